@@ -0,0 +1,91 @@
+#ifndef _ALGORITHM_REGISTRY_H_
+#define _ALGORITHM_REGISTRY_H_
+
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Aperture {
+
+class Environment;
+class ParticlePusher;
+class CurrentDepositer;
+class FieldSolver;
+
+////////////////////////////////////////////////////////////////////////////////
+///  Implementations of one kind of module, by name, so that the one used is
+///  picked from the config file at startup. There is one registry for each
+///  of ParticlePusher, CurrentDepositer and FieldSolver, which comes with
+///  the implementations in this library already added, the first of them
+///  being the default. More can be added before the PICSim is constructed.
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class AlgorithmRegistry {
+ public:
+  typedef std::function<std::unique_ptr<T>(const Environment&)> factory_t;
+
+  struct Entry {
+    std::string name;
+    std::string description;
+    factory_t create;
+  };
+
+  static AlgorithmRegistry& instance();
+
+  /// Add an implementation, or replace the one with the same name
+  void add(const std::string& name, const std::string& description,
+           const factory_t& factory) {
+    for (auto& entry : m_entries) {
+      if (entry.name == name) {
+        entry = Entry{name, description, factory};
+        return;
+      }
+    }
+    m_entries.push_back(Entry{name, description, factory});
+  }
+
+  bool has(const std::string& name) const { return find(name) != nullptr; }
+  /// Throws std::invalid_argument for a name that is not registered
+  std::unique_ptr<T> create(const std::string& name,
+                            const Environment& env) const;
+
+  const std::vector<Entry>& entries() const { return m_entries; }
+  const std::string& default_name() const { return m_entries.front().name; }
+  /// What the registry holds, and the config key that selects from it
+  const std::string& kind() const { return m_kind; }
+  const std::string& config_key() const { return m_config_key; }
+
+ private:
+  AlgorithmRegistry(const std::string& kind, const std::string& config_key)
+      : m_kind(kind), m_config_key(config_key) {}
+
+  const Entry* find(const std::string& name) const {
+    for (auto& entry : m_entries)
+      if (entry.name == name) return &entry;
+    return nullptr;
+  }
+
+  std::string m_kind, m_config_key;
+  std::vector<Entry> m_entries;
+};  // ----- end of class AlgorithmRegistry -----
+
+template <>
+AlgorithmRegistry<ParticlePusher>& AlgorithmRegistry<ParticlePusher>::instance();
+template <>
+AlgorithmRegistry<CurrentDepositer>&
+AlgorithmRegistry<CurrentDepositer>::instance();
+template <>
+AlgorithmRegistry<FieldSolver>& AlgorithmRegistry<FieldSolver>::instance();
+
+extern template class AlgorithmRegistry<ParticlePusher>;
+extern template class AlgorithmRegistry<CurrentDepositer>;
+extern template class AlgorithmRegistry<FieldSolver>;
+
+/// Print the contents of all the registries, for --list-algorithms
+void list_algorithms(std::ostream& os);
+
+}  // namespace Aperture
+
+#endif  // _ALGORITHM_REGISTRY_H_
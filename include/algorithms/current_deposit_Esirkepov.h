@@ -3,6 +3,7 @@
 
 #include "current_depositer.h"
 #include "sim_environment.h"
+#include "algorithms/interpolation.h"
 
 namespace Aperture {
 
@@ -12,18 +13,25 @@ class CurrentDepositer_Esirkepov : public CurrentDepositer {
   virtual ~CurrentDepositer_Esirkepov();
 
   virtual void deposit(SimData& data, double dt);
+
+  virtual void begin_deposit(SimData& data);
+  virtual void deposit_range(DepositWindow& window, const Particles& particles,
+                             double dt, Index_t begin, Index_t end);
+  virtual void finish_deposit(SimData& data);
   void normalize_current(const vfield& I, vfield& J);
   void normalize_density(const sfield& Q, sfield& rho, sfield& V);
   void normalize_velocity(const sfield& rho, sfield& V);
 
  private:
-  void split_delta_rho(vfield& J, sfield& Rho, const Particles& part,
-                       double dt);
-  void split_delta_rho(sfield& J, sfield& Rho, const Particles& part,
-                       double dt);
-
-  void scan_current(vfield& J);
-  void scan_current(sfield& J);
+  void deposit_species(SimData& data, Index_t sp, double dt);
+
+  // Versions for a fixed interpolation order, which deposit_range and
+  // deposit_species select from m_interp
+  template <int Order>
+  void deposit_range(DepositWindow& window, const Particles& particles,
+                     double dt, Index_t begin, Index_t end);
+  template <int Order>
+  void deposit_species(SimData& data, Index_t sp, double dt);
 
   const Environment& m_env;
   // int m_deposit_order = 3;
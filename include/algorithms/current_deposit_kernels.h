@@ -0,0 +1,116 @@
+#ifndef _CURRENT_DEPOSIT_KERNELS_H_
+#define _CURRENT_DEPOSIT_KERNELS_H_
+
+#include "algorithms/interpolation.h"
+#include "data/enum_types.h"
+#include "data/particle_data.h"
+#include "utils/util_functions.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Aperture {
+
+// 1D charge conserving deposit kernels of a fixed interpolation order. J
+// and Rho are arrays that start at cell offset of the grid. J[i] is the
+// current through the face between cells i and i + 1. Particles with the
+// ignore_current flag only deposit their charge. Rho can be null when only
+// the current is needed.
+
+/// Esirkepov deposit of particle n: the change of its weight in every cell
+/// of the stencil goes into J, and a prefix sum over the grid afterwards
+/// turns it into the current
+template <int Order>
+void
+deposit_delta_rho(Scalar* J, Scalar* Rho, int offset, const particle_data& part,
+                  const Pos_t* dx1, Index_t n, Scalar charge, double delta,
+                  double dt) {
+  typedef shape_function<Order> shape;
+
+  int c = part.cell[n];
+  int c_p = c;
+  double x = part.x1[n];
+  double x_p = x - dx1[n];
+  c_p += std::floor(x_p);
+  x_p -= (double)c_p - c;
+
+  // Weights after (s1) and before (s0) the move, on the same cells
+  int first = std::min(c, c_p) - shape::reach - 1;
+  double s1[shape::width], s0[shape::width];
+  shape::stencil(x, c, first, s1);
+  if (!check_bit(part.flag[n], ParticleFlag::ignore_current)) {
+    shape::stencil(x_p, c_p, first, s0);
+    for (int k = 0; k < shape::width; k++)
+      J[first + k - offset] += -charge * (s1[k] - s0[k]) * delta / dt;
+  }
+  if (Rho == nullptr) return;
+  for (int k = 0; k < shape::width; k++)
+    Rho[first + k - offset] += charge * s1[k];
+}
+
+/// Deposit the particles in [begin, end), putting the current through each
+/// face straight into J, so that no prefix sum is needed. The flux through
+/// a face is the change of the charge below it, from the cumulative shape
+/// function before and after the move, and the charge of a cell is the
+/// difference of its two faces, so the continuity equation holds to
+/// rounding. The weights are computed for a batch of particles at a time
+/// in a loop that vectorizes, and then added to the arrays one particle at
+/// a time.
+template <int Order>
+void
+deposit_flux(Scalar* J, Scalar* Rho, int offset, const particle_data& part,
+             const Pos_t* dx1, Index_t begin, Index_t end, Scalar charge,
+             double delta, double dt) {
+  typedef shape_function<Order> shape;
+  enum { width = shape::width, batch = 64 };
+  const double j_coef = charge * delta / dt;
+
+  int first[batch];
+  bool live[batch];
+  double flux[width][batch], rho[width][batch];
+  for (Index_t b0 = begin; b0 < end; b0 += batch) {
+    const int num = (int)std::min<Index_t>(batch, end - b0);
+#pragma omp simd
+    for (int b = 0; b < num; b++) {
+      Index_t n = b0 + b;
+      int c = part.cell[n];
+      live[b] = (part.cell[n] != MAX_CELL);
+      double x = part.x1[n];
+      double x_p = x - dx1[n];
+      // Cell of the old position, relative to c, and the lowest face that
+      // the charge can cross
+      int shift = (int)std::floor(x_p);
+      int lo = std::min(shift, 0) - shape::reach;
+      first[b] = c + lo - 1;
+      double coef =
+          (check_bit(part.flag[n], ParticleFlag::ignore_current) ? 0.0 : j_coef);
+
+      // Face k is the upper face of cell first + k
+      double q1_below = 0.0;
+      for (int k = 0; k < width; k++) {
+        double face = (double)(lo + k);
+        double q1 = shape::cumulative(face - x);
+        double q0 = shape::cumulative(face - x_p);
+        flux[k][b] = coef * (q0 - q1);
+        rho[k][b] = charge * (q1 - q1_below);
+        q1_below = q1;
+      }
+    }
+
+    // Neighbouring particles share cells, so this part stays scalar
+    for (int b = 0; b < num; b++) {
+      if (!live[b]) continue;
+      Scalar* J_b = J + first[b] - offset;
+      for (int k = 0; k < width; k++) J_b[k] += flux[k][b];
+    }
+    if (Rho == nullptr) continue;
+    for (int b = 0; b < num; b++) {
+      if (!live[b]) continue;
+      Scalar* Rho_b = Rho + first[b] - offset;
+      for (int k = 0; k < width; k++) Rho_b[k] += rho[k][b];
+    }
+  }
+}
+
+}  // namespace Aperture
+
+#endif  // _CURRENT_DEPOSIT_KERNELS_H_
@@ -0,0 +1,39 @@
+#ifndef _FIELD_SOLVER_FINITE_DIFF_H_
+#define _FIELD_SOLVER_FINITE_DIFF_H_
+
+#include "field_solver.h"
+
+namespace Aperture {
+
+////////////////////////////////////////////////////////////////////////////////
+///  Explicit Yee scheme on a Cartesian grid of any dimension, with the
+///  staggered operators of FiniteDiff. B is advanced by a full step from
+///  curl E, and then E from curl B and the current. E has the staggering of
+///  FieldType::E and B that of FieldType::B. The guard cells are filled by
+///  the communication callback, which is where the boundary conditions come
+///  in. In 1D curl B has no x component, so this is the same as the
+///  integral solver.
+////////////////////////////////////////////////////////////////////////////////
+class FieldSolver_FiniteDiff : public FieldSolver {
+ public:
+  FieldSolver_FiniteDiff(const Grid& g, const Grid& g_dual, int order = 2);
+  virtual ~FieldSolver_FiniteDiff();
+
+  virtual void update_fields(vfield_t& E, vfield_t& B, const vfield_t& J,
+                             double dt, double time = 0.0) override;
+  virtual void update_fields(SimData& data, double dt,
+                             double time = 0.0) override;
+
+  virtual void set_background_j(const vfield_t& J) override;
+
+  int order() const { return m_order; }
+
+ private:
+  int m_order;
+  vfield_t m_curlE, m_curlB;
+  vfield_t m_background_j;
+};  // ----- end of class FieldSolver_FiniteDiff -----
+
+}
+
+#endif  // _FIELD_SOLVER_FINITE_DIFF_H_
@@ -0,0 +1,60 @@
+#ifndef _FIELD_SOLVER_IMPLICIT_H_
+#define _FIELD_SOLVER_IMPLICIT_H_
+
+#include <vector>
+#include "algorithms/field_solver_integral.h"
+
+namespace Aperture {
+
+////////////////////////////////////////////////////////////////////////////////
+///  Semi-implicit version of the integral solver, which stays stable when
+///  the time step is longer than the plasma period. Before the push, the
+///  field is predicted at time n + theta from the linear response of the
+///  particles, chi = dt^2 q^2 / m dv/dp summed over the particles on every
+///  face, and from the current of the last step:
+///
+///      E_p = (E + theta dt (Jb - J)) / (1 + theta chi)
+///
+///  The particles are pushed in E_p, and then E is advanced from its old
+///  value with the current they deposit, as in the explicit solver, so the
+///  continuity equation still holds. theta = 1/2 is centered and theta = 0
+///  gives back the explicit scheme.
+////////////////////////////////////////////////////////////////////////////////
+class FieldSolver_Implicit : public FieldSolver_Integral {
+ public:
+  FieldSolver_Implicit(const Grid& g, const Grid& g_dual, double theta = 0.5);
+  virtual ~FieldSolver_Implicit();
+
+  using FieldSolver_Integral::update_fields;
+  virtual void update_fields(SimData& data, double dt, double time = 0.0) override;
+  virtual void update_fields_fused(SimData& data, double dt, Scalar* E_sum,
+                                   bool sum_species = true) override;
+  virtual void predict_fields(SimData& data, CurrentDepositer& depositer,
+                              double dt) override;
+
+  /// Add the response of the current through every face to the field there
+  /// to chi, for the particles in [begin, end) pushed with dt_sp in a field
+  /// advanced with dt
+  static void add_susceptibility(const Particles& particles,
+                                 const BackgroundGeometry& geom, double dt_sp,
+                                 double dt, Scalar* chi, Index_t begin,
+                                 Index_t end);
+  /// Replace E by the predicted field on the faces in [begin, end)
+  static void predict(Scalar* E, const Scalar* J, const Scalar* Jb,
+                      const Scalar* chi, double theta, double dt, int begin,
+                      int end);
+
+  double theta() const { return m_theta; }
+
+ private:
+  /// Put back the field from before the prediction
+  void restore(SimData& data);
+
+  double m_theta;
+  bool m_predicted = false;
+  std::vector<Scalar> m_E_old, m_chi;
+};  // ----- end of class FieldSolver_Implicit -----
+
+}
+
+#endif  // _FIELD_SOLVER_IMPLICIT_H_
@@ -14,6 +14,8 @@ class FieldSolver_Integral : public FieldSolver
 
   virtual void update_fields(vfield_t& E, vfield_t& B, const vfield_t& J, double dt, double time = 0.0) override;
   virtual void update_fields(SimData& data, double dt, double time = 0.0) override;
+  virtual void update_fields_fused(SimData& data, double dt, Scalar* E_sum,
+                                   bool sum_species = true) override;
   // virtual void compute_flux(const vfield_t& f, sfield_t& flux) override;
 
   void compute_E_update(vfield_t& E, const vfield_t& B, const vfield_t& J, double dt);
@@ -21,7 +23,7 @@ class FieldSolver_Integral : public FieldSolver
 
   virtual void set_background_j(const vfield_t& J);
 
- private:
+ protected:
   vfield_t m_dE, m_dB;
   vfield_t m_background_j;
 }; // ----- end of class field_solver_integral : public field_solver -----
@@ -0,0 +1,58 @@
+#ifndef _FINITE_DIFF_H_
+#define _FINITE_DIFF_H_
+
+#include "data/fields.h"
+#include "data/grid.h"
+#include "data/multi_array.h"
+
+namespace Aperture {
+
+////////////////////////////////////////////////////////////////////////////////
+///  Staggered finite difference operators on a Cartesian Quadmesh of 1 to 3
+///  dimensions. The derivative of a quantity that is not staggered in the
+///  direction of the derivative lives half a cell above it, and the other
+///  way around, so that
+///
+///      out[i] = (in[i + 1] - in[i]) / delta    for an unstaggered input
+///      out[i] = (in[i] - in[i - 1]) / delta    for a staggered input
+///
+///  at second order, and similarly with a four point stencil at fourth
+///  order. Results are computed in the bulk of the grid, starting one point
+///  lower in the directions where the result is staggered, so that the
+///  faces on the lower boundary are included. The guard cells of the input
+///  need to be filled already, at least order / 2 of them.
+///
+///  The grid is swept in tiles of block_rows rows of block_size points, and
+///  for a derivative along z each tile goes through all of the z range, so
+///  the rows needed by the next plane are still in cache. The loop along x
+///  is unit stride and vectorizes for all three directions.
+////////////////////////////////////////////////////////////////////////////////
+class FiniteDiff {
+ public:
+  typedef MultiArray<Scalar> array_type;
+  typedef VectorField<Scalar> vfield;
+  typedef ScalarField<Scalar> sfield;
+
+  /// Add factor times the derivative along dir of input, which has the
+  /// given stagger, to output
+  static void derivative(const Grid& grid, const array_type& input,
+                         array_type& output, int dir, Stagger_t stagger,
+                         Scalar factor = 1.0, int order = 2);
+  /// Same as derivative, one point at a time along the direction of the
+  /// derivative, for the tests and the benchmark
+  static void derivative_reference(const Grid& grid, const array_type& input,
+                                   array_type& output, int dir,
+                                   Stagger_t stagger, Scalar factor = 1.0,
+                                   int order = 2);
+
+  /// The output fields get the staggering of the result
+  static void compute_curl(const vfield& input, vfield& output, int order = 2);
+  static void compute_divergence(const vfield& input, sfield& output,
+                                 int order = 2);
+  static void compute_gradient(const sfield& input, vfield& output,
+                               int order = 2);
+};  // ----- end of class FiniteDiff -----
+
+}  // namespace Aperture
+
+#endif  // _FINITE_DIFF_H_
@@ -24,6 +24,11 @@ struct interp_nearest_grid_point {
   double operator()(double dx) const {
     return (std::abs(dx) <= 0.5 ? 1.0 : 0.0);
   }
+
+  // The cumulative functions give the fraction of the charge of a particle
+  // that lies below distance u from it, in units of the cell size. The
+  // weight of a cell is the difference between its two faces.
+  double cumulative(double u) const { return (u > 0.0 ? 1.0 : 0.0); }
 };
 
 struct interp_cloud_in_cell {
@@ -34,6 +39,10 @@ struct interp_cloud_in_cell {
     // return (abs_dx < 0.5 ? max(1.0 - abs_dx, 0.0) : abs_dx);
     return max(1.0 - abs_dx, 0.0);
   }
+
+  double cumulative(double u) const {
+    return std::min(std::max(u + 0.5, 0.0), 1.0);
+  }
 };
 
 struct interp_triangular_shaped_cloud {
@@ -50,6 +59,11 @@ struct interp_triangular_shaped_cloud {
       return 0.0;
     }
   }
+
+  double cumulative(double u) const {
+    double t = std::min(std::max(u, -1.0), 1.0);
+    return (t < 0.0 ? 0.5 * (1.0 + t) * (1.0 + t) : 1.0 - 0.5 * (1.0 - t) * (1.0 - t));
+  }
 };
 
 struct interp_piecewise_cubic {
@@ -67,9 +81,63 @@ struct interp_piecewise_cubic {
       return 0.0;
     }
   }
+
+  double cumulative(double u) const {
+    double t = std::min(std::max(u, -1.5), 1.5);
+    double lo = 1.5 + t, hi = 1.5 - t;
+    return (t < -0.5 ? lo * lo * lo / 6.0
+                     : (t > 0.5 ? 1.0 - hi * hi * hi / 6.0
+                                : 0.5 + t * (0.75 - t * t / 3.0)));
+  }
 };
+
+template <int Order>
+struct shape_of;
+
+template <>
+struct shape_of<0> { typedef interp_nearest_grid_point type; };
+template <>
+struct shape_of<1> { typedef interp_cloud_in_cell type; };
+template <>
+struct shape_of<2> { typedef interp_triangular_shaped_cloud type; };
+template <>
+struct shape_of<3> { typedef interp_piecewise_cubic type; };
 }
 
+////////////////////////////////////////////////////////////////////////////////
+///  Shape function of a fixed order, for the hot loops that should not switch
+///  on the order for every weight. The caller picks the instantiation once,
+///  from INTERPOLATION_ORDER, outside of the loop over particles.
+////////////////////////////////////////////////////////////////////////////////
+template <int Order>
+struct shape_function {
+  typedef typename detail::shape_of<Order>::type shape_type;
+  /// reach is the number of cells on either side of its own that the charge
+  /// of a particle extends into, and width is the number of cells it can
+  /// touch before and after moving by less than one cell
+  enum {
+    radius = shape_type::radius,
+    support = shape_type::support,
+    reach = (Order + 1) / 2,
+    width = 2 * reach + 3
+  };
+
+  /// Weights of a particle at relative position pos in cell p_cell, on the
+  /// width cells starting from first. Same as Interpolator::interp_cell with
+  /// no stagger
+  template <typename FloatT>
+  static void stencil(FloatT pos, int p_cell, int first, double* w) {
+    shape_type shape;
+    for (int k = 0; k < width; k++) {
+      FloatT x = ((double)(first + k) + 0.5) - (pos + (double)p_cell);
+      w[k] = shape(x);
+    }
+  }
+
+  /// Fraction of the charge that lies below distance u from the particle
+  static double cumulative(double u) { return shape_type().cumulative(u); }
+};
+
 // template <int Order>
 class Interpolator {
  public:
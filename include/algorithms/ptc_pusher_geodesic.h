@@ -4,6 +4,7 @@
 #include "algorithms/interpolation.h"
 #include "data/typedefs.h"
 #include "particle_pusher.h"
+#include "utils/simd.h"
 #include <array>
 
 namespace Aperture {
@@ -17,28 +18,47 @@ class ParticlePusher_Geodesic : public ParticlePusher {
 
   virtual void push(SimData& data, double dt);
 
-  void lorentz_push(Particles& particles, Index_t idx, double x,
-                    const VectorField<Scalar>& E, const VectorField<Scalar>& B,
-                    double dt);
-  void move_ptc(Particles& particles, Index_t idx, double x, const Grid& grid,
-                double dt);
-#ifdef __AVX2__
-  void lorentz_push_avx2(particle_data& data, Index_t idx, const VectorField<Scalar>& E, double dt);
+  /// Push and move one species in the given electric field, using the
+  /// vectorized kernels where available and all the OpenMP threads
+  void push(Particles& particles, const VectorField<Scalar>& E,
+            const BackgroundGeometry& geom, double dt);
+  /// Push and move the particles in [begin, end) on the calling thread
+  virtual void push_range(Particles& particles, const VectorField<Scalar>& E,
+                          const BackgroundGeometry& geom, double dt,
+                          Index_t begin, Index_t end);
 
-  void move_ptc_avx2(particle_data& data, Index_t idx, const Quadmesh& mesh, double dt);
-#endif // __AVX2__
+  // beta, inv_b2p1 and force are the background quantities from
+  // BackgroundGeometry at the particle position
+  void lorentz_push(Particles& particles, Index_t idx, double beta,
+                    double inv_b2p1, double force,
+                    const VectorField<Scalar>& E, double dt);
+  /// Move the particle and apply the boundary condition to its new cell.
+  /// A particle leaving through an absorbing boundary is added to absorbed.
+  void move_ptc(Particles& particles, Index_t idx, double beta,
+                double inv_b2p1, const Grid& grid, double dt,
+                std::vector<Index_t>& absorbed);
 
-  void handle_boundary(SimData& data);
+  virtual void handle_boundary(SimData& data,
+                               const std::vector<Index_t>& first_new);
+  /// Apply the boundary condition to a single particle, which must not be
+  /// an empty slot. An absorbed particle is only marked for erasing.
+  void handle_boundary(Particles& ptc, Index_t n, const Quadmesh& mesh);
   // void set_interp_order(int order);
 
   void extra_force(Particles& particles, Index_t idx, double x, const Grid& grid,
                    double dt);
   // virtual void print() { std::cout << "This is particle pusher" << std::endl; }
 
+  /// Select the instruction set for the push. Levels not supported by the
+  /// cpu fall back to the best available one.
+  self_type& set_simd_level(SimdLevel level);
+  SimdLevel simd_level() const { return m_simd_level; }
+
  private:
   // int m_order = 3;
   // Interpolator m_interp;
   bool m_radiation;
+  SimdLevel m_simd_level;
 
 };  // ----- end of class ParticlePusher_Geodesic : public ParticlePusher -----
 
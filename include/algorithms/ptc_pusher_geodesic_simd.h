@@ -0,0 +1,46 @@
+#ifndef _PTC_PUSHER_GEODESIC_SIMD_H_
+#define _PTC_PUSHER_GEODESIC_SIMD_H_
+
+#include "data/particle_data.h"
+#include "data/typedefs.h"
+#include <vector>
+
+namespace Aperture {
+
+namespace detail {
+
+/// Everything the vectorized geodesic push needs to know about the grid
+/// and the species, precomputed once per call
+struct geodesic_push_params {
+  const Scalar* E;         ///< Pointer to the E1 component
+  Pos_t* dx1;              ///< Particles::displacement of the species
+  const Scalar* beta;      ///< Background tables from BackgroundGeometry
+  const Scalar* inv_b2p1;
+  const Scalar* force;
+  double q_dt_over_m;      ///< charge * dt / mass
+  double dt;
+  double dt_over_delta;    ///< dt / delta, converts velocity to cell displacement
+
+  // Boundary condition, applied to the cell after the move. Cells below
+  // wrap_lower or from wrap_upper on are shifted by wrap_shift (0 unless the
+  // box is periodic), and the index of a particle that ends up below
+  // absorb_lower or from absorb_upper on is added to absorbed.
+  int wrap_lower, wrap_upper, wrap_shift;
+  int absorb_lower, absorb_upper;
+  std::vector<Index_t>* absorbed;
+};
+
+// These push particles in [begin, end) in full vectors only, and return the
+// index where they stopped. The remainder is left for the scalar path.
+Index_t geodesic_push_avx2(particle_data& ptc,
+                           const geodesic_push_params& params,
+                           Index_t begin, Index_t end);
+Index_t geodesic_push_avx512(particle_data& ptc,
+                             const geodesic_push_params& params,
+                             Index_t begin, Index_t end);
+
+}
+
+}
+
+#endif  // _PTC_PUSHER_GEODESIC_SIMD_H_
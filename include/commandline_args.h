@@ -35,6 +35,7 @@ class CommandArgs
   int dimx() const { return m_dimx; }
   int dimy() const { return m_dimy; }
   int dimz() const { return m_dimz; }
+  int threads() const { return m_threads; }
   uint32_t steps() const { return m_steps; }
   uint32_t data_interval() const { return m_data_interval; }
   const std::string& conf_filename() const { return m_conf_filename; }
@@ -42,6 +43,7 @@ class CommandArgs
  private:
   // default values provided in the constructor
   int m_dimx = 1, m_dimy = 1, m_dimz = 1;
+  int m_threads = 1;
   uint32_t m_steps, m_data_interval;
   std::string m_conf_filename;
   std::unique_ptr<cxxopts::Options> m_options;
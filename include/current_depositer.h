@@ -4,9 +4,64 @@
 #include "sim_data.h"
 #include "sim_environment.h"
 #include "data/callbacks.h"
+#include <algorithm>
+#include <vector>
 
 namespace Aperture {
 
+/// A small window onto the J and Rho arrays of one species, so that the
+/// deposit of a tile of particles happens in a cache resident buffer. The
+/// window is written back and moved whenever a particle falls outside of it.
+/// Contributions are still added in particle order, so the result is
+/// identical to depositing directly into the arrays.
+class DepositWindow {
+ public:
+  DepositWindow(ScalarField<Scalar>& J, ScalarField<Scalar>& Rho,
+                int size = 64)
+      : DepositWindow(&J(0), &Rho(0), J.grid().mesh().dims[0], size) {}
+  /// A window onto plain arrays of dim cells. Rho can be null when only the
+  /// current is deposited
+  DepositWindow(Scalar* J, Scalar* Rho, int dim, int size = 64)
+      : m_field_J(J), m_field_Rho(Rho), m_dim(dim), m_lo(0) {
+    m_size = std::min(size, dim);
+    m_J.assign(J, J + m_size);
+    if (Rho != nullptr) m_Rho.assign(Rho, Rho + m_size);
+  }
+  ~DepositWindow() { flush(); }
+
+  /// Whether cells lo to hi (inclusive) fit in the window at once
+  bool fits(int lo, int hi) const { return hi - lo < m_size; }
+  /// Make sure cells lo to hi (inclusive) are in the window
+  void cover(int lo, int hi) {
+    if (lo < m_lo || hi >= m_lo + m_size) move_to(lo, hi);
+  }
+  /// Write the window back to the arrays
+  void flush() {
+    std::copy(m_J.begin(), m_J.end(), m_field_J + m_lo);
+    if (m_field_Rho != nullptr)
+      std::copy(m_Rho.begin(), m_Rho.end(), m_field_Rho + m_lo);
+  }
+
+  Scalar* J() { return m_J.data(); }
+  Scalar* Rho() { return (m_field_Rho != nullptr ? m_Rho.data() : nullptr); }
+  int offset() const { return m_lo; }
+
+ private:
+  void move_to(int lo, int hi) {
+    flush();
+    // Center the window on the requested range, but keep it inside the grid
+    m_lo = std::max(0, std::min(m_dim - m_size, lo - (m_size - (hi - lo + 1)) / 2));
+    std::copy_n(m_field_J + m_lo, m_size, m_J.begin());
+    if (m_field_Rho != nullptr)
+      std::copy_n(m_field_Rho + m_lo, m_size, m_Rho.begin());
+  }
+
+  Scalar* m_field_J;
+  Scalar* m_field_Rho;
+  std::vector<Scalar> m_J, m_Rho;
+  int m_dim, m_lo, m_size;
+};  // ----- end of class DepositWindow -----
+
 class CurrentDepositer {
  public:
   typedef VectorField<Scalar> vfield;
@@ -17,6 +72,94 @@ class CurrentDepositer {
 
   virtual void deposit(SimData& data, double dt) = 0;
 
+  // The deposit can also be done in stages, so that it can be fused with
+  // the push: begin_deposit clears the arrays, deposit_range deposits a range
+  // of particles of one species through a window, and finish_deposit does
+  // the communication and the periodic boundary
+  virtual void begin_deposit(SimData& data) = 0;
+  virtual void deposit_range(DepositWindow& window, const Particles& particles,
+                             double dt, Index_t begin, Index_t end) = 0;
+  virtual void finish_deposit(SimData& data) = 0;
+
+  // The particles of a species are deposited in chunks, each into a private
+  // buffer, so that threads can work on the chunks concurrently. The buffers
+  // are then summed in a fixed order, so the result depends on the number of
+  // chunks but not on the number of threads. Chunk k covers the particles
+  // from k * chunk_size() on. With a single chunk the particles go straight
+  // into J and Rho.
+
+  /// Split the particles of species sp into chunks that deposit into its
+  /// current and charge density, and clear the buffers. Returns the number
+  /// of chunks. chunk_Rho is null when only the current is deposited.
+  Index_t begin_chunks(SimData& data, Index_t sp) {
+    return begin_chunks(current_target(data, sp),
+                        (data.deposit_rho[sp] ? data.Rho[sp].ptr() : nullptr),
+                        data.J.grid().mesh().dims[0],
+                        data.particles[sp].number());
+  }
+  /// Split num particles into chunks that deposit into the dim cells of J
+  /// and Rho, where Rho can be null
+  Index_t begin_chunks(Scalar* J, Scalar* Rho, int dim, Index_t num) {
+    // Chunks are a multiple of the push and fused block sizes
+    const Index_t min_chunk_size = 4096;
+    Index_t size = (num + m_max_chunks - 1) / m_max_chunks;
+    m_chunk_size = std::max<Index_t>(
+        1, (size + min_chunk_size - 1) / min_chunk_size) * min_chunk_size;
+    m_num_chunks = std::max<Index_t>(1, (num + m_chunk_size - 1) / m_chunk_size);
+    m_dim = dim;
+    m_J_target = J;
+    m_Rho_target = Rho;
+    if (m_num_chunks > 1) {
+      m_chunk_J.resize(m_num_chunks);
+      m_chunk_Rho.resize(m_num_chunks);
+#pragma omp parallel for schedule(static)
+      for (Index_t k = 0; k < m_num_chunks; k++) {
+        m_chunk_J[k].assign(m_dim, 0.0);
+        if (m_Rho_target != nullptr) m_chunk_Rho[k].assign(m_dim, 0.0);
+      }
+    }
+    return m_num_chunks;
+  }
+  Index_t chunk_size() const { return m_chunk_size; }
+  int chunk_dim() const { return m_dim; }
+  Scalar* chunk_J(Index_t k) {
+    return (m_num_chunks > 1 ? m_chunk_J[k].data() : m_J_target);
+  }
+  Scalar* chunk_Rho(Index_t k) {
+    if (m_num_chunks > 1 && m_Rho_target != nullptr)
+      return m_chunk_Rho[k].data();
+    return m_Rho_target;
+  }
+  /// Add the chunk buffers to J and Rho with a pairwise tree reduction
+  void reduce_chunks() {
+    const Index_t n = m_num_chunks;
+    if (n <= 1) return;
+    const bool with_rho = (m_Rho_target != nullptr);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < m_dim; i++) {
+      for (Index_t stride = 1; stride < n; stride *= 2) {
+        for (Index_t k = 0; k + stride < n; k += 2 * stride) {
+          m_chunk_J[k][i] += m_chunk_J[k + stride][i];
+          if (with_rho) m_chunk_Rho[k][i] += m_chunk_Rho[k + stride][i];
+        }
+      }
+      m_J_target[i] += m_chunk_J[0][i];
+      if (with_rho) m_Rho_target[i] += m_chunk_Rho[0][i];
+    }
+  }
+
+  /// The array the current of species sp goes into this step, see
+  /// SimData::keep_current
+  static Scalar* current_target(SimData& data, Index_t sp) {
+    return (data.keep_current[sp] ? data.J_s[sp].ptr() : data.J.ptr(0));
+  }
+
+  void set_deposit_chunks(int n) { m_max_chunks = std::max(n, 1); }
+  /// With the fused field update, finish_deposit adds up the species into J
+  /// only within two guard widths of the ends of the grid, which is what the
+  /// guard cell exchange and the periodic boundary need. The field solver
+  /// sums the rest (see FieldSolver::update_fields_fused)
+  void set_edge_sum_only(bool b) { m_edge_sum_only = b; }
   void set_periodic(bool p) { m_periodic = p; }
   void set_interp_order(int n) { m_interp = n; }
   void register_current_callback(const vfield_comm_callback& callback) {
@@ -28,9 +171,16 @@ class CurrentDepositer {
 
  protected:
   bool m_periodic = false;
+  bool m_edge_sum_only = false;
   int m_interp = 1;
   vfield_comm_callback m_comm_J;
   sfield_comm_callback m_comm_rho;
+
+  int m_max_chunks = 16;
+  Index_t m_num_chunks = 1, m_chunk_size = 0;
+  int m_dim = 0;
+  Scalar *m_J_target = nullptr, *m_Rho_target = nullptr;
+  std::vector<std::vector<Scalar>> m_chunk_J, m_chunk_Rho;
 };  // ----- end of class current_depositer -----
 
 }  // namespace Aperture
@@ -0,0 +1,70 @@
+#ifndef _CURRENT_FILTER_H_
+#define _CURRENT_FILTER_H_
+
+#include "data/callbacks.h"
+#include "data/fields.h"
+#include <vector>
+
+namespace Aperture {
+
+////////////////////////////////////////////////////////////////////////////////
+///  Digital filter on the current before the field update, to bring down
+///  the particle shot noise. Every pass is the binomial filter (1, 2, 1) / 4,
+///  and an optional last pass with (1 - a, 2a, 1 - a) / 2, where a = 1 + N/2
+///  for N passes, compensates the damping of the long wavelengths to second
+///  order. All the passes are done in one sweep over the grid, block by
+///  block. A face on a physical boundary keeps its current. Across the
+///  other ends every pass needs one more guard cell, so the guard cells are
+///  filled once for up to guard - 1 passes, from the other end of a periodic
+///  domain, or through the communication callback from the neighbouring
+///  domains.
+////////////////////////////////////////////////////////////////////////////////
+class CurrentFilter {
+ public:
+  /// periodic means that the domain wraps around onto itself, which is
+  /// only the case when it is not split along x
+  CurrentFilter(int passes, bool compensate = false, bool periodic = false);
+  ~CurrentFilter();
+
+  /// Whether the lower and upper ends of the domain are physical
+  /// boundaries, rather than faces shared with a neighbouring domain. Both
+  /// are unless the domain is periodic
+  void set_boundary(bool lower, bool upper) {
+    m_boundary[0] = lower;
+    m_boundary[1] = upper;
+  }
+  /// Called to fill the guard cells of J from the neighbouring domains
+  void register_comm_callback(const vfield_comm_callback& callback) {
+    m_comm_callback_vfield = callback;
+  }
+
+  /// Filter the first component of J in place
+  void apply(VectorField<Scalar>& J);
+
+  /// Apply passes binomial passes, and the compensation pass if asked, to
+  /// the values in [begin, end) of data. The two end points stay fixed.
+  /// The result does not depend on the size of the blocks
+  static void filter(Scalar* data, int begin, int end, int passes,
+                     bool compensate, std::vector<Scalar>& buffer);
+
+  int passes() const { return m_passes; }
+  bool compensate() const { return m_compensate; }
+
+ private:
+  /// passes binomial passes, then a compensation pass with weight alpha on
+  /// the center unless alpha is zero
+  static void sweep(Scalar* data, int begin, int end, int passes,
+                    Scalar alpha, std::vector<Scalar>& buffer);
+  void fill_guard_cells(VectorField<Scalar>& J);
+
+  int m_passes;
+  bool m_compensate;
+  bool m_periodic;
+  bool m_boundary[2];
+  std::vector<Scalar> m_buffer;
+  vfield_comm_callback m_comm_callback_vfield;
+};  // ----- end of class CurrentFilter -----
+
+}  // namespace Aperture
+
+#endif  // _CURRENT_FILTER_H_
@@ -0,0 +1,63 @@
+#ifndef _BACKGROUND_GEOMETRY_H_
+#define _BACKGROUND_GEOMETRY_H_
+
+#include <functional>
+#include <vector>
+#include "data/grid.h"
+#include "data/typedefs.h"
+
+namespace Aperture {
+
+////////////////////////////////////////////////////////////////////////////////
+///  Cache of the background quantities the geodesic pusher needs, tabulated
+///  at the cell edges of a 1D grid. Particles interpolate linearly between
+///  the two edges of their cell, using cell and x1 directly, so no position
+///  or transcendental function has to be computed per particle.
+///
+///  The background is given by a beta profile, a function of the position
+///  normalized by the size of the grid. By default this is beta_phi, but any
+///  other profile can be plugged in with set_beta_profile.
+////////////////////////////////////////////////////////////////////////////////
+class BackgroundGeometry {
+ public:
+  typedef std::function<double(double)> profile_t;
+
+  BackgroundGeometry();
+  BackgroundGeometry(const Grid& grid);
+  BackgroundGeometry(const Grid& grid, const profile_t& beta);
+  ~BackgroundGeometry();
+
+  /// Tabulate everything from the given beta profile
+  void set_beta_profile(const Grid& grid, const profile_t& beta);
+
+  /// Tables indexed by cell, holding the values at the lower cell edges
+  const Scalar* beta() const { return m_beta.data(); }
+  const Scalar* inv_b2p1() const { return m_inv_b2p1.data(); }
+  /// Prefactor of the geodesic force, to be multiplied by f^2 dt / gamma
+  const Scalar* force() const { return m_force.data(); }
+
+  Scalar beta(int cell, Pos_t x1) const {
+    return interp(m_beta, cell, x1);
+  }
+  /// 1/(1 + beta^2) given beta at the same position. The interpolated table
+  /// value is refined by one Newton iteration of the reciprocal, which
+  /// squares its error without a division.
+  Scalar inv_b2p1(int cell, Pos_t x1, Scalar beta) const {
+    Scalar t = interp(m_inv_b2p1, cell, x1);
+    return t * (2.0 - t * (1.0 + beta * beta));
+  }
+  Scalar force(int cell, Pos_t x1) const {
+    return interp(m_force, cell, x1);
+  }
+
+ private:
+  Scalar interp(const std::vector<Scalar>& v, int cell, Pos_t x1) const {
+    return v[cell] + (v[cell + 1] - v[cell]) * x1;
+  }
+
+  std::vector<Scalar> m_beta, m_inv_b2p1, m_force;
+};  // ----- end of class BackgroundGeometry -----
+
+}
+
+#endif  // _BACKGROUND_GEOMETRY_H_
@@ -7,60 +7,84 @@
 #include "boost/fusion/include/zip_view.hpp"
 #include "data/detail/particle_data_impl.hpp"
 #include "data/particle_base.h"
+#include "utils/logger.h"
 #include "utils/memory.h"
 #include "utils/timer.h"
 #include <algorithm>
+#include <limits>
 #include <numeric>
 #include <stdexcept>
 #include <type_traits>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 // #include "types/particles.h"
 
 namespace Aperture {
 
 using boost::fusion::at_c;
 
+template <typename ParticleClass>
+const std::size_t ParticleBase<ParticleClass>::chunk_size;
+
+template <typename ParticleClass>
+const std::size_t ParticleBase<ParticleClass>::merge_fraction;
+
 template <typename ParticleClass>
 ParticleBase<ParticleClass>::ParticleBase()
-    : m_numMax(0), m_number(0), m_sorted(true), m_data_ptr(nullptr) {
+    : m_numMax(0), m_capacity(0), m_peak_capacity(0), m_number(0),
+      m_sorted(true), m_data_ptr(nullptr), m_buffer_max(0), m_tiled(false),
+      m_moved(0) {
   boost::fusion::for_each(m_data, [](auto& x) { x = nullptr; });
+  boost::fusion::for_each(m_buffer, [](auto& x) { x = nullptr; });
 }
 
 template <typename ParticleClass>
 ParticleBase<ParticleClass>::ParticleBase(std::size_t max_num)
-    : m_numMax(max_num), m_number(0), m_sorted(true) {
+    : m_numMax(max_num), m_capacity(0), m_peak_capacity(0), m_number(0),
+      m_sorted(true), m_buffer_max(0), m_tiled(false), m_moved(0) {
+  boost::fusion::for_each(m_buffer, [](auto& x) { x = nullptr; });
   std::cout << "New particle array with size " << max_num << std::endl;
   alloc_mem(max_num);
-  m_index.resize(max_num, 0);
-  m_index_bak.resize(max_num, 0);
   initialize();
 }
 
 template <typename ParticleClass>
 ParticleBase<ParticleClass>::ParticleBase(
-    const ParticleBase<ParticleClass>& other) {
-  std::size_t n = other.m_numMax;
-  m_numMax = n;
+    const ParticleBase<ParticleClass>& other)
+    : m_numMax(other.m_numMax), m_capacity(0), m_peak_capacity(0),
+      m_number(0), m_sorted(other.m_sorted), m_buffer_max(0),
+      m_bin_offset(other.m_bin_offset), m_tiles(other.m_tiles),
+      m_tiled(other.m_tiled), m_moved(0) {
+  boost::fusion::for_each(m_buffer, [](auto& x) { x = nullptr; });
+  alloc_mem(m_numMax);
+  // Only the slots in use need to be copied, the rest are empty anyway
+  reserve(other.m_capacity);
+  copy_from(other, other.m_capacity);
   m_number = other.m_number;
-  m_sorted = other.m_sorted;
-
-  alloc_mem(n);
-  m_index.resize(n);
-  m_index_bak.resize(n);
-  copy_from(other, n);
 }
 
 template <typename ParticleClass>
 ParticleBase<ParticleClass>::ParticleBase(ParticleBase<ParticleClass>&& other) {
   m_numMax = other.m_numMax;
+  m_capacity = other.m_capacity;
+  m_peak_capacity = other.m_peak_capacity;
   m_number = other.m_number;
   m_sorted = other.m_sorted;
 
   // m_data_ptr = other.m_data_ptr;
   m_data = other.m_data;
-  m_index.resize(other.m_numMax);
-  m_index_bak.resize(other.m_numMax);
+  m_buffer = other.m_buffer;
+  m_buffer_max = other.m_buffer_max;
+  m_bin_offset = std::move(other.m_bin_offset);
+  m_tiles = other.m_tiles;
+  m_tiled = other.m_tiled;
+  m_moved = other.m_moved;
+  other.m_tiled = false;
 
   boost::fusion::for_each(other.m_data, [](auto& x) { x = nullptr; });
+  boost::fusion::for_each(other.m_buffer, [](auto& x) { x = nullptr; });
+  other.m_numMax = other.m_capacity = other.m_number = other.m_buffer_max = 0;
   // other.m_data_ptr = nullptr;
 }
 
@@ -73,57 +97,204 @@ template <typename ParticleClass>
 void
 ParticleBase<ParticleClass>::alloc_mem(std::size_t max_num,
                                        std::size_t alignment) {
-  alloc_struct_of_arrays(m_data, max_num, alignment);
+  // Pages are aligned to more than any alignment asked for
+  reserve_struct_of_arrays(m_data, max_num);
+  m_capacity = 0;
 }
 
 template <typename ParticleClass>
 void
 ParticleBase<ParticleClass>::free_mem() {
-  free_struct_of_arrays(m_data);
+  free_reserved_struct_of_arrays(m_data, m_numMax);
+  free_reserved_struct_of_arrays(m_buffer, m_buffer_max);
+  m_capacity = 0;
+  m_buffer_max = 0;
 }
 
 template <typename ParticleClass>
 void
 ParticleBase<ParticleClass>::initialize() {
-  erase(0, m_numMax);
+  erase(0, m_capacity);
   m_number = 0;
+  m_tiled = false;
 }
 
 template <typename ParticleClass>
 void
 ParticleBase<ParticleClass>::resize(std::size_t max_num) {
-  m_numMax = max_num;
-  if (m_number > max_num) m_number = max_num;
   free_mem();
+  m_numMax = max_num;
   alloc_mem(max_num);
-  m_index.resize(max_num, 0);
-  m_index_bak.resize(max_num, 0);
   initialize();
 }
 
+template <typename ParticleClass>
+void
+ParticleBase<ParticleClass>::reserve(std::size_t num) {
+  if (num <= m_capacity) return;
+  if (num > m_numMax) {
+    std::size_t max_num = std::max(num, 2 * m_numMax);
+    max_num = (max_num + chunk_size - 1) / chunk_size * chunk_size;
+    Logger::print_info("Particle array grows beyond {} to {} particles",
+                       m_numMax, max_num);
+    grow_struct_of_arrays(m_data, m_numMax, max_num);
+    if (m_buffer_max > 0) {
+      grow_struct_of_arrays(m_buffer, m_buffer_max, max_num);
+      m_buffer_max = max_num;
+    }
+    m_numMax = max_num;
+  }
+  std::size_t old_capacity = m_capacity;
+  m_capacity =
+      std::min(m_numMax, (num + chunk_size - 1) / chunk_size * chunk_size);
+  m_peak_capacity = std::max(m_peak_capacity, m_capacity);
+  erase(old_capacity, m_capacity - old_capacity);
+}
+
+template <typename ParticleClass>
+void
+ParticleBase<ParticleClass>::release_unused() {
+  std::size_t keep = m_number + m_number / 4 + chunk_size;
+  keep = std::min(m_capacity, (keep + chunk_size - 1) / chunk_size * chunk_size);
+  if (keep == m_capacity) return;
+  release_struct_of_arrays(m_data, keep, m_capacity);
+  if (m_buffer_max > 0) release_struct_of_arrays(m_buffer, keep, m_capacity);
+  m_capacity = keep;
+  if (m_index.size() > keep) {
+    m_index.resize(keep);
+    m_index.shrink_to_fit();
+  }
+}
+
 template <typename ParticleClass>
 void
 ParticleBase<ParticleClass>::erase(std::size_t pos, std::size_t amount) {
-  if (pos + amount > m_numMax) amount = m_numMax - pos;
+  if (pos >= m_capacity) return;
+  if (pos + amount > m_capacity) amount = m_capacity - pos;
   // std::cout << "Erasing from " << pos << " for " << amount << " number of
   // particles" << std::endl;
 
+  // Whole chunks are filled by all the threads, which is also where new
+  // chunks are first touched
+  const std::size_t num_chunks = (amount + chunk_size - 1) / chunk_size;
   typedef boost::fusion::vector<array_type&, const ParticleClass&> seq;
   boost::fusion::for_each(
       boost::fusion::zip_view<seq>(seq(m_data, ParticleClass())),
-      [this, pos, amount](const auto& x) {
-        std::fill_n(boost::fusion::at_c<0>(x) + pos, amount,
-                    boost::fusion::at_c<1>(x));
+      [pos, amount, num_chunks](const auto& x) {
+        auto array = boost::fusion::at_c<0>(x);
+        auto value = boost::fusion::at_c<1>(x);
+#pragma omp parallel for schedule(static) if (num_chunks > 1)
+        for (std::size_t k = 0; k < num_chunks; k++) {
+          std::size_t begin = k * chunk_size;
+          std::size_t n = std::min(chunk_size, amount - begin);
+          std::fill_n(array + pos + begin, n, value);
+        }
       });
 }
 
+template <typename ParticleClass>
+void
+ParticleBase<ParticleClass>::erase_marked() {
+  if (m_marked.empty()) return;
+
+  typedef boost::fusion::vector<array_type&, const ParticleClass&> seq;
+  boost::fusion::for_each(
+      boost::fusion::zip_view<seq>(seq(m_data, ParticleClass())),
+      [this](const auto& x) {
+        auto array = boost::fusion::at_c<0>(x);
+        for (auto pos : m_marked) array[pos] = boost::fusion::at_c<1>(x);
+      });
+  m_marked.clear();
+}
+
+template <typename ParticleClass>
+std::size_t
+ParticleBase<ParticleClass>::count_live() const {
+  std::size_t live = 0;
+#pragma omp parallel for reduction(+ : live)
+  for (Index_t i = 0; i < m_number; i++)
+    if (!is_empty(i)) live += 1;
+  return live;
+}
+
+template <typename ParticleClass>
+void
+ParticleBase<ParticleClass>::compact() {
+  erase_marked();
+  // Count the particles in fixed size chunks, and scan the counts to find
+  // where each chunk goes. The result does not depend on the number of
+  // threads.
+  const Index_t chunk_size = 4096;
+  const Index_t num = m_number;
+  if (num > std::numeric_limits<uint32_t>::max())
+    throw std::runtime_error("Too many particles for 32 bit indices!");
+  const Index_t num_chunks = (num + chunk_size - 1) / chunk_size;
+  m_chunk_offset.assign(num_chunks + 1, 0);
+#pragma omp parallel for schedule(static)
+  for (Index_t k = 0; k < num_chunks; k++) {
+    Index_t end = std::min(num, (k + 1) * chunk_size);
+    Index_t count = 0;
+    for (Index_t i = k * chunk_size; i < end; i++)
+      count += (m_data.cell[i] != MAX_CELL);
+    m_chunk_offset[k + 1] = count;
+  }
+  std::partial_sum(m_chunk_offset.begin(), m_chunk_offset.end(),
+                   m_chunk_offset.begin());
+  const Index_t live = m_chunk_offset[num_chunks];
+  if (live == num) {
+    release_unused();
+    return;
+  }
+
+  // Chunks before the first hole are already in place
+  Index_t first = 0;
+  while (m_chunk_offset[first + 1] == (first + 1) * chunk_size) first++;
+  const Index_t start = first * chunk_size;
+
+  // m_index[j] is where the particle that goes to slot j is now
+  if (m_index.size() < live) m_index.resize(live);
+#pragma omp parallel for schedule(static)
+  for (Index_t k = first; k < num_chunks; k++) {
+    Index_t end = std::min(num, (k + 1) * chunk_size);
+    Index_t n = m_chunk_offset[k];
+    for (Index_t i = k * chunk_size; i < end; i++) {
+      if (m_data.cell[i] != MAX_CELL) m_index[n++] = i;
+    }
+  }
+
+  // Gather one array at a time through a buffer, so that the cell array
+  // is not overwritten while it is still read
+  boost::fusion::for_each(m_data, [this, start, live](auto array) {
+    typedef typename std::remove_pointer<decltype(array)>::type value_t;
+    if (m_compact_buffer.size() < (live - start) * sizeof(value_t))
+      m_compact_buffer.resize((live - start) * sizeof(value_t));
+    value_t* buffer = reinterpret_cast<value_t*>(m_compact_buffer.data());
+#pragma omp parallel for schedule(static)
+    for (Index_t j = start; j < live; j++)
+      buffer[j - start] = array[m_index[j]];
+#pragma omp parallel for schedule(static)
+    for (Index_t j = start; j < live; j++)
+      array[j] = buffer[j - start];
+  });
+  // The order is kept, and so is the tile layout once the start of every
+  // bin moves down past the holes below it
+  if (m_tiled) {
+    for (auto& offset : m_bin_offset) {
+      if (offset > start)
+        offset = std::lower_bound(m_index.begin() + start,
+                                  m_index.begin() + live, offset) -
+                 m_index.begin();
+    }
+  }
+  erase(live, num - live);
+  m_number = live;
+  release_unused();
+}
+
 template <typename ParticleClass>
 void
 ParticleBase<ParticleClass>::put(Index_t pos, const ParticleClass& part) {
-  if (pos >= m_numMax)
-    throw std::runtime_error(
-        "Trying to insert particle beyond the end of the array. Resize it "
-        "first!");
+  if (pos >= m_capacity) reserve(pos + 1);
 
   typedef boost::fusion::vector<array_type&, const ParticleClass&> seq;
   boost::fusion::for_each(boost::fusion::zip_view<seq>(seq(m_data, part)),
@@ -137,11 +308,8 @@ ParticleBase<ParticleClass>::put(Index_t pos, const ParticleClass& part) {
 template <typename ParticleClass>
 void
 ParticleBase<ParticleClass>::swap(Index_t pos, ParticleClass& part) {
+  if (pos >= m_capacity) reserve(pos + 1);
   ParticleClass p_tmp = m_data[pos];
-  if (pos >= m_numMax)
-    throw std::runtime_error(
-        "Trying to swap particle beyond the end of the array. Resize it "
-        "first!");
 
   typedef boost::fusion::vector<array_type&, const ParticleClass&> seq;
   boost::fusion::for_each(boost::fusion::zip_view<seq>(seq(m_data, part)),
@@ -165,8 +333,7 @@ void
 ParticleBase<ParticleClass>::copy_from(const ParticleBase<ParticleClass>& other,
                                        std::size_t num, std::size_t src_pos,
                                        std::size_t dest_pos) {
-  // Adjust the number so that we don't over fill
-  if (dest_pos + num > m_numMax) num = m_numMax - dest_pos;
+  reserve(dest_pos + num);
   typedef boost::fusion::vector<array_type&, const array_type&> seq;
   boost::fusion::for_each(
       boost::fusion::zip_view<seq>(seq(m_data, other.m_data)),
@@ -208,226 +375,335 @@ ParticleBase<ParticleClass>::rearrange(std::vector<Index_t>& index,
 }
 
 template <typename ParticleClass>
-template <typename T>
 void
-ParticleBase<ParticleClass>::rearrange_single_array(T* array,
-                                                    std::vector<Index_t>& index,
-                                                    std::size_t num) {
-  // std::cout << "In rearrange!" << std::endl;
-  T tmp, tmp_swap;
-  if (num == 0) num = index.size();
-  for (Index_t i = 0; i < num; i++) {
-    // -1 means LLONG_MAX for unsigned long int
-    if (index[i] != (Index_t)-1) {
-      tmp = array[i];
-      for (Index_t j = i;;) {
-        if (index[j] != i) {
-          // put(index[j], m_data[j]);
-          // swap(index[j], p_tmp);
-          tmp_swap = array[index[j]];
-          array[index[j]] = tmp;
-          tmp = tmp_swap;
-          Index_t id = index[j];
-          index[j] = (Index_t)-1;  // Mark as done
-          j = id;
-        } else {
-          // put(i, p_tmp);
-          array[i] = tmp;
-          index[j] = (Index_t)-1;  // Mark as done
-          break;
+ParticleBase<ParticleClass>::scatter(std::size_t begin, std::size_t num) {
+  if (m_buffer_max != m_numMax) {
+    // The contents of the buffer do not matter, so it is reserved anew
+    free_reserved_struct_of_arrays(m_buffer, m_buffer_max);
+    reserve_struct_of_arrays(m_buffer, m_numMax);
+    m_buffer_max = m_numMax;
+  }
+  typedef boost::fusion::vector<array_type&, array_type&> seq;
+  boost::fusion::for_each(
+      boost::fusion::zip_view<seq>(seq(m_data, m_buffer)),
+      [this, begin, num](const auto& x) {
+        auto src = boost::fusion::at_c<0>(x);
+        auto dst = boost::fusion::at_c<1>(x);
+#pragma omp parallel for schedule(static)
+        for (Index_t i = begin; i < num; i++) dst[m_index[i]] = src[i];
+        // Only part of the arrays was sorted, so it is copied back rather
+        // than swapped
+        if (begin > 0) {
+#pragma omp parallel for schedule(static)
+          for (Index_t i = begin; i < num; i++) src[i] = dst[i];
         }
-      }
-    }
+      });
+  if (begin == 0) {
+    std::swap(m_data, m_buffer);
+    // The slots after the sorted ones were never written in the buffer
+    erase(num, m_capacity - num);
   }
 }
 
 template <typename ParticleClass>
 void
-ParticleBase<ParticleClass>::rearrange_arrays(std::vector<Index_t>& index,
+ParticleBase<ParticleClass>::swap_slots(Index_t a, Index_t b) {
+  boost::fusion::for_each(m_data,
+                          [a, b](auto array) { std::swap(array[a], array[b]); });
+}
+
+template <typename ParticleClass>
+void
+ParticleBase<ParticleClass>::rearrange_arrays(const std::vector<Index_t>& index,
                                               std::size_t num) {
-  // typedef boost::fusion::vector<array_type&> seq;
-  boost::fusion::for_each(m_data, [this, &index, num](const auto x) {
-    // at_c<0>(x)[pos] = at_c<1>(x);
-    std::copy(index.begin(), index.begin() + num, this -> m_index_bak.begin());
-    this->rearrange_single_array(x, this->m_index_bak, num);
-  });
+  if (num == 0) num = index.size();
+  if (num > m_capacity) reserve(num);
+  m_index.resize(num);
+  for (Index_t i = 0; i < num; i++) m_index[i] = index[i];
+  // Everything after the permuted range stays in place
+  std::size_t end = std::max(num, m_number);
+  if (end > num) {
+    m_index.resize(end);
+    std::iota(m_index.begin() + num, m_index.end(), (uint32_t)num);
+  }
+  scatter(0, end);
 }
 
 template <typename ParticleClass>
+template <typename KeyFunc>
 void
-ParticleBase<ParticleClass>::rearrange_copy(std::vector<Index_t>& index,
-                                            std::size_t num) {
-  boost::fusion::for_each(m_data, [this, &index, num](const auto x) {
-      // at_c<0>(x)[pos] = at_c<1>(x);
-      // this->rearrange_single_array(x, index, num);
+ParticleBase<ParticleClass>::counting_sort(uint32_t num_bins,
+                                           const KeyFunc& key,
+                                           std::size_t begin) {
+  const Index_t num = m_number;
+  if (num > std::numeric_limits<uint32_t>::max())
+    throw std::runtime_error("Too many particles for 32 bit indices!");
+#ifdef _OPENMP
+  const Index_t num_blocks = omp_get_max_threads();
+#else
+  const Index_t num_blocks = 1;
+#endif
+  const Index_t n = num - begin;
+  m_index.resize(num);
+  m_histogram.assign(num_blocks * num_bins, 0);
+
+  // Count the particles of every block in every bin, keeping the bins
+#pragma omp parallel for schedule(static)
+  for (Index_t b = 0; b < num_blocks; b++) {
+    uint32_t* hist = m_histogram.data() + b * num_bins;
+    for (Index_t i = begin + b * n / num_blocks;
+         i < begin + (b + 1) * n / num_blocks; i++) {
+      uint32_t bin = (is_empty(i) ? num_bins - 1 : key(i));
+      m_index[i] = bin;
+      hist[bin] += 1;
+    }
+  }
 
-    });
+  // Where each block starts in each bin. Blocks come in order within a bin,
+  // so the sort is stable, and the result does not depend on the number of
+  // threads
+  m_bin_offset.resize(num_bins + 1);
+  uint32_t offset = begin;
+  for (uint32_t bin = 0; bin < num_bins; bin++) {
+    m_bin_offset[bin] = offset;
+    for (Index_t b = 0; b < num_blocks; b++) {
+      uint32_t count = m_histogram[b * num_bins + bin];
+      m_histogram[b * num_bins + bin] = offset;
+      offset += count;
+    }
+  }
+  m_bin_offset[num_bins] = offset;
+
+  // Turn the bin of every particle into where it goes
+#pragma omp parallel for schedule(static)
+  for (Index_t b = 0; b < num_blocks; b++) {
+    uint32_t* next = m_histogram.data() + b * num_bins;
+    for (Index_t i = begin + b * n / num_blocks;
+         i < begin + (b + 1) * n / num_blocks; i++)
+      m_index[i] = next[m_index[i]]++;
+  }
+  scatter(begin, num);
 }
 
 template <typename ParticleClass>
 void
 ParticleBase<ParticleClass>::partition(std::vector<Index_t>& partitions,
                                        const Grid& grid) {
-  // timer::stamp();
-  // TODO: This process is tediously slow. How to optimize?
-
-  // std::cout << "In partition!" << std::endl;
-  // unsigned int zone_num = 27 + grid.size(); // FIXME: Magic numbers!
   unsigned int zone_num = 27u;  // FIXME: Magic numbers!
   if (partitions.size() != zone_num + 2) partitions.resize(zone_num + 2);
 
-  std::fill(partitions.begin(), partitions.end(), 0);
-  std::iota(m_index.begin(), m_index.end(), 0);
-
-  std::cout << "Partitions has size " << partitions.size() << std::endl;
-  // std::cout << "Array has size " << m_number << std::endl;
-  for (Index_t i = 0; i < m_number; i++) {
-    unsigned int zone_idx = 0;
-    if (is_empty(i)) {
-      zone_idx = zone_num;
-    } else {
-      zone_idx = grid.mesh().find_zone(m_data.cell[i]);
-    }
-    // if (zone_idx == CENTER_ZONE) // FIXME: Magic number again!!?
-    //   zone_idx = m_data.cell[i];
-    // else if (zone_idx != zone_num)
-    //   zone_idx += grid.size();
-    // Right now m_index array saves the id of each particle in its
-    // zone, and partitions array saves the number of particles in
-    // each zone
-    m_index[i] = partitions[zone_idx + 1];
-    partitions[zone_idx + 1] += 1;
-  }
-  // for (auto n : m_index) { std::cout << n << " "; }
-  // std::cout << std::endl;
-
-  // Scan the array, now the array contains the starting index of each
-  // zone in the main particle array
-  for (unsigned int i = 1; i < zone_num + 2; i++) {
-    partitions[i] += partitions[i - 1];
-    // The last element means how many particles are empty
-  }
-  // Second pass through the particle array, get the real index
-  for (Index_t i = 0; i < m_number; i++) {
-    unsigned int zone_idx = 0;
-    if (is_empty(i)) {
-      zone_idx = zone_num;
-    } else {
-      zone_idx = grid.mesh().find_zone(m_data.cell[i]);
-    }
-    // if (zone_idx == CENTER_ZONE) // FIXME: Magic number again!!?
-    //   zone_idx = m_data.cell[i];
-    // else if (zone_idx != zone_num)
-    //   zone_idx += grid.size();
-    m_index[i] += partitions[zone_idx];
-  }
-  // std::copy(m_index.begin(), m_index.begin() + m_number, m_index_bak.begin());
-  // for (auto n : m_index) { std::cout << n << " "; }
-  // std::cout << std::endl;
-
-  // Rearrange the particles to reflect the partition
-  // timer::show_duration_since_stamp("partition", "ms");
-  rearrange_arrays(m_index, m_number);
-  // rearrange(m_index, m_number);
-  // timer::show_duration_since_stamp("rearrange", "ms");
-
-  // for (int i = 0; i < numMax(); i++) {
-  //   std::cout << m_data.cell[i] << " ";
-  // }
-  // std::cout << std::endl;
-  // partitions[zone_num] is where the empty zone starts. This should
-  // be equal to the number of particles in the array now
-  // FIXME: There could be wrap around error due to large number of particles
-  if (partitions[zone_num] != m_number) this->set_num(partitions[zone_num]);
-
-  // std::cout << "Finished partition!" << std::endl;
+  auto& mesh = grid.mesh();
+  counting_sort(zone_num + 1, [this, &mesh](Index_t i) {
+    return (uint32_t)mesh.find_zone(m_data.cell[i]);
+  });
+  m_tiled = false;
+  // partitions[zone_num] is where the empty zone starts, which is the
+  // number of particles in the array now
+  std::copy(m_bin_offset.begin(), m_bin_offset.end(), partitions.begin());
+  this->set_num(partitions[zone_num]);
 }
 
 template <typename ParticleClass>
 void
 ParticleBase<ParticleClass>::partition_and_sort(
     std::vector<Index_t>& partitions, const Aperture::Grid& grid,
-    int tile_size) {
+    int tile_size, bool by_cell) {
+  auto& mesh = grid.mesh();
   // Make sure the tile size divides the reduced dimension in every direction
   for (int i = 0; i < 3; i++) {
-    if (grid.mesh().dims[i] > 1 &&
-        grid.mesh().reduced_dim(i) % tile_size != 0) {
+    if (mesh.dims[i] > 1 && mesh.reduced_dim(i) % tile_size != 0) {
       std::cerr << "Tile size does not divide the dimension in direction " << i
                 << std::endl;
       return;
     }
   }
+  m_tiles = TileLayout(mesh, tile_size, by_cell);
+
+  // Tiles, or the cells of the tiles, come first, then the other zones
+  counting_sort(m_tiles.num_bins(),
+                [this](Index_t i) { return m_tiles.bin(m_data.cell[i]); });
+  m_tiled = true;
+  // The empty zone starts after the last particle
+  this->set_num(m_bin_offset[m_tiles.num_bins() - 1]);
+  tile_partitions(partitions);
+}
 
-  // Compute the number of tiles
-  int num_tiles[3] = {1, 1, 1};
-  int total_num_tiles = 1;
-  for (int i = 0; i < 3; i++) {
-    if (grid.mesh().dims[i] > 1)
-      num_tiles[i] = grid.mesh().reduced_dim(i) / tile_size;
-    total_num_tiles *= num_tiles[i];
-  }
-
+template <typename ParticleClass>
+void
+ParticleBase<ParticleClass>::tile_partitions(
+    std::vector<Index_t>& partitions) const {
   // unsigned int zone_num = 27 + grid.size(); // FIXME: Magic numbers!
-  unsigned int zone_num = 27u + total_num_tiles;  // FIXME: Magic numbers!
+  const int num_tiles = m_tiles.num_tiles;
+  unsigned int zone_num = 27u + num_tiles;  // FIXME: Magic numbers!
   if (partitions.size() != zone_num + 2) partitions.resize(zone_num + 2);
+  for (int t = 0; t < num_tiles; t++)
+    partitions[t] = m_bin_offset[t * m_tiles.cells_per_tile];
+  for (int z = 0; z < 29; z++)
+    partitions[num_tiles + z] = m_bin_offset[m_tiles.tile_bins + z];
+}
 
-  std::fill(partitions.begin(), partitions.end(), 0);
-  std::iota(m_index.begin(), m_index.end(), 0);
+template <typename ParticleClass>
+bool
+ParticleBase<ParticleClass>::maintain_tiles(std::vector<Index_t>& partitions) {
+  if (!m_tiled) return false;
+  const uint32_t num_bins = m_tiles.num_bins();
+  const uint32_t last = num_bins - 1;
+  // The layout is lost if particles were taken off the end since
+  if (m_bin_offset[last] > m_number) {
+    m_tiled = false;
+    return false;
+  }
+  erase_marked();
+  if (m_number > std::numeric_limits<uint32_t>::max())
+    throw std::runtime_error("Too many particles for 32 bit indices!");
+  // The last bin is the overflow, which holds the particles appended since
+  // the layout was made and those waiting for a slot in their bin
+  m_bin_offset[num_bins] = m_number;
+  m_index.resize(m_number);
+  // For every bin, the particles that go to the bin before, to the bin
+  // after, and further, and the empty slots
+  m_histogram.assign(4 * num_bins, 0);
+  Index_t moved = 0;
+
+  // Find the particles that left their bin. Empty slots stay where they
+  // are, as slack for the particles coming in
+#pragma omp parallel for schedule(dynamic, 64)
+  for (uint32_t b = 0; b < last; b++) {
+    uint32_t left = 0, right = 0, far = 0, holes = 0;
+    for (Index_t i = m_bin_offset[b]; i < m_bin_offset[b + 1]; i++) {
+      m_index[i] = b;
+      if (is_empty(i)) {
+        holes += 1;
+        continue;
+      }
+      uint32_t bin = m_tiles.bin(m_data.cell[i]);
+      if (bin == b) continue;
+      if (bin + 1 == b) {
+        m_index[i] = bin;
+        left += 1;
+      } else if (bin == b + 1 && bin != last) {
+        m_index[i] = bin;
+        right += 1;
+      } else {
+        m_index[i] = last;
+        far += 1;
+      }
+    }
+    m_histogram[4 * b] = left;
+    m_histogram[4 * b + 1] = right;
+    m_histogram[4 * b + 2] = far;
+    m_histogram[4 * b + 3] = holes;
+  }
 
-  std::cout << "Partitions has size " << partitions.size() << std::endl;
-  // std::cout << "Array has size " << m_number << std::endl;
-  for (Index_t i = 0; i < m_number; i++) {
-    unsigned int zone_idx = 0;
-    if (is_empty(i)) {
-      zone_idx = zone_num;
-    } else {
-      zone_idx = grid.mesh().find_zone(m_data.cell[i]);
+  // Particles that went further than the next bin join the overflow, in
+  // the order of the bins, and leave a hole behind
+  Index_t num_far = 0;
+  for (uint32_t b = 0; b < last; b++) num_far += m_histogram[4 * b + 2];
+  if (num_far > 0) {
+    std::vector<Index_t> far(num_far);
+    m_chunk_offset.assign(last + 1, 0);
+    for (uint32_t b = 0; b < last; b++)
+      m_chunk_offset[b + 1] = m_chunk_offset[b] + m_histogram[4 * b + 2];
+#pragma omp parallel for schedule(dynamic, 64)
+    for (uint32_t b = 0; b < last; b++) {
+      if (m_histogram[4 * b + 2] == 0) continue;
+      Index_t n = m_chunk_offset[b];
+      for (Index_t i = m_bin_offset[b]; i < m_bin_offset[b + 1]; i++) {
+        if (m_index[i] == last) {
+          far[n++] = i;
+          m_index[i] = b;
+        }
+      }
+      m_histogram[4 * b + 3] += m_histogram[4 * b + 2];
     }
-    if (zone_idx == CENTER_ZONE) {
-      zone_idx = grid.mesh().tile_id(m_data.cell[i], tile_size);
-    } else if (zone_idx != zone_num) {
-      zone_idx += total_num_tiles;
+    for (auto i : far) {
+      put(m_number, m_data[i]);
+      erase(i);
     }
-    // Right now m_index array saves the id of each particle in its
-    // zone, and partitions array saves the number of particles in
-    // each zone
-    m_index[i] = partitions[zone_idx + 1];
-    partitions[zone_idx + 1] += 1;
+    moved += num_far;
   }
 
-  // Scan the array, now the array contains the starting index of each
-  // zone in the main particle array
-  for (unsigned int i = 1; i < zone_num + 2; i++) {
-    partitions[i] += partitions[i - 1];
-    // The last element means how many particles are empty
+  // Within every bin, put the particles going to the bin before first and
+  // those going to the bin after last, swapping the rest out of the way
+#pragma omp parallel for schedule(dynamic, 64) reduction(+ : moved)
+  for (uint32_t b = 0; b < last; b++) {
+    if (m_histogram[4 * b] + m_histogram[4 * b + 1] == 0) continue;
+    Index_t lo = m_bin_offset[b], mid = lo, hi = m_bin_offset[b + 1];
+    while (mid < hi) {
+      if (m_index[mid] < b) {
+        if (lo != mid) {
+          swap_slots(lo, mid);
+          moved += 2;
+        }
+        std::swap(m_index[lo++], m_index[mid++]);
+      } else if (m_index[mid] > b) {
+        if (mid != --hi) {
+          swap_slots(mid, hi);
+          moved += 2;
+        }
+        std::swap(m_index[mid], m_index[hi]);
+      } else {
+        mid++;
+      }
+    }
   }
-  // Second pass through the particle array, get the real index
-  for (Index_t i = 0; i < m_number; i++) {
-    unsigned int zone_idx = 0;
-    if (is_empty(i)) {
-      zone_idx = zone_num;
+  // The particles leaving across a boundary are now next to each other on
+  // both sides of it, and trade places in one rotation
+#pragma omp parallel for schedule(dynamic, 64) reduction(+ : moved)
+  for (uint32_t b = 1; b < last; b++) {
+    Index_t first = m_bin_offset[b] - m_histogram[4 * b - 3];
+    Index_t middle = m_bin_offset[b];
+    Index_t end = m_bin_offset[b] + m_histogram[4 * b];
+    if (first == middle || middle == end) continue;
+    boost::fusion::for_each(m_data, [first, middle, end](auto array) {
+      std::rotate(array + first, array + middle, array + end);
+    });
+    moved += end - first;
+  }
+  for (uint32_t b = 1; b < last; b++)
+    m_bin_offset[b] =
+        m_bin_offset[b] + m_histogram[4 * b] - m_histogram[4 * b - 3];
+
+  // Move what is in the overflow into the empty slots of its bin where
+  // there are any, and close up the rest at the start of the overflow
+  std::vector<Index_t> next_hole(m_bin_offset.begin(),
+                                 m_bin_offset.begin() + last);
+  Index_t holes = 0;
+  for (uint32_t b = 0; b < last; b++) holes += m_histogram[4 * b + 3];
+  Index_t waiting = m_bin_offset[last];
+  for (Index_t i = m_bin_offset[last]; i < m_number; i++) {
+    if (is_empty(i)) continue;
+    uint32_t bin = m_tiles.bin(m_data.cell[i]);
+    if (m_histogram[4 * bin + 3] > 0) {
+      Index_t& slot = next_hole[bin];
+      while (!is_empty(slot)) slot++;
+      put(slot++, m_data[i]);
+      m_histogram[4 * bin + 3] -= 1;
+      holes -= 1;
+    } else if (i != waiting) {
+      put(waiting++, m_data[i]);
     } else {
-      zone_idx = grid.mesh().find_zone(m_data.cell[i]);
+      waiting++;
+      continue;
     }
-    if (zone_idx == CENTER_ZONE) {
-      zone_idx = grid.mesh().tile_id(m_data.cell[i], tile_size);
-    } else if (zone_idx != zone_num) {
-      zone_idx += total_num_tiles;
-    }
-    m_index[i] += partitions[zone_idx];
+    moved += 1;
   }
-
-  // std::copy(m_index.begin(), m_index.begin() + m_number, m_index_bak.begin());
-  // Rearrange the particles to reflect the partition
-  // timer::show_duration_since_stamp("partition", "ms");
-  rearrange_arrays(m_index, m_number);
-  // rearrange(m_index, m_number);
-  // timer::show_duration_since_stamp("rearrange", "ms");
-
-  // partitions[zone_num] is where the empty zone starts. This should
-  // be equal to the number of particles in the array now
-  // FIXME: There could be wrap around error due to large number of particles
-  if (partitions[zone_num] != m_number) this->set_num(partitions[zone_num]);
+  erase(waiting, m_number - waiting);
+  m_number = waiting;
+
+  // Merge the overflow with a sort of the whole array once it, and the
+  // slack in the bins, take up too much of it
+  if (holes + m_number - m_bin_offset[last] > m_number / merge_fraction) {
+    counting_sort(num_bins,
+                  [this](Index_t i) { return m_tiles.bin(m_data.cell[i]); });
+    this->set_num(m_bin_offset[last]);
+    moved = m_number;
+  }
+  m_bin_offset[num_bins] = m_number;
+  m_moved = moved;
+  release_unused();
+  tile_partitions(partitions);
+  return true;
 }
 
 template <typename ParticleClass>
@@ -435,10 +711,7 @@ void
 ParticleBase<ParticleClass>::copy_from(const std::vector<ParticleClass>& buffer,
                                        std::size_t num, std::size_t src_pos,
                                        std::size_t dest_pos) {
-  // Adjust the number so that we don't over fill
-  if (dest_pos > m_numMax)
-    throw std::runtime_error("Destination position larger than buffer size!");
-  if (dest_pos + num > m_numMax) num = m_numMax - dest_pos;
+  reserve(dest_pos + num);
   typedef boost::fusion::vector<array_type&, const ParticleClass&> seq;
   for (Index_t i = 0; i < num; i++) {
     boost::fusion::for_each(
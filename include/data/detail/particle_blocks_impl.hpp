@@ -0,0 +1,260 @@
+#ifndef _PARTICLE_BLOCKS_IMPL_H_
+#define _PARTICLE_BLOCKS_IMPL_H_
+
+#include "boost/fusion/include/for_each.hpp"
+#include "boost/fusion/include/zip_view.hpp"
+#include "data/particle_blocks.h"
+#include "utils/logger.h"
+#include "utils/memory.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace Aperture {
+
+template <typename ParticleClass, int Lanes>
+ParticleBlocks<ParticleClass, Lanes>::ParticleBlocks()
+    : m_data(nullptr), m_buffer(nullptr), m_numMax(0), m_number(0),
+      m_used(0) {
+  // The attributes are stored in the order of the pointer struct
+  std::size_t offset = 0, i = 0;
+  boost::fusion::for_each(array_type(), [this, &offset, &i](auto x) {
+    typedef typename std::remove_pointer<decltype(x)>::type value_t;
+    m_offset[i++] = offset;
+    offset += Lanes * sizeof(value_t);
+  });
+}
+
+template <typename ParticleClass, int Lanes>
+ParticleBlocks<ParticleClass, Lanes>::ParticleBlocks(std::size_t max_num)
+    : ParticleBlocks() {
+  reserve(max_num);
+}
+
+template <typename ParticleClass, int Lanes>
+ParticleBlocks<ParticleClass, Lanes>::~ParticleBlocks() {
+  aligned_free(m_data);
+  aligned_free(m_buffer);
+}
+
+template <typename ParticleClass, int Lanes>
+typename ParticleBlocks<ParticleClass, Lanes>::array_type
+ParticleBlocks<ParticleClass, Lanes>::view(char* base, Index_t b) const {
+  array_type result;
+  char* start = base + b * block_bytes;
+  std::size_t i = 0;
+  boost::fusion::for_each(result, [this, start, &i](auto& x) {
+    x = reinterpret_cast<typename std::remove_reference<decltype(x)>::type>(
+        start + m_offset[i++]);
+  });
+  return result;
+}
+
+template <typename ParticleClass, int Lanes>
+void
+ParticleBlocks<ParticleClass, Lanes>::reserve(std::size_t num) {
+  if (num <= m_numMax) return;
+  std::size_t max_num = std::max(num, 2 * m_numMax);
+  max_num = (max_num + Lanes - 1) / Lanes * Lanes;
+  if (m_numMax > 0)
+    Logger::print_info("Particle blocks grow beyond {} to {} particles",
+                       m_numMax, max_num);
+  char* data = reinterpret_cast<char*>(
+      aligned_malloc(max_num / Lanes * block_bytes, 64));
+  if (data == nullptr)
+    throw std::runtime_error("Failed to allocate particle blocks!");
+  if (m_data != nullptr)
+    std::memcpy(data, m_data, m_numMax / Lanes * block_bytes);
+  aligned_free(m_data);
+  // The sort buffer is made again at the new size when needed
+  aligned_free(m_buffer);
+  m_buffer = nullptr;
+  m_data = data;
+  std::size_t old_max = m_numMax;
+  m_numMax = max_num;
+  erase(old_max, max_num - old_max);
+}
+
+template <typename ParticleClass, int Lanes>
+ParticleClass
+ParticleBlocks<ParticleClass, Lanes>::operator[](Index_t pos) const {
+  ParticleClass part;
+  const int lane = pos % Lanes;
+  typedef boost::fusion::vector<ParticleClass&, const array_type&> seq;
+  boost::fusion::for_each(
+      boost::fusion::zip_view<seq>(seq(part, block(pos / Lanes))),
+      [lane](const auto& x) {
+        boost::fusion::at_c<0>(x) = boost::fusion::at_c<1>(x)[lane];
+      });
+  return part;
+}
+
+template <typename ParticleClass, int Lanes>
+void
+ParticleBlocks<ParticleClass, Lanes>::put(Index_t pos,
+                                          const ParticleClass& part) {
+  if (pos >= m_numMax) reserve(pos + 1);
+  const int lane = pos % Lanes;
+  typedef boost::fusion::vector<const array_type&, const ParticleClass&> seq;
+  boost::fusion::for_each(
+      boost::fusion::zip_view<seq>(seq(block(pos / Lanes), part)),
+      [lane](const auto& x) {
+        boost::fusion::at_c<0>(x)[lane] = boost::fusion::at_c<1>(x);
+      });
+  if (pos >= m_number) m_number = pos + 1;
+  m_used = std::max(m_used, m_number);
+}
+
+template <typename ParticleClass, int Lanes>
+void
+ParticleBlocks<ParticleClass, Lanes>::erase(std::size_t pos,
+                                            std::size_t amount) {
+  clear(m_data, pos, amount);
+}
+
+template <typename ParticleClass, int Lanes>
+void
+ParticleBlocks<ParticleClass, Lanes>::clear(char* base, std::size_t pos,
+                                            std::size_t amount) {
+  if (pos >= m_numMax) return;
+  if (pos + amount > m_numMax) amount = m_numMax - pos;
+  const ParticleClass empty;
+  for (std::size_t n = pos; n < pos + amount; n++) {
+    const int lane = n % Lanes;
+    typedef boost::fusion::vector<const array_type&, const ParticleClass&> seq;
+    boost::fusion::for_each(
+        boost::fusion::zip_view<seq>(seq(view(base, n / Lanes), empty)),
+        [lane](const auto& x) {
+          boost::fusion::at_c<0>(x)[lane] = boost::fusion::at_c<1>(x);
+        });
+  }
+}
+
+template <typename ParticleClass, int Lanes>
+void
+ParticleBlocks<ParticleClass, Lanes>::copy_from(
+    const ParticleBase<ParticleClass>& other) {
+  erase(0, m_used);
+  m_number = 0;
+  reserve(other.number());
+  const auto& data = other.data();
+  for (Index_t n = 0; n < other.number(); n++) {
+    ParticleClass part;
+    typedef boost::fusion::vector<ParticleClass&, const array_type&> seq;
+    boost::fusion::for_each(boost::fusion::zip_view<seq>(seq(part, data)),
+                            [n](const auto& x) {
+                              boost::fusion::at_c<0>(x) =
+                                  boost::fusion::at_c<1>(x)[n];
+                            });
+    put(n, part);
+  }
+}
+
+template <typename ParticleClass, int Lanes>
+void
+ParticleBlocks<ParticleClass, Lanes>::copy_to(
+    ParticleBase<ParticleClass>& other) const {
+  other.initialize();
+  for (Index_t n = 0; n < m_number; n++) other.put(n, (*this)[n]);
+}
+
+template <typename ParticleClass, int Lanes>
+void
+ParticleBlocks<ParticleClass, Lanes>::partition_and_sort(
+    std::vector<Index_t>& partitions, const Grid& grid, int tile_size) {
+  auto& mesh = grid.mesh();
+  for (int i = 0; i < 3; i++) {
+    if (mesh.dims[i] > 1 && mesh.reduced_dim(i) % tile_size != 0) {
+      std::cerr << "Tile size does not divide the dimension in direction " << i
+                << std::endl;
+      return;
+    }
+  }
+  const TileLayout tiles(mesh, tile_size, false);
+  const uint32_t num_bins = tiles.num_bins();
+  const Index_t num = m_number;
+  if (num > std::numeric_limits<uint32_t>::max())
+    throw std::runtime_error("Too many particles for 32 bit indices!");
+
+  // The same stable counting sort as ParticleBase::counting_sort, a block
+  // of particles for each thread
+#ifdef _OPENMP
+  const Index_t num_threads = omp_get_max_threads();
+#else
+  const Index_t num_threads = 1;
+#endif
+  m_index.resize(num);
+  m_histogram.assign(num_threads * num_bins, 0);
+#pragma omp parallel for schedule(static)
+  for (Index_t t = 0; t < num_threads; t++) {
+    uint32_t* hist = m_histogram.data() + t * num_bins;
+    for (Index_t i = t * num / num_threads; i < (t + 1) * num / num_threads;
+         i++) {
+      uint32_t bin = (is_empty(i) ? num_bins - 1
+                                  : tiles.bin(block(i / Lanes).cell[i % Lanes]));
+      m_index[i] = bin;
+      hist[bin] += 1;
+    }
+  }
+  std::vector<Index_t> bin_offset(num_bins + 1);
+  uint32_t offset = 0;
+  for (uint32_t bin = 0; bin < num_bins; bin++) {
+    bin_offset[bin] = offset;
+    for (Index_t t = 0; t < num_threads; t++) {
+      uint32_t count = m_histogram[t * num_bins + bin];
+      m_histogram[t * num_bins + bin] = offset;
+      offset += count;
+    }
+  }
+  bin_offset[num_bins] = offset;
+
+  if (m_buffer == nullptr) {
+    m_buffer = reinterpret_cast<char*>(
+        aligned_malloc(m_numMax / Lanes * block_bytes, 64));
+    if (m_buffer == nullptr)
+      throw std::runtime_error("Failed to allocate particle blocks!");
+    // Kernels run over whole blocks, so the lanes past the particles have
+    // to read as empty once the buffer is swapped in
+    clear(m_buffer, 0, m_numMax);
+  }
+  // Move every particle where it goes, whole blocks at a time for each
+  // thread, and then swap the buffer in
+#pragma omp parallel for schedule(static)
+  for (Index_t t = 0; t < num_threads; t++) {
+    uint32_t* next = m_histogram.data() + t * num_bins;
+    for (Index_t i = t * num / num_threads; i < (t + 1) * num / num_threads;
+         i++) {
+      Index_t j = next[m_index[i]]++;
+      const int src_lane = i % Lanes, dst_lane = j % Lanes;
+      typedef boost::fusion::vector<const array_type&, const array_type&> seq;
+      boost::fusion::for_each(
+          boost::fusion::zip_view<seq>(
+              seq(view(m_data, i / Lanes), view(m_buffer, j / Lanes))),
+          [src_lane, dst_lane](const auto& x) {
+            boost::fusion::at_c<1>(x)[dst_lane] =
+                boost::fusion::at_c<0>(x)[src_lane];
+          });
+    }
+  }
+  std::swap(m_data, m_buffer);
+  // Past the sorted particles the buffer still holds what it had before
+  // the last sort, and from m_used on it is empty
+  if (m_used > num) erase(num, m_used - num);
+
+  const int num_tiles = tiles.num_tiles;
+  partitions.resize(num_tiles + 29);
+  for (int t = 0; t < num_tiles; t++) partitions[t] = bin_offset[t];
+  for (int z = 0; z < 29; z++)
+    partitions[num_tiles + z] = bin_offset[tiles.tile_bins + z];
+  m_number = bin_offset[num_bins - 1];
+}
+
+}  // namespace Aperture
+
+#endif  // _PARTICLE_BLOCKS_IMPL_H_
@@ -15,6 +15,9 @@ enum class ParticleType : char { electron = 0, positron, ion };
 
 enum class CommTags : char { left = 0, right };
 
+/// Instruction set used by the vectorized particle kernels
+enum class SimdLevel : char { scalar = 0, avx2, avx512 };
+
 enum class Zone : char { center = 13 };
 
 enum class BoundaryPos : char {
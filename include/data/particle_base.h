@@ -2,6 +2,8 @@
 #define  _PARTICLE_BASE_H_
 
 #include <cstddef>
+#include <cstdint>
+#include <stdexcept>
 #include <vector>
 #include "data/grid.h"
 #include "data/particle_data.h"
@@ -9,6 +11,57 @@
 
 namespace Aperture {
 
+///  How partition_and_sort bins the particles: the tiles, or the cells of
+///  the tiles, come first, then the 27 communication zones, then the empty
+///  slots.
+struct TileLayout {
+  Quadmesh mesh;
+  int tile_size = 0;
+  int num_tiles = 0;
+  int cells_per_tile = 1;
+  int cell_stride[3] = {0, 0, 0};
+  uint32_t tile_bins = 0;  ///< Bins before the first zone
+
+  TileLayout() {}
+  /// The tile size needs to divide the bulk of the mesh in every direction.
+  /// With by_cell every cell of a tile gets its own bin
+  TileLayout(const Quadmesh& m, int size, bool by_cell)
+      : tile_size(size), num_tiles(1) {
+    // Quadmesh only declares the assignment
+    mesh = m;
+    for (int i = 0; i < 3; i++) {
+      if (mesh.dims[i] > 1) {
+        num_tiles *= mesh.reduced_dim(i) / tile_size;
+        if (by_cell) {
+          cell_stride[i] = cells_per_tile;
+          cells_per_tile *= tile_size;
+        }
+      }
+    }
+    tile_bins = num_tiles * cells_per_tile;
+  }
+
+  uint32_t num_bins() const { return tile_bins + 28; }
+  uint32_t bin(uint32_t cell) const {
+    int zone = mesh.find_zone(cell);
+    if (zone != CENTER_ZONE) return tile_bins + zone;
+    uint32_t b = mesh.tile_id(cell, tile_size) * cells_per_tile;
+    if (cells_per_tile > 1) {
+      b += ((mesh.get_c1(cell) - mesh.guard[0]) % tile_size) * cell_stride[0] +
+           ((mesh.get_c2(cell) - mesh.guard[1]) % tile_size) * cell_stride[1] +
+           ((mesh.get_c3(cell) - mesh.guard[2]) % tile_size) * cell_stride[2];
+    }
+    return b;
+  }
+};
+
+///  Slots [begin, end) of a particle array
+struct ParticleRange {
+  Index_t begin = 0, end = 0;
+
+  Index_t size() const { return end - begin; }
+};
+
 ///  Base class for particle storage classes. The only thing this
 ///  class does is to maintain a maximum number of particles in the
 ///  storage buffer, as well as the current particle number that is
@@ -16,13 +69,24 @@ namespace Aperture {
 ///  specify what to store in the particle array and how to store
 ///  them. Both the CPU particle buffer and the GPU particle buffer
 ///  derive from this class.
+///
+///  Every array reserves address space for numMax() particles, but only
+///  the first capacity() slots are in use. The capacity grows in chunks of
+///  chunk_size particles as they are added, and the new slots are first
+///  touched then, in parallel. Chunks that are no longer needed are given
+///  back to the system by compact(). Adding beyond numMax() moves the
+///  reservation to a larger one, which remaps the pages rather than
+///  copying them, so the pointers in data() can change whenever particles
+///  are added.
 template <typename ParticleClass>
 class ParticleBase
 {
  protected:
   typedef typename particle_array_type<ParticleClass>::type array_type;
 
-  std::size_t m_numMax;                  ///< Maximum number of particles in the array
+  std::size_t m_numMax;                  ///< Number of particles the address space is reserved for
+  std::size_t m_capacity;                ///< Number of slots in use, empty or not
+  std::size_t m_peak_capacity;           ///< Largest capacity so far
   /// @brief The current number of particles in the array.
   /// @accessors #number(), #setNum()
   std::size_t m_number;
@@ -30,7 +94,48 @@ class ParticleBase
 
   void* m_data_ptr;
   array_type m_data;
-  std::vector<Index_t> m_index, m_index_bak;
+  /// The other half of the ping-pong arrays that the sort scatters into,
+  /// reserved for m_buffer_max particles once the first sort needs it
+  array_type m_buffer;
+  std::size_t m_buffer_max;
+  std::vector<uint32_t> m_index;         ///< Scratch space for compact() and the sort
+  std::vector<uint32_t> m_histogram;     ///< Scratch space for the sort
+  std::vector<Index_t> m_bin_offset;
+  /// Layout of the last partition_and_sort. While m_tiled is set,
+  /// m_bin_offset holds where each of its bins starts. The last bin is the
+  /// overflow, which holds the particles appended since and those that
+  /// maintain_tiles has not found a slot for yet
+  TileLayout m_tiles;
+  bool m_tiled;
+  std::size_t m_moved;                   ///< Particles the last maintain_tiles moved
+  std::vector<Index_t> m_marked;         ///< Slots waiting for erase_marked()
+  std::vector<Index_t> m_chunk_offset;   ///< Scratch space for compact() and maintain_tiles()
+  std::vector<char> m_compact_buffer;
+
+  /// Stable counting sort of the particles in [0, number()) into num_bins
+  /// bins, with empty slots in the last one. key(i) gives the bin of the
+  /// particle in slot i. Each thread counts a block of the particles, and
+  /// each array is then scattered into m_buffer by all the threads at
+  /// once, and swapped with it. Afterwards m_bin_offset[b] is where bin b
+  /// starts. Only [begin, number()) is sorted when begin is given, and the
+  /// bins then start from there
+  template <typename KeyFunc>
+  void counting_sort(uint32_t num_bins, const KeyFunc& key,
+                     std::size_t begin = 0);
+  /// Move the particle in slot i to slot m_index[i] for begin <= i < num,
+  /// through m_buffer
+  void scatter(std::size_t begin, std::size_t num);
+  void swap_slots(Index_t a, Index_t b);
+  /// Fill partitions from m_bin_offset, as partition_and_sort returns them
+  void tile_partitions(std::vector<Index_t>& partitions) const;
+  const TileLayout& check_tiled() const {
+    if (!m_tiled)
+      throw std::runtime_error("Particles are not sorted into tiles!");
+    return m_tiles;
+  }
+  ParticleRange bin_range(uint32_t first, uint32_t last) const {
+    return ParticleRange{m_bin_offset[first], m_bin_offset[last]};
+  }
 
  public:
   /// Default constructor, initializing everything to 0 and `sorted` to `true`
@@ -56,7 +161,27 @@ class ParticleBase
 
   void resize(std::size_t max_num);
   void initialize();
+  /// Make sure that there are at least num slots in use
+  void reserve(std::size_t num);
+  /// Give back the chunks well above number(). Some are kept, so that an
+  /// array that shrinks and grows again does not fault in the same pages
+  /// every step
+  void release_unused();
   void erase(std::size_t pos, std::size_t amount = 1);
+  /// Mark a slot to be erased by the next erase_marked(). This lets a
+  /// particle that leaves the box in the push still deposit its current.
+  /// Marking is not thread safe.
+  void mark_erase(Index_t pos) { m_marked.push_back(pos); }
+  void mark_erase(const std::vector<Index_t>& list) {
+    m_marked.insert(m_marked.end(), list.begin(), list.end());
+  }
+  /// Erase all the marked slots in one pass over the arrays
+  void erase_marked();
+  /// Remove the empty slots in [0, number()), keeping the order of the
+  /// particles, so that every slot below number() holds a particle.
+  /// Marked slots are erased first.
+  void compact();
+  const std::vector<Index_t>& marked() const { return m_marked; }
   void copy_from(const ParticleBase<ParticleClass>& other, std::size_t num, std::size_t src_pos = 0, std::size_t dest_pos = 0);
   void copy_from(const std::vector<ParticleClass>& buffer, std::size_t num, std::size_t src_pos = 0, std::size_t dest_pos = 0);
   void copy_to_buffer(std::vector<ParticleClass>& buffer, std::size_t num, std::size_t src_pos = 0, std::size_t dest_pos = 0);
@@ -68,18 +193,86 @@ class ParticleBase
 
   // After rearrange, the index array will all be -1
   void rearrange(std::vector<Index_t>& index, std::size_t num = 0);
-  void rearrange_arrays(std::vector<Index_t>& index, std::size_t num = 0);
-  void rearrange_copy(std::vector<Index_t>& index, std::size_t num = 0);
-  template <typename T>
-  void rearrange_single_array(T* array, std::vector<Index_t>& index, std::size_t num = 0);
+  /// Move the particle in slot i to slot index[i] for i < num (all of index
+  /// for 0). index needs to be a permutation of [0, num)
+  void rearrange_arrays(const std::vector<Index_t>& index, std::size_t num = 0);
   // Partition according to a grid configuration, sort the particles into the
   // bulk part, and those that needs to be communicated out. After partition,
   // the given array partition becomes the starting position of each partition
   // in the particle array
   void partition(std::vector<Index_t>& partitions, const Grid& grid);
   // Partition for communication, as well as sorting the particles into tiles,
-  // with a given tile size. Tiles have the same size in every direction available
-  void partition_and_sort(std::vector<Index_t>& partitions, const Grid& grid, int tile_size);
+  // with a given tile size. Tiles have the same size in every direction
+  // available. With by_cell the particles of a tile are also sorted by cell
+  void partition_and_sort(std::vector<Index_t>& partitions, const Grid& grid,
+                          int tile_size, bool by_cell = false);
+  /// Bring the particles back into the bins of the last partition_and_sort
+  /// after they moved, were erased or appended. Particles that went to the
+  /// bin just before or after their own are swapped across the boundary in
+  /// place. Erased particles leave an empty slot in their bin, which is
+  /// slack for the particles coming in. Particles that went further join
+  /// the appended ones in the overflow after the last bin, and are moved
+  /// into an empty slot of their bin if there is one. Once more than
+  /// 1/merge_fraction of the slots are empty or in the overflow, the whole
+  /// array is sorted again, which merges the overflow and closes the
+  /// holes. Returns false without doing anything if there is no layout to
+  /// keep, which needs a partition_and_sort first
+  bool maintain_tiles(std::vector<Index_t>& partitions);
+  bool tiled() const { return m_tiled; }
+  /// Number of particles the last maintain_tiles moved to another slot
+  std::size_t moved() const { return m_moved; }
+  static const std::size_t merge_fraction = 16;
+
+  /// Index of the particles by tile and by cell, kept by partition_and_sort,
+  /// maintain_tiles and compact(). It holds from a sort until the particles
+  /// move again. Particles moved since are found where they were before,
+  /// the ranges may hold empty slots, and particles in the overflow are
+  /// not found at all. These throw
+  /// std::runtime_error if the particles were never sorted into tiles.
+  int num_tiles() const { return check_tiled().num_tiles; }
+  ParticleRange tile_range(int tile) const {
+    const auto& tiles = check_tiled();
+    return bin_range(tile * tiles.cells_per_tile,
+                     (tile + 1) * tiles.cells_per_tile);
+  }
+  /// The particles in one of the 27 communication zones, which are empty
+  /// but for the guard cells
+  ParticleRange zone_range(int zone) const {
+    const auto& tiles = check_tiled();
+    return bin_range(tiles.tile_bins + zone, tiles.tile_bins + zone + 1);
+  }
+  /// The range that holds the particles of a cell, which is the range of
+  /// the cell itself when sorted by cell, and of its tile or zone otherwise
+  ParticleRange cell_range(int cell) const {
+    uint32_t b = check_tiled().bin(cell);
+    return bin_range(b, b + 1);
+  }
+
+  /// Call f(n) for every particle n in the cell
+  template <typename Func>
+  void for_each_in_cell(int cell, const Func& f) const {
+    auto range = cell_range(cell);
+    for (Index_t n = range.begin; n < range.end; n++)
+      if (m_data.cell[n] == (uint32_t)cell) f(n);
+  }
+  /// Call f(n) for every particle n in the tile
+  template <typename Func>
+  void for_each_in_tile(int tile, const Func& f) const {
+    auto range = tile_range(tile);
+    for (Index_t n = range.begin; n < range.end; n++) f(n);
+  }
+  /// Call f(tile, range) for every tile, in order or with the tiles shared
+  /// out among the threads
+  template <typename Func>
+  void for_each_tile(const Func& f) const {
+    for (int t = 0; t < num_tiles(); t++) f(t, tile_range(t));
+  }
+  template <typename Func>
+  void parallel_for_each_tile(const Func& f) const {
+    const int num = num_tiles();
+#pragma omp parallel for schedule(dynamic)
+    for (int t = 0; t < num; t++) f(t, tile_range(t));
+  }
   void clear_guard_cells(const Grid& grid);
 
   // Accessor methods
@@ -92,9 +285,25 @@ class ParticleBase
   }
   /// @return Returns the value of the current number of particles
   std::size_t number() const { return m_number; }
+  /// @return Number of slots below number() that hold a particle. This is
+  /// less than number() while erased slots are kept as slack in the tiles
+  std::size_t count_live() const;
 
   /// @return Returns the maximum number of particles
   std::size_t numMax() const { return m_numMax; }
+  std::size_t capacity() const { return m_capacity; }
+  /// Bytes taken up by the particle arrays, now and at most so far. Once
+  /// the particles have been sorted this includes the sort buffer
+  std::size_t memory() const {
+    return m_capacity * array_type::size * (m_buffer_max > 0 ? 2 : 1);
+  }
+  std::size_t peak_memory() const {
+    return m_peak_capacity * array_type::size * (m_buffer_max > 0 ? 2 : 1);
+  }
+
+  /// Granularity of the capacity, which keeps every array a whole number of
+  /// pages long
+  static const std::size_t chunk_size = 1 << 16;
 
   /// Set the current number of particles in the array to a given value
   ///
@@ -0,0 +1,89 @@
+#ifndef _PARTICLE_BLOCKS_H_
+#define _PARTICLE_BLOCKS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "boost/fusion/include/size.hpp"
+#include "data/grid.h"
+#include "data/particle_base.h"
+#include "data/particle_data.h"
+
+namespace Aperture {
+
+/// Lanes of a block by default, one cache line of Scalar, which is also
+/// the width of an AVX-512 vector
+const int default_particle_lanes = 64 / sizeof(Scalar);
+
+///  Particle storage in blocks of Lanes particles, each block holding the
+///  arrays of every attribute of its particles one after the other, which
+///  is an array of structs of arrays. A push or deposit then streams
+///  through one region of memory instead of one per attribute.
+///
+///  block(b) gives the same pointer struct as ParticleBase::data(), for the
+///  particles of block b only, so the kernels that work on a range of
+///  ParticleBase::data() work on a block with the range [0, Lanes). Lanes
+///  is a multiple of 8, so a block is a whole number of vectors at every
+///  SIMD width. Otherwise it follows ParticleBase: slots hold MAX_CELL in
+///  the cell when they are empty, and the array grows as particles are
+///  put beyond numMax().
+template <typename ParticleClass, int Lanes = default_particle_lanes>
+class ParticleBlocks {
+  static_assert(Lanes % 8 == 0, "Lanes needs to be a multiple of 8");
+
+ public:
+  typedef typename particle_array_type<ParticleClass>::type array_type;
+  enum { lanes = Lanes, block_bytes = Lanes * array_type::size };
+
+  ParticleBlocks();
+  explicit ParticleBlocks(std::size_t max_num);
+  ParticleBlocks(const ParticleBlocks& other) = delete;
+  ParticleBlocks& operator=(const ParticleBlocks& other) = delete;
+  ~ParticleBlocks();
+
+  /// Pointers to the lanes of block b
+  array_type block(Index_t b) const { return view(m_data, b); }
+  Index_t num_blocks() const { return (m_number + Lanes - 1) / Lanes; }
+
+  ParticleClass operator[](Index_t pos) const;
+  void put(Index_t pos, const ParticleClass& part);
+  void append(const ParticleClass& part) { put(m_number, part); }
+  void erase(std::size_t pos, std::size_t amount = 1);
+  bool is_empty(Index_t pos) const {
+    return block(pos / Lanes).cell[pos % Lanes] == MAX_CELL;
+  }
+
+  /// Replace the particles with those of a ParticleBase, in the same order,
+  /// or the other way around
+  void copy_from(const ParticleBase<ParticleClass>& other);
+  void copy_to(ParticleBase<ParticleClass>& other) const;
+
+  /// Sort into tiles, in the same order as ParticleBase::partition_and_sort
+  void partition_and_sort(std::vector<Index_t>& partitions, const Grid& grid,
+                          int tile_size);
+
+  std::size_t number() const { return m_number; }
+  std::size_t numMax() const { return m_numMax; }
+  void set_num(std::size_t num) { m_number = num; }
+
+ private:
+  array_type view(char* base, Index_t b) const;
+  /// Mark the slots of the given storage as empty
+  void clear(char* base, std::size_t pos, std::size_t amount);
+  /// Make sure that there are at least num slots
+  void reserve(std::size_t num);
+
+  char* m_data;
+  char* m_buffer;          ///< What the sort scatters into, once it has run
+  std::size_t m_numMax;
+  std::size_t m_number;
+  std::size_t m_used;      ///< Slots from which both arrays are empty
+  /// Where the array of each attribute starts in a block
+  std::size_t m_offset[boost::fusion::result_of::size<array_type>::value];
+  std::vector<uint32_t> m_index;
+  std::vector<uint32_t> m_histogram;
+};  // ----- end of class ParticleBlocks -----
+
+}  // namespace Aperture
+
+#endif  // _PARTICLE_BLOCKS_H_
@@ -14,14 +14,22 @@
 
 namespace Aperture {
 
+// In the compact format (APERTURE_COMPACT_PARTICLES) a particle does not
+// store dx1 and gamma. The displacement only lives from the push to the
+// deposit, in a buffer owned by Particles (see Particles::displacement), and
+// gamma is computed from p1 and the background where it is needed.
 struct single_particle_t {
   Pos_t x1 = 0.0;
+#ifndef APERTURE_COMPACT_PARTICLES
   Pos_t dx1 = 0.0;
+#endif
   Scalar p1 = 0.0;
+#ifndef APERTURE_COMPACT_PARTICLES
   Scalar gamma = 0.0;
+#endif
   // Defulat MAX_CELL means empty particle slot
   uint32_t cell = MAX_CELL;
-  uint32_t flag = 0;
+  Flag_t flag = 0;
 
   // A series of set methods so that one can chain them
   single_particle_t& set_x(Pos_t x) {
@@ -29,14 +37,18 @@ struct single_particle_t {
     return *this;
   }
 
+#ifndef APERTURE_COMPACT_PARTICLES
   single_particle_t& set_dx(Pos_t dx) {
     dx1 = dx;
     return *this;
   }
+#endif
 
   single_particle_t& set_p(Scalar p) {
     p1 = p;
+#ifndef APERTURE_COMPACT_PARTICLES
     gamma = sqrt(1.0 + p1 * p1);
+#endif
     return *this;
   }
 
@@ -88,13 +100,21 @@ struct single_photon_t {
 };
 }
 
+#ifdef APERTURE_COMPACT_PARTICLES
+BOOST_FUSION_ADAPT_STRUCT(Aperture::single_particle_t,
+                          (Aperture::Pos_t, x1)
+                          (Aperture::Scalar, p1)
+                          (uint32_t, cell)
+                          (Aperture::Flag_t, flag));
+#else
 BOOST_FUSION_ADAPT_STRUCT(Aperture::single_particle_t,
                           (Aperture::Pos_t, x1)
                           (Aperture::Pos_t, dx1)
                           (Aperture::Scalar, p1)
                           (Aperture::Scalar, gamma)
                           (uint32_t, cell)
-                          (uint32_t, flag));
+                          (Aperture::Flag_t, flag));
+#endif
 
 BOOST_FUSION_ADAPT_STRUCT(Aperture::single_photon_t,
                           (Aperture::Pos_t, x1)
@@ -112,17 +132,26 @@ struct particle_data {
 
   // NOTE: This size is also NOT equal to the size of the
   // single_particle_t struct, due to padding
+#ifdef APERTURE_COMPACT_PARTICLES
   enum {
-    size = sizeof(Pos_t) * 2 + sizeof(Scalar) * 2 + sizeof(uint32_t) * 2
+    size = sizeof(Pos_t) + sizeof(Scalar) + sizeof(uint32_t) + sizeof(Flag_t)
+  };
+
+  Pos_t* x1;
+  Scalar* p1;
+#else
+  enum {
+    size = sizeof(Pos_t) * 2 + sizeof(Scalar) * 2 + sizeof(uint32_t) + sizeof(Flag_t)
   };
 
   Pos_t* x1;
   Pos_t* dx1;
   Scalar* p1;
   Scalar* gamma;
+#endif
 
   uint32_t* cell;
-  uint32_t* flag;
+  Flag_t* flag;
 
   single_particle_t operator[](int idx) const;
 };
@@ -161,13 +190,21 @@ struct particle_array_type<single_photon_t> {
 };
 }
 
+#ifdef APERTURE_COMPACT_PARTICLES
+BOOST_FUSION_ADAPT_STRUCT(Aperture::particle_data,
+                          (Aperture::Pos_t*, x1)
+                          (Aperture::Scalar*, p1)
+                          (uint32_t*, cell)
+                          (Aperture::Flag_t*, flag));
+#else
 BOOST_FUSION_ADAPT_STRUCT(Aperture::particle_data,
                           (Aperture::Pos_t*, x1)
                           (Aperture::Pos_t*, dx1)
                           (Aperture::Scalar*, p1)
                           (Aperture::Scalar*, gamma)
                           (uint32_t*, cell)
-                          (uint32_t*, flag));
+                          (Aperture::Flag_t*, flag));
+#endif
 
 BOOST_FUSION_ADAPT_STRUCT(Aperture::photon_data,
                           (Aperture::Pos_t*, x1)
@@ -50,6 +50,31 @@ class Particles : public ParticleBase<single_particle_t>
   // void partition(std::vector<Index_t>& partitions, const Grid& grid);
   // void clear_guard_cells(const Grid& grid);
   void sort(const Grid& grid);
+  /// Keep the particles sorted from the last sort(), or sort them if there
+  /// is nothing to keep. See ParticleBase::maintain_tiles
+  void sort_incremental(const Grid& grid);
+  /// Whether sort() also orders the particles of a tile by cell
+  void set_sort_by_cell(bool by_cell) { m_sort_by_cell = by_cell; }
+
+  /// Displacement dx1 of every particle in the last push, in units of the
+  /// cell size. This is written by the pusher and read by the depositer to
+  /// find the old position. In the compact format it is a scratch buffer
+  /// that only covers the particles up to number(), and is only valid
+  /// between a push and the following deposit.
+#ifdef APERTURE_COMPACT_PARTICLES
+  Pos_t* displacement() {
+    if (m_dx1.size() < m_number) m_dx1.resize(m_number);
+    return m_dx1.data();
+  }
+  const Pos_t* displacement() const { return m_dx1.data(); }
+#else
+  Pos_t* displacement() { return m_data.dx1; }
+  const Pos_t* displacement() const { return m_data.dx1; }
+#endif
+  /// Make sure the displacement covers number() particles. Threads that
+  /// push parts of the array share the buffer, so this has to happen
+  /// before they start
+  void reserve_displacement() { displacement(); }
 
   // particle_data& data() { return m_data; }
   // const particle_data& data() const { return m_data; }
@@ -76,6 +101,10 @@ class Particles : public ParticleBase<single_particle_t>
   Scalar m_charge = 1.0;
   Scalar m_mass = 1.0;
   std::vector<Index_t> m_partition;
+  bool m_sort_by_cell = false;
+#ifdef APERTURE_COMPACT_PARTICLES
+  std::vector<Pos_t> m_dx1;
+#endif
 
   // std::vector<Index_t> m_index;
 }; // ----- end of class Particles : public ParticleBase -----
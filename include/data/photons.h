@@ -5,6 +5,7 @@
 #include <vector>
 #include <string>
 #include <random>
+#include "data/background_geometry.h"
 #include "data/particles.h"
 #include "data/quadmesh.h"
 
@@ -24,9 +25,12 @@ class Photons : public ParticleBase<single_photon_t>
   void append(Pos_t x, Scalar p, Scalar path_left, int cell, int flag = 0);
 
   void convert_pairs(Particles& electrons, Particles& positrons);
-  void emit_photons(Particles& electrons, Particles& positrons, const Quadmesh& mesh);
+  /// The particle arrays need to be dense, see ParticleBase::compact
+  void emit_photons(Particles& electrons, Particles& positrons,
+                    const Quadmesh& mesh, const BackgroundGeometry& geom);
   void move(const Grid& grid, double dt);
   void sort(const Grid& grid);
+  void sort_incremental(const Grid& grid);
 
   bool check_flag(Index_t pos, PhotonFlag flag) const { return (m_data.flag[pos] & (unsigned int)flag) == (unsigned int)flag; }
   void set_flag(Index_t pos, PhotonFlag flag) { m_data.flag[pos] |= (unsigned int)flag; }
@@ -38,12 +42,14 @@ class Photons : public ParticleBase<single_photon_t>
   double draw_photon_e1p(double gamma);
   double draw_photon_ep(double e1p, double gamma);
   double draw_photon_u1p(double e1p, double gamma);
-  double draw_photon_energy(double gamma, double p, double x);
+  /// beta is the background beta_phi at the emitting particle
+  double draw_photon_energy(double gamma, double p, double beta);
   double draw_photon_freepath(double Eph);
 
  private:
   bool create_pairs = false;
   bool trace_photons = false;
+  bool periodic = false;
   float gamma_thr = 10.0;
   float l_ph = 1.0;
   float p_ph = 1.0;
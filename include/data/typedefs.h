@@ -3,6 +3,7 @@
 
 #include <bitset>
 #include <cstddef>
+#include <cstdint>
 // #include <Eigen/Dense>
 
 namespace Aperture {
@@ -15,7 +16,22 @@ typedef double Scalar;
 typedef std::bitset<3> Stagger_t;
 
 typedef double Mom_t;
+/// Relative position of a particle inside its cell, which is in [0, 1), so
+/// single precision is enough for most purposes. Enable with the CMake option
+/// use_float_position to save memory bandwidth in the push and deposit
+#ifdef APERTURE_FLOAT_POSITION
+typedef float Pos_t;
+#else
 typedef double Pos_t;
+#endif
+
+/// Particle flags. The flags defined in ParticleFlag fit in 16 bits, which
+/// the compact particle format (CMake option use_compact_particles) uses
+#ifdef APERTURE_COMPACT_PARTICLES
+typedef uint16_t Flag_t;
+#else
+typedef uint32_t Flag_t;
+#endif
 
 typedef std::size_t Index_t;
 
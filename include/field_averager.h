@@ -0,0 +1,75 @@
+#ifndef _FIELD_AVERAGER_H_
+#define _FIELD_AVERAGER_H_
+
+#include "data/multi_array.h"
+#include "data/typedefs.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Aperture {
+
+////////////////////////////////////////////////////////////////////////////////
+///  Running time averages of fields and moments for the data output. A
+///  quantity is registered once with the array it is sampled from, and the
+///  averager keeps its running sum and an array for the average, which is
+///  what gets written. Every quantity has its own window: it is sampled over
+///  the last window steps before each output step, once every stride steps.
+///  All the sums are updated in one sweep over the grid, and divided by the
+///  number of samples only when the output is written.
+////////////////////////////////////////////////////////////////////////////////
+class FieldAverager {
+ public:
+  typedef MultiArray<Scalar> array_type;
+
+  /// interval is the number of steps between two outputs
+  FieldAverager(uint32_t interval);
+  ~FieldAverager();
+
+  /// Average source over the last window steps before every output step (0
+  /// for the whole interval), once every stride steps. Returns the array
+  /// that holds the average after normalize()
+  array_type& add(const std::string& name, const array_type& source,
+                  uint32_t window = 0, uint32_t stride = 1);
+
+  /// Add the sources that sample this step to their sums. Call this after
+  /// the step is done
+  void accumulate(uint32_t step);
+  /// For a solver that adds source into the sum itself while it updates it.
+  /// Returns the sum of the quantity averaged from source if it samples this
+  /// step, counting the sample, and null otherwise. accumulate() then skips
+  /// that quantity for this step
+  Scalar* claim(const array_type& source, uint32_t step);
+  /// Turn the sums into averages, and start new sums
+  void normalize();
+
+  /// Whether a quantity with this window and stride samples the given step.
+  /// The step right before an output step is always sampled
+  static bool in_window(uint32_t step, uint32_t interval, uint32_t window,
+                        uint32_t stride);
+
+  uint32_t interval() const { return m_interval; }
+  /// Number of samples in the current sum of quantity n
+  uint32_t num_samples(int n) const { return m_entries[n]->count; }
+  int size() const { return m_entries.size(); }
+
+ private:
+  struct Entry {
+    std::string name;
+    const array_type* source;
+    array_type sum, average;
+    uint32_t window, stride, count = 0;
+    // The step for which the sum was claimed, if any
+    int64_t claimed = -1;
+  };
+
+  uint32_t m_interval;
+  std::vector<std::unique_ptr<Entry>> m_entries;
+  // Entries that sample the current step
+  std::vector<Entry*> m_active;
+};  // ----- end of class FieldAverager -----
+
+}  // namespace Aperture
+
+#endif  // _FIELD_AVERAGER_H_
@@ -1,6 +1,7 @@
 #ifndef _FIELD_SOLVER_H_
 #define _FIELD_SOLVER_H_
 
+#include <algorithm>
 #include <memory>
 // #include "algorithms/finite_diff.h"
 // #include "boundary_conditions.h"
@@ -10,6 +11,8 @@
 
 namespace Aperture {
 
+class CurrentDepositer;
+
 class FieldSolver {
  public:
   typedef VectorField<Scalar> vfield_t;
@@ -21,6 +24,21 @@ class FieldSolver {
   virtual void update_fields(vfield_t& E, vfield_t& B, const vfield_t& J,
                              double dt, double time = 0.0) = 0;
   virtual void update_fields(SimData& data, double dt, double time = 0.0) = 0;
+  /// Same as update_fields, for a depositer that left J summed only near
+  /// the ends of the grid (CurrentDepositer::set_edge_sum_only). Unless
+  /// sum_species is false, the rest of J is summed here from the species
+  /// that kept their own current (SimData::keep_current), and E is added to
+  /// E_sum unless it is null. Solvers can do all of this in one sweep over
+  /// the grid
+  virtual void update_fields_fused(SimData& data, double dt, Scalar* E_sum,
+                                   bool sum_species = true);
+
+  /// Called at the beginning of a step, before the particles are pushed.
+  /// An implicit solver replaces E by the field the particles should see.
+  /// Sums over the particles can go through the chunk buffers of the
+  /// depositer, which are free until the deposit
+  virtual void predict_fields(SimData& data, CurrentDepositer& depositer,
+                              double dt) {}
 
   virtual void set_background_j(const vfield_t& j) = 0;
 
@@ -49,6 +67,21 @@ class FieldSolver {
   // External boundary condition, memory managed elsewhere
   // const BoundaryConditions* m_bc = nullptr;
 };  // ----- end of class field_solver -----
+inline void
+FieldSolver::update_fields_fused(SimData& data, double dt, Scalar* E_sum,
+                                 bool sum_species) {
+  auto& mesh = data.J.grid().mesh();
+  int edge = std::min(2 * mesh.guard[0], mesh.dims[0]);
+  for (int i = edge; sum_species && i < mesh.dims[0] - edge; i++) {
+    for (Index_t sp = 0; sp < 2; sp++)
+      if (data.keep_current[sp]) data.J(0, i) += data.J_s[sp](i);
+  }
+  update_fields(data, dt);
+  if (E_sum != nullptr) {
+    for (int i = 0; i < mesh.dims[0]; i++) E_sum[i] += data.E(0, i);
+  }
+}
+
 }  // namespace Aperture
 
 #endif  // _FIELD_SOLVER_H_
@@ -16,7 +16,17 @@ class ParticlePusher {
   virtual ~ParticlePusher() {}
 
   virtual void push(SimData& data, double dt) = 0;
-  virtual void handle_boundary(SimData& data) = 0;
+  /// The boundary condition is applied as the particles and photons move,
+  /// and the ones that leave the box are only marked then. This erases them,
+  /// and applies the boundary condition to the pairs created since the push,
+  /// which start at index first_new[sp] of each species.
+  virtual void handle_boundary(SimData& data,
+                               const std::vector<Index_t>& first_new) = 0;
+
+  // Finer grained version used by the fused step engine
+  virtual void push_range(Particles& particles, const vfield& E,
+                          const BackgroundGeometry& geom, double dt,
+                          Index_t begin, Index_t end) = 0;
   // virtual void push(Particles& particles, const vfield_t& E, const vfield_t& B, double dt) = 0;
 
   // void register_ptc_comm_callback(const ptc_comm_callback& callback) {
@@ -57,7 +67,8 @@ class ParticlePusher {
 
  protected:
   // ptc_comm_callback m_comm;
-  bool m_gravity, m_radiation, m_compute_curvature, m_periodic;
+  bool m_gravity = false, m_radiation = false, m_compute_curvature = false,
+       m_periodic = false;
   ForceAlgorithm m_algorithm;
   int m_interp = 1;
 
@@ -3,7 +3,10 @@
 
 #include <stddef.h>
 #include <memory>
+#include <vector>
 #include "current_depositer.h"
+#include "current_filter.h"
+#include "field_averager.h"
 #include "field_solver.h"
 #include "particle_pusher.h"
 #include "sim_data.h"
@@ -23,13 +26,39 @@ class PICSim {
   void step(SimData& data, uint32_t step);
 
   FieldSolver& field_solver() { return *m_field_solver; }
+  /// With the fused field engine, the average of E is accumulated by the
+  /// field solver itself
+  void set_averager(FieldAverager* averager) { m_averager = averager; }
+
+  /// Whether the per species moments after this step go into the averaged
+  /// output, see DIAG_WINDOW, DIAG_STRIDE and FieldAverager
+  bool sample_step(uint32_t step) const;
 
  private:
+  /// Push and deposit one block of particles at a time
+  void push_deposit_fused(SimData& data, double dt);
+  /// Decide which species are advanced this step, and by how many steps
+  void update_subcycle(SimData& data, uint32_t step, double dt);
+  /// Largest subcycle for species sp that keeps its displacement and
+  /// momentum kick per advance small
+  int auto_subcycle(const SimData& data, Index_t sp, double dt) const;
+  /// Largest subcycle for species sp that keeps its displacement per
+  /// advance below half a cell. A manual SUBCYCLE is capped by it as well
+  int displacement_limit(const SimData& data, Index_t sp, double dt) const;
+
   Environment& m_env;
+  bool m_fused = false;
+  bool m_fused_fields = false;
+  // Not owned, can be null
+  FieldAverager* m_averager = nullptr;
+  // The step at which each species is advanced next
+  std::vector<uint32_t> m_next_advance;
 
   // modules
   std::unique_ptr<ParticlePusher> m_pusher;
   std::unique_ptr<CurrentDepositer> m_depositer;
+  // Only there when CURRENT_SMOOTHING is on
+  std::unique_ptr<CurrentFilter> m_filter;
   std::unique_ptr<FieldSolver> m_field_solver;
   std::unique_ptr<DomainCommunicator> m_comm;
 };  // ----- end of class PICSim -----
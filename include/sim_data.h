@@ -1,6 +1,7 @@
 #ifndef _SIM_DATA_H_
 #define _SIM_DATA_H_
 
+#include "data/background_geometry.h"
 #include "data/enum_types.h"
 #include "data/fields.h"
 #include "data/grid.h"
@@ -22,11 +23,23 @@ struct SimData {
   VectorField<Scalar> B;
   VectorField<Scalar> J;
   std::vector<ScalarField<Scalar> > Rho;
-  std::vector<ScalarField<Scalar> > Rho_avg;
   std::vector<ScalarField<Scalar> > J_s;
-  std::vector<ScalarField<Scalar> > J_avg;
+  BackgroundGeometry geometry;
 
   std::vector<Particles> particles;  // Each species occupies an array
+  // Species sp is pushed and deposited with subcycle[sp] * dt once every
+  // subcycle[sp] steps, and advance[sp] tells whether this is one of those
+  // steps. Its current and charge density are held in between
+  std::vector<int> subcycle;
+  std::vector<bool> advance;
+  // Whether the deposit of species sp fills Rho[sp] as well as J_s[sp]. The
+  // charge density is only needed by the diagnostics, so PICSim sets this for
+  // the advances whose result is sampled
+  std::vector<bool> deposit_rho;
+  // Whether species sp deposits its current into J_s[sp], which is then
+  // added to J. Only held and sampled currents need their own array, so
+  // PICSim clears this for the other advances, which deposit straight into J
+  std::vector<bool> keep_current;
   Photons photons;
   int num_species;
   double time = 0.0;
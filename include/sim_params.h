@@ -27,6 +27,9 @@ struct SimParams {
   unsigned long max_ptc_number    = 100;
   unsigned long max_photon_number = 100;
   double        ion_mass          = 1.0;
+  // Number of steps each species (electron, positron, ion) is advanced by
+  // at a time. 0 means it is chosen automatically
+  std::array<int, 3> subcycle     = {1, 1, 1};
 
   bool          gravity_on        = false;
   double        gravity           = 0.0;
@@ -36,7 +39,23 @@ struct SimParams {
 
   // simulation parameters
   int         interpolation_order = 1;
+  // Number of binomial filter passes on the current, and whether to add a
+  // pass that compensates the damping of long wavelengths
   int         current_smoothing   = 0;
+  bool        current_compensate  = false;
+  // Largest number of chunks a species is split into for the threaded
+  // deposit. The result depends on it, but not on the number of threads
+  int         deposit_chunks      = 16;
+  // Whether the periodic sort also orders the particles of a tile by cell
+  bool        sort_by_cell        = false;
+  // Whether the particles are kept sorted every step, instead of sorted
+  // every 100 steps
+  bool        incremental_sort    = false;
+  // The per species charge and current are sampled for the averaged output
+  // over the last diag_window steps before each output step (0 for the whole
+  // data interval), once every diag_stride steps
+  int         diag_window         = 0;
+  int         diag_stride         = 1;
   std::string data_dir            = "../Data/";
   std::string data_file_prefix    = "output";
   bool        data_compress       = true;
@@ -64,9 +83,13 @@ struct SimParams {
   std::array<std::string, 3> data_grid_config;
 
   std::string algorithm_ptc_move = "mapping";
-  std::string algorithm_ptc_push = "Vay";
+  std::string algorithm_ptc_push = "geodesic";
   std::string algorithm_field_update = "integral";
+  // Centering of the field the particles see with the implicit field update
+  double      implicit_theta      = 0.5;
   std::string algorithm_current_deposit = "Esirkepov";
+  std::string step_engine = "staged";
+  std::string field_engine = "fused";
   std::string initial_condition = "empty";
 };
 
@@ -19,6 +19,17 @@ namespace Aperture {
 void* aligned_malloc(std::size_t size, std::size_t alignment);
 void aligned_free(void* p);
 
+/// Reserve size bytes of address space, aligned to a page. The pages only
+/// take up memory once they are written to, and read as zero before that
+void* reserve_pages(std::size_t size);
+/// Move a reservation to one of new_size bytes, keeping the contents. On
+/// Linux the pages are remapped rather than copied
+void* grow_pages(void* p, std::size_t old_size, std::size_t new_size);
+/// Give the whole pages in [p, p + size) back to the system, keeping the
+/// reservation. They read as zero afterwards
+void release_pages(void* p, std::size_t size);
+void free_pages(void* p, std::size_t size);
+
 template <typename StructOfArrays>
 void
 alloc_struct_of_arrays(StructOfArrays& data, std::size_t max_num, std::size_t alignment) {
@@ -41,6 +52,55 @@ free_struct_of_arrays(StructOfArrays& data) {
     });
 }
 
+/// The page reserved versions of the above, for arrays that are filled
+/// gradually. The number of elements reserved needs to be passed back in
+template <typename StructOfArrays>
+void
+reserve_struct_of_arrays(StructOfArrays& data, std::size_t max_num) {
+  boost::fusion::for_each(data, [max_num](auto& x) {
+      typedef typename std::remove_reference<decltype(*x)>::type x_type;
+      void* p = reserve_pages(max_num * sizeof(x_type));
+      x = reinterpret_cast<typename std::remove_reference<decltype(x)>::type>(p);
+    });
+}
+
+template <typename StructOfArrays>
+void
+grow_struct_of_arrays(StructOfArrays& data, std::size_t old_num,
+                      std::size_t new_num) {
+  boost::fusion::for_each(data, [old_num, new_num](auto& x) {
+      typedef typename std::remove_reference<decltype(*x)>::type x_type;
+      void* p = grow_pages(reinterpret_cast<void*>(x), old_num * sizeof(x_type),
+                           new_num * sizeof(x_type));
+      x = reinterpret_cast<typename std::remove_reference<decltype(x)>::type>(p);
+    });
+}
+
+/// Release the elements in [begin, end) of every array
+template <typename StructOfArrays>
+void
+release_struct_of_arrays(StructOfArrays& data, std::size_t begin,
+                         std::size_t end) {
+  boost::fusion::for_each(data, [begin, end](auto& x) {
+      typedef typename std::remove_reference<decltype(*x)>::type x_type;
+      if (x != nullptr && end > begin)
+        release_pages(reinterpret_cast<void*>(x + begin),
+                      (end - begin) * sizeof(x_type));
+    });
+}
+
+template <typename StructOfArrays>
+void
+free_reserved_struct_of_arrays(StructOfArrays& data, std::size_t max_num) {
+  boost::fusion::for_each(data, [max_num](auto& x) {
+      typedef typename std::remove_reference<decltype(*x)>::type x_type;
+      if (x != nullptr) {
+        free_pages(reinterpret_cast<void*>(x), max_num * sizeof(x_type));
+        x = nullptr;
+      }
+    });
+}
+
 }
 
 #endif  // _UTILS_MEMORY_H_
@@ -220,6 +220,8 @@ class MPIComm {
   std::unique_ptr<MPICommCartesian> _cartesian;
 
   const int _world_root = 0;
+  // Whether MPI was initialized here, and so is finalized here as well
+  bool _owns_mpi = false;
 
  public:
   MPIComm();
@@ -531,6 +531,7 @@ MPIComm::MPIComm(int* argc, char*** argv) {
   MPI_Initialized(&is_initialized);
 
   if (!is_initialized) {
+    _owns_mpi = true;
     if (argc == nullptr && argv == nullptr) {
       MPI_Init(NULL, NULL);
     } else {
@@ -552,7 +553,7 @@ MPIComm::~MPIComm() {
   int is_finalized = 0;
   MPI_Finalized(&is_finalized);
 
-  if (!is_finalized) MPI_Finalize();
+  if (_owns_mpi && !is_finalized) MPI_Finalize();
 }
 
 std::vector<int>
@@ -0,0 +1,25 @@
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+#include "data/enum_types.h"
+
+// The SIMD kernels are written with x86 intrinsics and compiled with
+// per-function target attributes, so that a generic build can still pick
+// the best instruction set at run time.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define APERTURE_X86_SIMD
+#endif
+
+namespace Aperture {
+
+/// Find the widest instruction set supported by the running cpu
+SimdLevel detect_simd_level();
+
+/// Number of doubles processed per vector at the given level
+int simd_width(SimdLevel level);
+
+const char* simd_level_name(SimdLevel level);
+
+}
+
+#endif  // _SIMD_H_
@@ -0,0 +1,135 @@
+#include "algorithm_registry.h"
+#include "algorithms/current_deposit_Esirkepov.h"
+#include "algorithms/field_solver_finite_diff.h"
+#include "algorithms/field_solver_implicit.h"
+#include "algorithms/field_solver_integral.h"
+#include "algorithms/ptc_pusher_geodesic.h"
+#include "sim_environment.h"
+#include <iostream>
+#include <stdexcept>
+
+namespace Aperture {
+
+namespace {
+
+std::unique_ptr<ParticlePusher>
+make_geodesic(SimdLevel level) {
+  auto pusher = std::make_unique<ParticlePusher_Geodesic>();
+  pusher->set_simd_level(level);
+  return pusher;
+}
+
+}  // namespace
+
+template <typename T>
+std::unique_ptr<T>
+AlgorithmRegistry<T>::create(const std::string& name,
+                             const Environment& env) const {
+  auto entry = find(name);
+  if (entry == nullptr) {
+    std::string names;
+    for (auto& e : m_entries) names += " " + e.name;
+    throw std::invalid_argument("Unknown " + m_kind + " " + name +
+                                ", available are" + names);
+  }
+  return entry->create(env);
+}
+
+template <>
+AlgorithmRegistry<ParticlePusher>&
+AlgorithmRegistry<ParticlePusher>::instance() {
+  static AlgorithmRegistry registry = [] {
+    AlgorithmRegistry r("particle pusher", "algorithm_ptc_push");
+    r.add("geodesic",
+          "Geodesic push, with the widest SIMD kernels the cpu supports",
+          [](const Environment& env) {
+            return make_geodesic(detect_simd_level());
+          });
+    r.add("geodesic_scalar", "Geodesic push, one particle at a time",
+          [](const Environment& env) {
+            return make_geodesic(SimdLevel::scalar);
+          });
+    r.add("geodesic_avx2", "Geodesic push, AVX2 kernels at most",
+          [](const Environment& env) {
+            return make_geodesic(SimdLevel::avx2);
+          });
+    r.add("geodesic_avx512", "Geodesic push, AVX-512 kernels at most",
+          [](const Environment& env) {
+            return make_geodesic(SimdLevel::avx512);
+          });
+    return r;
+  }();
+  return registry;
+}
+
+template <>
+AlgorithmRegistry<CurrentDepositer>&
+AlgorithmRegistry<CurrentDepositer>::instance() {
+  static AlgorithmRegistry registry = [] {
+    AlgorithmRegistry r("current depositer", "algorithm_current_deposit");
+    r.add("Esirkepov",
+          "Charge conserving deposit, in DEPOSIT_CHUNKS chunks per thread",
+          [](const Environment& env) {
+            return std::make_unique<CurrentDepositer_Esirkepov>(env);
+          });
+    return r;
+  }();
+  return registry;
+}
+
+template <>
+AlgorithmRegistry<FieldSolver>&
+AlgorithmRegistry<FieldSolver>::instance() {
+  static AlgorithmRegistry registry = [] {
+    AlgorithmRegistry r("field solver", "algorithm_field_update");
+    r.add("integral", "Explicit 1D update of E from the current",
+          [](const Environment& env) {
+            return std::make_unique<FieldSolver_Integral>(
+                env.local_grid(), env.local_grid_dual());
+          });
+    r.add("implicit",
+          "Semi-implicit 1D update, stable beyond the plasma period",
+          [](const Environment& env) {
+            return std::make_unique<FieldSolver_Implicit>(
+                env.local_grid(), env.local_grid_dual(),
+                env.conf().implicit_theta);
+          });
+    r.add("finite_diff", "Explicit Yee scheme on 1D to 3D grids",
+          [](const Environment& env) {
+            return std::make_unique<FieldSolver_FiniteDiff>(
+                env.local_grid(), env.local_grid_dual());
+          });
+    return r;
+  }();
+  return registry;
+}
+
+template class AlgorithmRegistry<ParticlePusher>;
+template class AlgorithmRegistry<CurrentDepositer>;
+template class AlgorithmRegistry<FieldSolver>;
+
+namespace {
+
+template <typename T>
+void
+list_registry(std::ostream& os) {
+  auto& registry = AlgorithmRegistry<T>::instance();
+  os << registry.kind() << " (" << registry.config_key() << "):\n";
+  for (auto& entry : registry.entries()) {
+    os << "  " << entry.name
+       << (entry.name == registry.default_name() ? " (default)" : "") << "\n"
+       << "      " << entry.description << "\n";
+  }
+}
+
+}  // namespace
+
+void
+list_algorithms(std::ostream& os) {
+  list_registry<ParticlePusher>(os);
+  list_registry<CurrentDepositer>(os);
+  list_registry<FieldSolver>(os);
+  os << std::flush;
+}
+
+}  // namespace Aperture
@@ -1,7 +1,9 @@
 #include "algorithms/current_deposit_Esirkepov.h"
+#include "algorithms/current_deposit_kernels.h"
 #include "algorithms/interpolation.h"
 #include "utils/util_functions.h"
 #include "data/detail/multi_array_utils.hpp"
+#include <limits>
 
 namespace Aperture {
 
@@ -13,22 +15,103 @@ CurrentDepositer_Esirkepov::~CurrentDepositer_Esirkepov() {}
 void CurrentDepositer_Esirkepov::deposit(SimData& data, double dt) {
   Logger::print_detail("Depositing current");
   auto& part = data.particles;
-  data.J.initialize();
+  begin_deposit(data);
 
   for (Index_t i = 0; i < part.size(); i++) {
-    data.Rho[i].initialize();
-    data.J_s[i].initialize();
-    // data.V[i].initialize();
-    split_delta_rho(data.J_s[i], data.Rho[i], part[i], dt);
+    if (!data.advance[i] || part[i].number() == 0) continue;
+    deposit_species(data, i, data.subcycle[i] * dt);
     // normalize_density(data.Rho[i], data.Rho[i]);
   }
 
+  finish_deposit(data);
+}
+
+void CurrentDepositer_Esirkepov::begin_deposit(SimData& data) {
+  data.J.initialize();
+  // Species that are not advanced this step keep their J_s and Rho from the
+  // last time they were. Rho is only deposited for the diagnostics
+  for (Index_t i = 0; i < data.particles.size(); i++) {
+    if (!data.advance[i]) continue;
+    if (data.deposit_rho[i]) data.Rho[i].initialize();
+    if (data.keep_current[i]) data.J_s[i].initialize();
+    // data.V[i].initialize();
+  }
+}
+
+void CurrentDepositer_Esirkepov::deposit_range(DepositWindow& window,
+                                               const Particles& particles,
+                                               double dt, Index_t begin,
+                                               Index_t end) {
+  switch (m_interp) {
+    case 0:
+      deposit_range<0>(window, particles, dt, begin, end);
+      break;
+    case 1:
+      deposit_range<1>(window, particles, dt, begin, end);
+      break;
+    case 2:
+      deposit_range<2>(window, particles, dt, begin, end);
+      break;
+    case 3:
+      deposit_range<3>(window, particles, dt, begin, end);
+      break;
+    default:
+      break;
+  }
+}
+
+template <int Order>
+void CurrentDepositer_Esirkepov::deposit_range(DepositWindow& window,
+                                               const Particles& particles,
+                                               double dt, Index_t begin,
+                                               Index_t end) {
+  typedef shape_function<Order> shape;
+  // Size of the batches handed to the kernel
+  const Index_t batch = 64;
+  auto& part = particles.data();
+  double delta = m_env.local_grid().mesh().delta[0];
+  for (Index_t b0 = begin; b0 < end; b0 += batch) {
+    Index_t b1 = std::min(end, b0 + batch);
+    int lo = std::numeric_limits<int>::max(), hi = 0;
+    for (Index_t n = b0; n < b1; n++) {
+      if (particles.is_empty(n)) continue;
+      lo = std::min(lo, (int)part.cell[n]);
+      hi = std::max(hi, (int)part.cell[n]);
+    }
+    if (lo > hi) continue;
+    // The stencil of a particle spans one more cell at either end than its
+    // charge does, since it moves by less than a cell in one step
+    lo -= shape::reach + 2;
+    hi += shape::reach + 1;
+    if (window.fits(lo, hi)) {
+      window.cover(lo, hi);
+      deposit_flux<Order>(window.J(), window.Rho(), window.offset(), part,
+                          particles.displacement(), b0, b1,
+                          particles.charge(), delta, dt);
+      continue;
+    }
+    // The batch is too spread out, which happens for particles created
+    // since the last sort
+    for (Index_t n = b0; n < b1; n++) {
+      if (particles.is_empty(n)) continue;
+      int c = part.cell[n];
+      window.cover(c - shape::reach - 2, c + shape::reach + 1);
+      deposit_flux<Order>(window.J(), window.Rho(), window.offset(), part,
+                          particles.displacement(), n, n + 1,
+                          particles.charge(), delta, dt);
+    }
+  }
+}
+
+void CurrentDepositer_Esirkepov::finish_deposit(SimData& data) {
+  auto& part = data.particles;
   // Handle periodic boundary by copying over the deposited quantities
   if (m_periodic) {
     auto& mesh = data.J.grid().mesh();
     for (int i = 0; i < mesh.guard[0]; i++) {
       // rho
       for (unsigned int j = 0; j < part.size(); j++) {
+        if (!data.advance[j] || !data.deposit_rho[j]) continue;
         data.Rho[j](i + mesh.reduced_dim(0)) += data.Rho[j](i);
         data.Rho[j](i) = 0.0;
         data.Rho[j](2 * mesh.guard[0] - 1 - i) += data.Rho[j](mesh.dims[0] - 1 - i);
@@ -41,21 +124,31 @@ void CurrentDepositer_Esirkepov::deposit(SimData& data, double dt) {
   // communication on the just deposited Rho
   if (m_comm_rho != nullptr) {
     for (Index_t i = 0; i < part.size(); i++) {
-      m_comm_rho(data.Rho[i]);
+      if (data.advance[i] && data.deposit_rho[i]) m_comm_rho(data.Rho[i]);
+    }
+  }
+
+  // The deposit gives the current through every face directly, so unlike the
+  // original Esirkepov scheme there is no scan here
+  // Species that deposited straight into J are already there
+  for (Index_t sp = 0; sp < 2; sp++) {
+    if (!data.keep_current[sp]) continue;
+    if (m_edge_sum_only) {
+      // The field solver adds up the rest in its own sweep
+      auto& mesh = data.J.grid().mesh();
+      int edge = std::min(2 * mesh.guard[0], mesh.dims[0]);
+      for (int i = 0; i < edge; i++) data.J(0, i) += data.J_s[sp](i);
+      for (int i = std::max(edge, mesh.dims[0] - edge); i < mesh.dims[0]; i++)
+        data.J(0, i) += data.J_s[sp](i);
+    } else {
+      detail::map_multi_array(data.J.data(0).begin(), data.J_s[sp].data().begin(),
+                              data.J.grid().extent(), detail::Op_PlusAssign<Scalar>());
     }
   }
-  // Now we have delta Q in every cell, add them up along all directions
-
-  scan_current(data.J_s[0]);
-  scan_current(data.J_s[1]);
-  detail::map_multi_array(data.J.data(0).begin(), data.J_s[0].data().begin(),
-                          data.J.grid().extent(), detail::Op_PlusAssign<Scalar>());
-  detail::map_multi_array(data.J.data(0).begin(), data.J_s[1].data().begin(),
-                          data.J.grid().extent(), detail::Op_PlusAssign<Scalar>());
   // for (unsigned int j = 0; j < part.size(); j++) {
   //   normalize_velocity(data.Rho[j], data.V[j]);
   // }
-  // Call communication on just scanned J
+  // Call communication on the summed J
   if (m_comm_J != nullptr) {
     m_comm_J(data.J);
   }
@@ -73,114 +166,46 @@ void CurrentDepositer_Esirkepov::deposit(SimData& data, double dt) {
   }
 }
 
-void CurrentDepositer_Esirkepov::split_delta_rho(vfield& J, sfield& Rho,
-                                                 const Particles& particles,
+void CurrentDepositer_Esirkepov::deposit_species(SimData& data, Index_t sp,
                                                  double dt) {
-  Interpolator interp(m_interp);
-  auto& part = particles.data();
-  auto& grid = J.grid();
-  auto charge = particles.charge();
-  if (grid.dim() == 1) {
-    // Logger::print_info("Computing rho");
-    // loop over all the particles
-    for (Index_t n = 0; n < particles.number(); n++) {
-      if (particles.is_empty(n)) continue;
-      // double v = part.p1[n] / part.gamma[n];
-
-      int c = part.cell[n];
-      int c_p = c;
-      auto x = part.x1[n];
-      auto x_p = part.x1[n] - part.dx1[n];
-      c_p += std::floor(x_p);
-      x_p -= (double)c_p - c;
-      // Logger::print_info("{}, {}, {}, {}", c, c_p, x, x_p);
-      // auto v3 = part.dx3[n];
-
-      double s0, s1;
-      for (int i = c_p - interp.radius() - 1;
-           i <= c_p + interp.support() - interp.radius(); i++) {
-        double w0 = interp.interp_cell(x, c, i);
-        s1 = w0;
-        // This is kinda redundant
-        // int idx = grid.mesh().get_idx(i);
-        // assert(idx < grid.mesh().dims[0] && idx >= 0);
-
-        if (!check_bit(part.flag[n], ParticleFlag::ignore_current)) {
-          double w0_p = interp.interp_cell(x_p, c_p, i);
-          // double w1_p = interp.interp_cell(x_p[1], c_p[1], j);
-          s0 = w0_p;
-          // double s00 = w0_p * w1_p;
-          J(0, i) += -charge * (s1 - s0) * grid.mesh().delta[0] / dt;
-        }
-        Rho(i) += charge * s1;
-        // V(i) += v * s1;
-        // Logger::print_info("weights are {}, {}; {}", s0, s1, s1-s0);
-      }
-    }
+  switch (m_interp) {
+    case 0:
+      deposit_species<0>(data, sp, dt);
+      break;
+    case 1:
+      deposit_species<1>(data, sp, dt);
+      break;
+    case 2:
+      deposit_species<2>(data, sp, dt);
+      break;
+    case 3:
+      deposit_species<3>(data, sp, dt);
+      break;
+    default:
+      break;
   }
 }
 
-void CurrentDepositer_Esirkepov::split_delta_rho(sfield& J, sfield& Rho,
-                                                 const Particles& particles,
+template <int Order>
+void CurrentDepositer_Esirkepov::deposit_species(SimData& data, Index_t sp,
                                                  double dt) {
-  Interpolator interp(m_interp);
+  auto& particles = data.particles[sp];
   auto& part = particles.data();
-  auto& grid = J.grid();
+  auto& grid = data.J.grid();
   auto charge = particles.charge();
   if (grid.dim() == 1) {
     // Logger::print_info("Computing rho");
-    // loop over all the particles
-    for (Index_t n = 0; n < particles.number(); n++) {
-      if (particles.is_empty(n)) continue;
-      // double v = part.p1[n] / part.gamma[n];
-
-      int c = part.cell[n];
-      int c_p = c;
-      auto x = part.x1[n];
-      auto x_p = part.x1[n] - part.dx1[n];
-      c_p += std::floor(x_p);
-      x_p -= (double)c_p - c;
-      // Logger::print_info("{}, {}, {}, {}", c, c_p, x, x_p);
-      // auto v3 = part.dx3[n];
-
-      double s0, s1;
-      for (int i = c_p - interp.radius() - 1;
-           i <= c_p + interp.support() - interp.radius(); i++) {
-        double w0 = interp.interp_cell(x, c, i);
-        s1 = w0;
-        // This is kinda redundant
-        // int idx = grid.mesh().get_idx(i);
-        // assert(idx < grid.mesh().dims[0] && idx >= 0);
-
-        if (!check_bit(part.flag[n], ParticleFlag::ignore_current)) {
-          double w0_p = interp.interp_cell(x_p, c_p, i);
-          // double w1_p = interp.interp_cell(x_p[1], c_p[1], j);
-          s0 = w0_p;
-          // double s00 = w0_p * w1_p;
-          J(i) += -charge * (s1 - s0) * grid.mesh().delta[0] / dt;
-        }
-        Rho(i) += charge * s1;
-        // Logger::print_info("weights are {}, {}; {}", s0, s1, s1-s0);
-      }
-    }
-  }
-}
-
-void CurrentDepositer_Esirkepov::scan_current(sfield& J) {
-  auto& grid = J.grid();
-  if (grid.dim() == 1) {
-    for (int i = 1; i < grid.mesh().dims[0]; i++) {
-      J.data()[i] += J.data()[i-1];
-    }
-  }
-}
-
-void CurrentDepositer_Esirkepov::scan_current(vfield& J) {
-  auto& grid = J.grid();
-  if (grid.dim() == 1) {
-    for (int i = 1; i < grid.mesh().dims[0]; i++) {
-      J.data(0)[i] += J.data(0)[i-1];
+    // loop over all the particles, one chunk per thread at a time
+    const Index_t num = particles.number();
+    const Index_t num_chunks = begin_chunks(data, sp);
+#pragma omp parallel for schedule(dynamic)
+    for (Index_t k = 0; k < num_chunks; k++) {
+      Index_t end = std::min(num, (k + 1) * chunk_size());
+      deposit_flux<Order>(chunk_J(k), chunk_Rho(k), 0, part,
+                          particles.displacement(), k * chunk_size(), end,
+                          charge, grid.mesh().delta[0], dt);
     }
+    reduce_chunks();
   }
 }
 
@@ -1,113 +1,67 @@
-#include "field_solver.h"
-#include "data/detail/multi_array_utils.hpp"
+#include "algorithms/field_solver_finite_diff.h"
+#include "algorithms/finite_diff.h"
 
 using namespace Aperture;
 
-FieldSolver_FiniteDiff::FieldSolver_FiniteDiff(const Grid& g, double alpha)
-    :  m_dE(g), m_dB(g), m_E_tmp(g), m_B_old(g),
-       m_vfield_tmp(g), m_sfield_tmp(g),
-       m_alpha(alpha), m_beta(1.0 - alpha) {
-  m_dE.set_field_type(FieldType::E);
-  m_dB.set_field_type(FieldType::B);
-  m_E_tmp.set_field_type(FieldType::E);
-  m_B_old.set_field_type(FieldType::B);
+FieldSolver_FiniteDiff::FieldSolver_FiniteDiff(const Grid &g,
+                                               const Grid &g_dual, int order)
+    : m_order(order), m_curlE(g), m_curlB(g), m_background_j(g) {
+  m_background_j.initialize();
 }
 
 FieldSolver_FiniteDiff::~FieldSolver_FiniteDiff() {}
 
 void
-FieldSolver_FiniteDiff::compute_laplacian(const vfield &input, vfield &output, const Index &start, const Extent &ext, const bool is_boundary[], int order) {
-  // Invoke the series of differential operators
-  FiniteDiff::compute_curl(input, m_vfield_tmp, is_boundary, start, ext, order);
-  if (m_comm_callback_vfield != nullptr)
-    m_comm_callback_vfield(m_vfield_tmp);
-  m_vfield_tmp.set_stagger(input.stagger_dual());
-
-  FiniteDiff::compute_divergence(input, m_sfield_tmp, is_boundary, start, ext, order);
-  if (m_comm_callback_sfield != nullptr)
-    m_comm_callback_sfield(m_sfield_tmp);
-
-  FiniteDiff::compute_curl(m_vfield_tmp, output, is_boundary, start, ext, order);
-  FiniteDiff::compute_gradient(m_sfield_tmp, m_vfield_tmp, is_boundary, start, ext, order);
-
-  // Put both components together
-  for (int comp = 0; comp < 3; comp++) {
-    subtract(output.data(comp).begin(), m_vfield_tmp.data(comp).begin(), output.grid().mesh().extent());
-    multiply(output.data(comp).begin(), output.grid().mesh().extent(), -1.0);
-  }
-
-  // FIXME: Is this really needed?
-  if (m_comm_callback_vfield != nullptr)
-    m_comm_callback_vfield(output);
-}
-
-// Implicit field updater
-void
-FieldSolver_FiniteDiff::compute_B_update(vfield &B, const vfield &E, const vfield& J, double dt) {
-  const int num_expansion = 5;
-  // Assuming B, E, and J are already communicated
-  m_B_old.copyFrom(B);
-  m_dB.assign(0.0);
-  if (std::abs(m_beta) > EPS) {
-    compute_laplacian(B, m_dB, m_bc -> bound_start(), m_bc -> bound_ext(), m_bc -> is_boundary());
-    B.addBy(m_dB.multiplyBy(m_alpha * m_beta * dt * dt));
+FieldSolver_FiniteDiff::update_fields(vfield_t &E, vfield_t &B,
+                                      const vfield_t &J, double dt,
+                                      double time) {
+  auto &mesh = E.grid().mesh();
+  FiniteDiff::compute_curl(E, m_curlE, m_order);
+  for (int n = 0; n < VECTOR_DIM; n++) {
+    Scalar *b = B.ptr(n);
+    const Scalar *c = m_curlE.ptr(n);
+#pragma omp parallel for simd
+    for (int i = 0; i < mesh.size(); i++) b[i] -= dt * c[i];
   }
-
-  // FIXME: Boundary adjust issue
-  FiniteDiff::compute_curl(E, m_dB, m_bc -> is_boundary(), m_bc -> bound_start(), m_bc -> bound_ext());
-  B.addBy(m_dB.multiplyBy(-1.0 * dt));
-
-  FiniteDiff::compute_curl(J, m_dB, m_bc -> is_boundary(), m_bc -> bound_start(), m_bc -> bound_ext());
-  B.addBy(m_dB.multiplyBy(m_alpha * dt * dt));
-
-  if (m_comm_callback_vfield != nullptr)
+  if (m_comm_callback_vfield != nullptr) {
     m_comm_callback_vfield(B);
-
-  m_dB.copyFrom(B);
-  double factor = dt * dt * m_alpha * m_alpha;
-  for (int j = 0; j < num_expansion; j++) {
-    m_dB.multiplyBy(factor);
-    compute_laplacian(m_dB, m_dB, m_bc -> bound_start(), m_bc -> bound_ext(), m_bc -> is_boundary());
-    B.addBy(m_dB);
-
-    if (m_comm_callback_vfield != nullptr)
-      m_comm_callback_vfield(m_dB);
   }
 
-  if (m_comm_callback_vfield != nullptr)
-    m_comm_callback_vfield(B);
-}
-
-void
-FieldSolver_FiniteDiff::compute_E_update(vfield &E, const vfield &B, const vfield &J, double dt) {
-  // Assume communication is already done
-  FiniteDiff::compute_curl(B, m_E_tmp, m_bc -> is_boundary(), m_bc -> bound_start(), m_bc -> bound_ext());
-  m_dE.addBy(m_E_tmp.multiplyBy(m_alpha));
-
-  FiniteDiff::compute_curl(m_B_old, m_E_tmp, m_bc -> is_boundary(), m_bc -> bound_start(), m_bc -> bound_ext());
-  m_dE.addBy(m_E_tmp.multiplyBy(m_beta));
-
-  m_dE.subtractBy(J);
-  m_dE.multiplyBy(dt);
-  E.addBy(m_dE);
-
-  if (m_comm_callback_vfield != nullptr)
+  // curl B is only computed in the bulk, so the same range is used for the
+  // current, which leaves the guard cells to the communication
+  FiniteDiff::compute_curl(B, m_curlB, m_order);
+  for (int n = 0; n < VECTOR_DIM; n++) {
+    Scalar *e = E.ptr(n);
+    const Scalar *c = m_curlB.ptr(n);
+    const Scalar *j = J.ptr(n);
+    const Scalar *jb = m_background_j.ptr(n);
+    int lo[3], hi[3];
+    for (int d = 0; d < 3; d++) {
+      bool bulk = (d < mesh.dim());
+      lo[d] = (bulk ? mesh.guard[d] - (int)E.stagger(n)[d] : 0);
+      hi[d] = (bulk ? mesh.dims[d] - mesh.guard[d] : mesh.dims[d]);
+    }
+#pragma omp parallel for collapse(2)
+    for (int k = lo[2]; k < hi[2]; k++) {
+      for (int jj = lo[1]; jj < hi[1]; jj++) {
+        const int row = mesh.get_idx(0, jj, k);
+#pragma omp simd
+        for (int i = row + lo[0]; i < row + hi[0]; i++)
+          e[i] += dt * (c[i] + jb[i] - j[i]);
+      }
+    }
+  }
+  if (m_comm_callback_vfield != nullptr) {
     m_comm_callback_vfield(E);
-
-}
-
-void
-FieldSolver_FiniteDiff::update_fields(vfield &E, vfield &B, const vfield &J, double dt, double time) {
-  compute_B_update(B, E, J, dt);
-  compute_E_update(B, E, J, dt);
+  }
 }
 
 void
-FieldSolver_FiniteDiff::update_fields(Aperture::SimData &data, double dt, double time) {
-
+FieldSolver_FiniteDiff::update_fields(SimData &data, double dt, double time) {
+  update_fields(data.E, data.B, data.J, dt, time);
 }
 
 void
-FieldSolver_FiniteDiff::compute_flux(const vfield &f, sfield &flux) {
-
+FieldSolver_FiniteDiff::set_background_j(const vfield_t &J) {
+  m_background_j = J;
 }
@@ -0,0 +1,107 @@
+#include "algorithms/field_solver_implicit.h"
+#include "current_depositer.h"
+#include "utils/util_functions.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace Aperture;
+
+FieldSolver_Implicit::FieldSolver_Implicit(const Grid &g, const Grid &g_dual,
+                                           double theta)
+    : FieldSolver_Integral(g, g_dual),
+      m_theta(std::min(std::max(theta, 0.0), 1.0)) {}
+
+FieldSolver_Implicit::~FieldSolver_Implicit() {}
+
+void
+FieldSolver_Implicit::predict_fields(SimData &data,
+                                     CurrentDepositer &depositer, double dt) {
+  auto &grid = data.E.grid();
+  auto &mesh = grid.mesh();
+  if (grid.dim() != 1) return;
+
+  m_chi.assign(mesh.dims[0], 0.0);
+  for (Index_t sp = 0; sp < data.particles.size(); sp++) {
+    // A species that is not advanced holds its current
+    auto &part = data.particles[sp];
+    if (!data.advance[sp] || part.number() == 0) continue;
+    // Summed in chunks like the deposit, one chunk per thread at a time
+    const Index_t num = part.number();
+    const Index_t num_chunks =
+        depositer.begin_chunks(m_chi.data(), nullptr, mesh.dims[0], num);
+    const Index_t chunk_size = depositer.chunk_size();
+#pragma omp parallel for schedule(dynamic)
+    for (Index_t k = 0; k < num_chunks; k++) {
+      add_susceptibility(part, data.geometry, data.subcycle[sp] * dt, dt,
+                         depositer.chunk_J(k), k * chunk_size,
+                         std::min(num, (k + 1) * chunk_size));
+    }
+    depositer.reduce_chunks();
+  }
+
+  Scalar *E = data.E.ptr(0);
+  m_E_old.assign(E, E + mesh.dims[0]);
+  predict(E, data.J.ptr(0), m_background_j.ptr(0), m_chi.data(), m_theta, dt,
+          mesh.guard[0] - 1, mesh.dims[0] - mesh.guard[0]);
+  if (m_comm_callback_vfield != nullptr) {
+    m_comm_callback_vfield(data.E);
+  }
+  m_predicted = true;
+}
+
+void
+FieldSolver_Implicit::update_fields(SimData &data, double dt, double time) {
+  restore(data);
+  FieldSolver_Integral::update_fields(data, dt, time);
+}
+
+void
+FieldSolver_Implicit::update_fields_fused(SimData &data, double dt,
+                                          Scalar *E_sum, bool sum_species) {
+  restore(data);
+  FieldSolver_Integral::update_fields_fused(data, dt, E_sum, sum_species);
+}
+
+void
+FieldSolver_Implicit::restore(SimData &data) {
+  if (!m_predicted) return;
+  std::copy(m_E_old.begin(), m_E_old.end(), data.E.ptr(0));
+  m_predicted = false;
+}
+
+void
+FieldSolver_Implicit::add_susceptibility(const Particles &particles,
+                                         const BackgroundGeometry &geom,
+                                         double dt_sp, double dt,
+                                         Scalar *chi, Index_t begin,
+                                         Index_t end) {
+  auto &ptc = particles.data();
+  const double coef =
+      dt * dt_sp * particles.charge() * particles.charge() / particles.mass();
+  for (Index_t n = begin; n < end; n++) {
+    if (particles.is_empty(n) ||
+        check_bit(ptc.flag[n], ParticleFlag::ignore_EM))
+      continue;
+    int cell = ptc.cell[n];
+    double x = ptc.x1[n];
+    double beta = geom.beta(cell, x);
+    double p = ptc.p1[n];
+    double g = std::sqrt(1.0 + p * p + beta * beta);
+    // The pusher moves with v = s (s p / g + beta^2) / (1 + beta^2), where s
+    // is the sign of beta. The two signs cancel in dv/dp, and
+    // d(p / g)/dp = (1 + beta^2) / g^3 cancels the denominator
+    double k = coef / (g * g * g);
+    // Same weights as the field the pusher interpolates
+    chi[cell] += k * x;
+    chi[cell - 1] += k * (1.0 - x);
+  }
+}
+
+void
+FieldSolver_Implicit::predict(Scalar *E, const Scalar *J, const Scalar *Jb,
+                              const Scalar *chi, double theta, double dt,
+                              int begin, int end) {
+#pragma omp simd
+  for (int i = begin; i < end; i++)
+    E[i] = (E[i] + theta * dt * (Jb[i] - J[i])) / (1.0 + theta * chi[i]);
+}
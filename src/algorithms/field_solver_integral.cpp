@@ -1,4 +1,5 @@
 #include "algorithms/field_solver_integral.h"
+#include <algorithm>
 
 using namespace Aperture;
 
@@ -34,7 +35,57 @@ void
 FieldSolver_Integral::update_fields(Aperture::SimData &data, double dt,
                                     double time) {
   update_fields(data.E, data.B, data.J, dt, time);
-  data.B.addBy(data.E);
+}
+
+void
+FieldSolver_Integral::update_fields_fused(SimData &data, double dt,
+                                          Scalar *E_sum, bool sum_species) {
+  auto &grid = data.E.grid();
+  auto &mesh = grid.mesh();
+  if (grid.dim() == 1) {
+    Scalar *E = data.E.ptr(0);
+    Scalar *J = data.J.ptr(0);
+    const Scalar *Jb = m_background_j.ptr(0);
+    // Only species that kept their own current still need adding
+    const Scalar *J_sp[2];
+    int num_sp = 0;
+    for (Index_t sp = 0; sum_species && sp < 2; sp++)
+      if (data.keep_current[sp]) J_sp[num_sp++] = data.J_s[sp].ptr();
+    // The depositer summed J within edge cells of either end already
+    const int edge = std::min(2 * mesh.guard[0], mesh.dims[0]);
+    const int lo = mesh.guard[0] - 1, hi = mesh.dims[0] - mesh.guard[0];
+    for (int i = lo; i < edge; i++) E[i] += dt * (Jb[i] - J[i]);
+    // One sweep over the bulk does the species sum, the E update and the
+    // average. The guard cells of E change in the communication below, so
+    // their average is taken afterwards
+    if (num_sp > 0) {
+#pragma omp simd
+      for (int i = edge; i < mesh.dims[0] - edge; i++) {
+        for (int k = 0; k < num_sp; k++) J[i] += J_sp[k][i];
+        E[i] += dt * (Jb[i] - J[i]);
+        if (E_sum != nullptr) E_sum[i] += E[i];
+      }
+    } else {
+#pragma omp simd
+      for (int i = edge; i < mesh.dims[0] - edge; i++) {
+        E[i] += dt * (Jb[i] - J[i]);
+        if (E_sum != nullptr) E_sum[i] += E[i];
+      }
+    }
+    for (int i = std::max(edge, mesh.dims[0] - edge); i < hi; i++)
+      E[i] += dt * (Jb[i] - J[i]);
+
+    if (m_comm_callback_vfield != nullptr) {
+      m_comm_callback_vfield(data.E);
+    }
+    if (E_sum != nullptr) {
+      for (int i = 0; i < edge; i++) E_sum[i] += E[i];
+      for (int i = std::max(edge, mesh.dims[0] - edge); i < mesh.dims[0]; i++)
+        E_sum[i] += E[i];
+    }
+  } else {
+    FieldSolver::update_fields_fused(data, dt, E_sum, sum_species);
+  }
 }
 
 void
@@ -1,42 +1,21 @@
 #include "algorithms/ptc_pusher_geodesic.h"
 #include "utils/util_functions.h"
+#include <algorithm>
 #include <array>
 #include <cmath>
 #include <fmt/ostream.h>
 #include "utils/logger.h"
-#include "algorithms/functions.h"
-#ifdef __AVX2__
-#include <immintrin.h>
-#include <xmmintrin.h>
-#endif // __AVX2__
+#include "algorithms/ptc_pusher_geodesic_simd.h"
 
 namespace Aperture {
 
-#ifdef __AVX2__
+// Number of particles handed to a thread at a time, needs to be a multiple of
+// the widest vector
+static const Index_t push_chunk_size = 4096;
 
-__m256d beta_avx2(__m256d x) {
-  __m256d result = _mm256_fmadd_pd(_mm256_sub_pd(x, _mm256_set1_pd(0.05)),
-                                   _mm256_set1_pd(1.0/0.45), _mm256_set1_pd(-1.0));
-  return result;
-}
-
-__m256d gamma_avx2(__m256d beta_phi, __m256d p) {
-  __m256d b2p1 = _mm256_fmadd_pd(beta_phi, beta_phi, _mm256_set1_pd(1.0));
-  __m256d gamma2 = _mm256_fmadd_pd(p, p, b2p1);
-  return _mm256_sqrt_pd(gamma2);
-}
-
-__m256d sign(__m256d x)
-{
-    __m256d zero = _mm256_setzero_pd();
-
-    __m256d positive = _mm256_and_pd(_mm256_cmp_pd(x, zero, _CMP_GT_OS), _mm256_set1_pd(1.0));
-    __m256d negative = _mm256_and_pd(_mm256_cmp_pd(x, zero, _CMP_LT_OS), _mm256_set1_pd(-1.0));
-
-    return _mm256_or_pd(positive, negative);
-}
-
-#endif // __AVX2__
+// Without a periodic boundary, particles are erased once they are within
+// this many cells of the end of the grid
+static const int absorb_margin = 3;
 
 double gamma(double beta_phi, double p) {
   double b2 = beta_phi * beta_phi;
@@ -51,105 +30,132 @@ double gamma(double beta_phi, double p) {
   return std::sqrt(1.0 + p*p + b2);
 }
 
-ParticlePusher_Geodesic::ParticlePusher_Geodesic() {}
+ParticlePusher_Geodesic::ParticlePusher_Geodesic()
+    : m_simd_level(detect_simd_level()) {
+  Logger::print_info("Particle pusher using {} kernels",
+                     simd_level_name(m_simd_level));
+}
 
 ParticlePusher_Geodesic::~ParticlePusher_Geodesic() {}
 
+ParticlePusher_Geodesic&
+ParticlePusher_Geodesic::set_simd_level(SimdLevel level) {
+  SimdLevel available = detect_simd_level();
+  m_simd_level = (level > available ? available : level);
+  return *this;
+}
+
 void
 ParticlePusher_Geodesic::push(SimData& data, double dt) {
   Logger::print_info("In particle pusher");
-  auto& grid = data.E.grid();
+  for (Index_t sp = 0; sp < data.particles.size(); sp++) {
+    if (!data.advance[sp]) continue;
+    push(data.particles[sp], data.E, data.geometry, data.subcycle[sp] * dt);
+  }
+}
+
+void
+ParticlePusher_Geodesic::push(Particles& particles,
+                              const VectorField<Scalar>& E,
+                              const BackgroundGeometry& geom, double dt) {
+  // Particles are independent during the push, so contiguous chunks of the
+  // array are handed to the threads. Since the chunk size is a multiple of
+  // every vector width, each particle is pushed by the same kernel no matter
+  // how many threads there are, and the result is bitwise identical to the
+  // serial push.
+  const Index_t num = particles.number();
+  const Index_t num_chunks = (num + push_chunk_size - 1) / push_chunk_size;
+  particles.reserve_displacement();
+#pragma omp parallel for schedule(dynamic)
+  for (Index_t n = 0; n < num_chunks; n++) {
+    Index_t begin = n * push_chunk_size;
+    push_range(particles, E, geom, dt, begin,
+               std::min(num, begin + push_chunk_size));
+  }
+}
+
+void
+ParticlePusher_Geodesic::push_range(Particles& particles,
+                                    const VectorField<Scalar>& E,
+                                    const BackgroundGeometry& geom, double dt,
+                                    Index_t begin, Index_t end) {
+  auto& grid = E.grid();
   auto& mesh = grid.mesh();
-  for (auto& particles : data.particles) {
-#ifdef __AVX2_CUSTOM__
+  Index_t idx_start = begin;
+  // Particles that leave through an absorbing boundary, marked for erasing
+  // all at once when the range is done
+  std::vector<Index_t> absorbed;
+  if (mesh.dim() == 1 && m_simd_level != SimdLevel::scalar) {
+    detail::geodesic_push_params params;
+    params.E = E.data(0).data();
+    params.dx1 = particles.displacement();
+    params.beta = geom.beta();
+    params.inv_b2p1 = geom.inv_b2p1();
+    params.force = geom.force();
+    params.q_dt_over_m = particles.charge() * dt / particles.mass();
+    params.dt = dt;
+    params.dt_over_delta = dt / mesh.delta[0];
+    params.wrap_lower = mesh.guard[0];
+    params.wrap_upper = mesh.dims[0] - mesh.guard[0];
+    params.wrap_shift = (m_periodic ? mesh.reduced_dim(0) : 0);
+    params.absorb_lower = (m_periodic ? 0 : absorb_margin);
+    params.absorb_upper = mesh.dims[0] - (m_periodic ? 0 : absorb_margin);
+    params.absorbed = &absorbed;
+    if (m_simd_level == SimdLevel::avx512)
+      idx_start = detail::geodesic_push_avx512(particles.data(), params,
+                                               begin, end);
+    else
+      idx_start = detail::geodesic_push_avx2(particles.data(), params,
+                                             begin, end);
+  }
+  // Scalar remainder that does not fill a whole vector
+  for (Index_t idx = idx_start; idx < end; idx++) {
+    if (particles.is_empty(idx)) continue;
     auto& ptc = particles.data();
-    for (Index_t idx = 0; idx + 3 < particles.number(); idx+=4) {
-      // Lorentz push in avx2
-      __m128i cell = _mm_load_si128((const __m128i*)(ptc.cell + idx));
-      __m128i cell_m = _mm_sub_epi32(cell, _mm_set1_epi32(1));
-      // Less than MAX_CELL means that the particle position is not empty
-      __m128i cell_mask = _mm_cmplt_epi32(cell, _mm_set1_epi32(MAX_CELL));
-      // __m256i cell_mask = _mm256_castsi128_si256(cell_mask_128);
-
-      __m256d x1 = _mm256_load_pd(ptc.x1 + idx);
-      __m256d cx1 = _mm256_sub_pd(_mm256_set1_pd(1.0), x1);
-      __m256d E_0 = _mm256_mask_i32gather_pd(_mm256_set1_pd(0.0), data.E.ptr(0), cell_m,
-                                             _mm256_cvtepi32_pd(cell_mask), 1);
-      __m256d E_1 = _mm256_mask_i32gather_pd(_mm256_set1_pd(0.0), data.E.ptr(0), cell,
-                                             _mm256_cvtepi32_pd(cell_mask), 1);
-      // __m256d E_1 = _mm256_i32gather_pd(data.E.ptr(0), cell, 1);
-      __m256d vE = _mm256_fmadd_pd(E_0, cx1, _mm256_mul_pd(E_1, x1));
-
-      __m256d p1 = _mm256_load_pd(ptc.p1 + idx);
-      _mm256_store_pd(ptc.p1 + idx, _mm256_fmadd_pd(vE, _mm256_set1_pd(particles.charge() * dt / particles.mass()), p1));
-
-      // TODO: Add centrifugal force term
-
-      // Move particles in avx2
-      // TODO: compute full x from the relative coordinate
-      __m256d x;
-      __m256d beta = beta_avx2(x);
-      __m256d gamma = gamma_avx2(beta, p1);
-      _mm256_store_pd(ptc.gamma, gamma);
-
-      __m256d beta_sign = sign(beta);
-      __m256d v = _mm256_fmadd_pd(beta, beta, _mm256_div_pd(_mm256_mul_pd(beta_sign, p1), gamma));
-      v = _mm256_mul_pd(beta_sign, v);
-      __m256d dx = _mm256_mul_pd(v, _mm256_set1_pd(dt / grid.mesh().delta[0]));
-      _mm256_store_pd(ptc.x1 + idx, dx);
-      x1 = _mm256_add_pd(x1, dx);
-      __m256d delta_cell = _mm256_floor_pd(x1);
-      cell = _mm_add_epi32(cell, _mm256_cvtpd_epi32(delta_cell));
-      x1 = _mm256_sub_pd(x1, delta_cell);
-      _mm_store_si128((__m128i*)(ptc.cell + idx), cell);
-      _mm256_store_pd(ptc.x1 + idx, x1);
-    }
-    Index_t idx_start = (particles.number() / 4) * 4;
-#else
-    Index_t idx_start = 0;
-#endif // __AVX2__
-    for (Index_t idx = idx_start; idx < particles.number(); idx++) {
-      if (particles.is_empty(idx)) continue;
-      auto& ptc = particles.data();
-      auto c = mesh.get_cell_3d(ptc.cell[idx]);
-
-      // Logger::print_info("Looping particle {}", idx);
-      double x = grid.mesh().pos(0, c[0], ptc.x1[idx]);
-      // Logger::print_info("Pushing particle at cell {} and position {}",
-      //                    ptc.cell[idx], x);
-
-      lorentz_push(particles, idx, x, data.E, data.B, dt);
-      // extra_force(particles, idx, x, grid, dt);
-      move_ptc(particles, idx, x, grid, dt);
-    }
+    int cell = ptc.cell[idx];
+    auto x1 = ptc.x1[idx];
+
+    // The background at the particle position, which does not change
+    // between the push and the move
+    double beta = geom.beta(cell, x1);
+    double inv_b2p1 = geom.inv_b2p1(cell, x1, beta);
+
+    lorentz_push(particles, idx, beta, inv_b2p1, geom.force(cell, x1), E, dt);
+    // extra_force(particles, idx, x, grid, dt);
+    move_ptc(particles, idx, beta, inv_b2p1, grid, dt, absorbed);
+  }
+  if (!absorbed.empty()) {
+#pragma omp critical
+    particles.mark_erase(absorbed);
   }
 }
 
 void
 ParticlePusher_Geodesic::move_ptc(Particles& particles, Index_t idx,
-                                  double x, const Grid& grid,
-                                  double dt) {
+                                  double beta, double inv_b2p1,
+                                  const Grid& grid, double dt,
+                                  std::vector<Index_t>& absorbed) {
   auto& ptc = particles.data();
   auto& mesh = grid.mesh();
   if (mesh.dim() == 1) {
     int cell = ptc.cell[idx];
 
     // ptc.gamma[idx] = sqrt(1.0 + ptc.p1[idx] * ptc.p1[idx]);
-    double beta = beta_phi(x/mesh.sizes[0]);
     double g = gamma(beta, ptc.p1[idx]);
     // if (g < 1.0) g = 1.0;
-    // if (std::abs(beta_phi(x/mesh.sizes[0])) > 1.0)
-    //   // Logger::print_info("p is {}, beta is {}, g is {}, x is {}", ptc.p1[idx], beta_phi(x/mesh.sizes[0]), g, x);
+#ifndef APERTURE_COMPACT_PARTICLES
     ptc.gamma[idx] = g;
+#endif
     // double v = ptc.p1[idx] / ptc.gamma[idx];
     // Logger::print_info("Before move, v is {}, gamma is {}", v, ptc.gamma[idx]);
 
-    double v = ((beta < 0.0 ? -1.0 : 1.0) * ptc.p1[idx] / g + beta * beta) / (1.0 + beta * beta);
+    double v = ((beta < 0.0 ? -1.0 : 1.0) * ptc.p1[idx] / g + beta * beta) * inv_b2p1;
     if (beta < 0.0) {
       v *= -1.0;
     }
-    ptc.dx1[idx] = v * dt / grid.mesh().delta[0];
-    ptc.x1[idx] += ptc.dx1[idx];
+    Pos_t* dx1 = particles.displacement();
+    dx1[idx] = v * dt / grid.mesh().delta[0];
+    ptc.x1[idx] += dx1[idx];
 
     // Compute the change in particle cell
     // auto c = mesh.get_cell_3d(cell);
@@ -158,6 +164,14 @@ ParticlePusher_Geodesic::move_ptc(Particles& particles, Index_t idx,
     cell += delta_cell;
     // Logger::print_info("After move, c is {}, x1 is {}", c, ptc.x1[idx]);
 
+    // Boundary condition. A particle leaving the box still deposits its
+    // last current, so it is only erased after the deposit.
+    if (m_periodic)
+      cell += mesh.reduced_dim(0) * ((cell < mesh.guard[0]) -
+                                     (cell >= mesh.dims[0] - mesh.guard[0]));
+    else if (cell < absorb_margin || cell >= mesh.dims[0] - absorb_margin)
+      absorbed.push_back(idx);
+
     ptc.cell[idx] = cell;
     // std::cout << ptc.x1[idx] << ", " << ptc.cell[idx] << std::endl;
     ptc.x1[idx] -= (Pos_t)delta_cell;
@@ -167,30 +181,26 @@ ParticlePusher_Geodesic::move_ptc(Particles& particles, Index_t idx,
 
 void
 ParticlePusher_Geodesic::lorentz_push(Particles& particles, Index_t idx,
-                                      double x,
-                                      const VectorField<Scalar>& E,
-                                      const VectorField<Scalar>& B, double dt) {
+                                      double beta, double inv_b2p1,
+                                      double force,
+                                      const VectorField<Scalar>& E, double dt) {
   auto& ptc = particles.data();
   if (E.grid().dim() == 1) {
     // Logger::print_debug("in lorentz, flag is {}", ptc.flag[idx]);
     if (!check_bit(ptc.flag[idx], ParticleFlag::ignore_EM)) {
-      auto& mesh = E.grid().mesh();
       int cell = ptc.cell[idx];
       // Vec3<Pos_t> rel_x{ptc.x1[idx], 0.0, 0.0};
       auto rel_x = ptc.x1[idx];
 
       // Vec3<Scalar> vE = m_interp.interp_cell(ptc.x[idx].vec3(), grid.);
-      // auto c = mesh.get_cell_3d(cell);
-      // std::cout << c << std::endl;
       // Vec3<Scalar> vE = E.interpolate(c, rel_x, m_interp);
       Scalar vE = E.data(0)[cell] * rel_x + E.data(0)[cell - 1] * (1.0 - rel_x);
       // Logger::print_info("in lorentz, c = {}, E = {}, rel_x = {}", c, vE, rel_x);
 
       double p = ptc.p1[idx];
-      double beta = beta_phi(x/mesh.sizes[0]);
       double g = gamma(beta, p);
-      double f = (g - (beta < 0.0 ? -1.0 : 1.0) * p) / (1.0 + beta * beta);
-      ptc.p1[idx] += (beta / g) * f * f * dt / (0.5 * mesh.sizes[0]);
+      double f = (g - (beta < 0.0 ? -1.0 : 1.0) * p) * inv_b2p1;
+      ptc.p1[idx] += force * (f * f / g) * dt;
       ptc.p1[idx] += particles.charge() * vE * dt / particles.mass();
 
     }
@@ -198,51 +208,30 @@ ParticlePusher_Geodesic::lorentz_push(Particles& particles, Index_t idx,
 }
 
 void
-ParticlePusher_Geodesic::handle_boundary(SimData &data) {
+ParticlePusher_Geodesic::handle_boundary(SimData& data,
+                                         const std::vector<Index_t>& first_new) {
   auto& mesh = data.E.grid().mesh();
-  for (auto& ptc : data.particles) {
-    if (ptc.number() > 0) {
-      for (Index_t n = 0; n < ptc.number(); n++) {
-        // This controls the boundary condition
-        auto c = mesh.get_cell_3d(ptc.data().cell[n]);
-        if (c[0] < mesh.guard[0] || c[0] >= mesh.dims[0] - mesh.guard[0]) {
-          // Move particles to the other end of the box
-          if (m_periodic) {
-            if (c[0] < mesh.guard[0])
-              c[0] += mesh.reduced_dim(0);
-            else
-              c[0] -= mesh.reduced_dim(0);
-            ptc.data().cell[n] = mesh.get_idx(c[0], c[1], c[2]);
-          } else {
-            // Erase particles in the guard cell
-            if (c[0] <= 2 || c[0] >= mesh.dims[0] - 3)
-            ptc.erase(n);
-          }
-        }
-      }
-    }
-  }
-  auto& ptc = data.photons;
-  if (ptc.number() > 0) {
-    for (Index_t n = 0; n < ptc.number(); n++) {
-      // This controls the boundary condition
-      auto c = mesh.get_cell_3d(ptc.data().cell[n]);
-      if (c[0] < mesh.guard[0] || c[0] >= mesh.dims[0] - mesh.guard[0]) {
-        // Move particles to the other end of the box
-        if (m_periodic) {
-          if (c[0] < mesh.guard[0])
-            c[0] += mesh.reduced_dim(0);
-          else
-            c[0] -= mesh.reduced_dim(0);
-          ptc.data().cell[n] = mesh.get_idx(c[0], c[1], c[2]);
-        } else {
-          // Erase particles in the guard cell
-          ptc.erase(n);
-        }
-      }
+  for (Index_t sp = 0; sp < data.particles.size(); sp++) {
+    auto& ptc = data.particles[sp];
+    for (Index_t n = first_new[sp]; n < ptc.number(); n++) {
+      if (!ptc.is_empty(n)) handle_boundary(ptc, n, mesh);
     }
+    ptc.erase_marked();
   }
+  data.photons.erase_marked();
+}
 
+void
+ParticlePusher_Geodesic::handle_boundary(Particles& ptc, Index_t n,
+                                         const Quadmesh& mesh) {
+  // Same as in move_ptc, for particles that have not been moved
+  int cell = ptc.data().cell[n];
+  if (m_periodic)
+    ptc.data().cell[n] =
+        cell + mesh.reduced_dim(0) * ((cell < mesh.guard[0]) -
+                                      (cell >= mesh.dims[0] - mesh.guard[0]));
+  else if (cell < absorb_margin || cell >= mesh.dims[0] - absorb_margin)
+    ptc.mark_erase(n);
 }
 
 void
@@ -0,0 +1,339 @@
+#include "algorithms/ptc_pusher_geodesic_simd.h"
+#include "data/enum_types.h"
+#include "utils/simd.h"
+#include "constant_defs.h"
+#ifdef APERTURE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// Vectorized version of ParticlePusher_Geodesic::lorentz_push followed by
+// ParticlePusher_Geodesic::move_ptc. Empty slots (cell == MAX_CELL) are
+// masked out of the E gather and of all the stores, and particles flagged
+// with ignore_EM keep their momentum but are still moved. Positions are
+// always computed in double precision, and rounded to Pos_t at the same
+// points where the scalar path stores them. The periodic wrap is done with
+// masks; only the rare absorbed lanes take a branch.
+
+namespace Aperture {
+
+namespace detail {
+
+#ifdef APERTURE_X86_SIMD
+
+// Add the lanes set in mask, counted from idx, to the list
+static inline void
+record_lanes(std::vector<Index_t>* list, Index_t idx, unsigned int mask) {
+  for (; mask != 0; mask &= mask - 1) list->push_back(idx + __builtin_ctz(mask));
+}
+
+// Linear interpolation of a cell edge table, same as
+// BackgroundGeometry::interp
+__attribute__((target("avx2,fma"))) static inline __m256d
+interp_avx2(const Scalar* table, __m128i cell, __m128i cell_p, __m256d x1,
+            __m256d mask) {
+  __m256d v0 = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), table, cell, mask, 8);
+  __m256d v1 = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), table, cell_p, mask, 8);
+  return _mm256_fmadd_pd(_mm256_sub_pd(v1, v0), x1, v0);
+}
+
+__attribute__((target("avx512f"))) static inline __m512d
+interp_avx512(const Scalar* table, __m256i cell, __m256i cell_p, __m512d x1,
+              __mmask8 mask) {
+  __m512d v0 = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask, cell, table, 8);
+  __m512d v1 = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask, cell_p, table, 8);
+  return _mm512_fmadd_pd(_mm512_sub_pd(v1, v0), x1, v0);
+}
+
+// Loads and stores of the positions, overloaded on the storage precision.
+// The masks are given both as 64 bit and as 32 bit lanes.
+__attribute__((target("avx2,fma"))) static inline __m256d
+load_pos_avx2(const double* p) {
+  return _mm256_loadu_pd(p);
+}
+
+__attribute__((target("avx2,fma"))) static inline __m256d
+load_pos_avx2(const float* p) {
+  return _mm256_cvtps_pd(_mm_loadu_ps(p));
+}
+
+__attribute__((target("avx2,fma"))) static inline void
+store_pos_avx2(double* p, __m256i mask, __m128i mask32, __m256d v) {
+  _mm256_maskstore_pd(p, mask, v);
+}
+
+__attribute__((target("avx2,fma"))) static inline void
+store_pos_avx2(float* p, __m256i mask, __m128i mask32, __m256d v) {
+  _mm_maskstore_ps(p, mask32, _mm256_cvtpd_ps(v));
+}
+
+// Round to the storage precision
+__attribute__((target("avx2,fma"))) static inline __m256d
+round_pos_avx2(const double*, __m256d v) {
+  return v;
+}
+
+__attribute__((target("avx2,fma"))) static inline __m256d
+round_pos_avx2(const float*, __m256d v) {
+  return _mm256_cvtps_pd(_mm256_cvtpd_ps(v));
+}
+
+__attribute__((target("avx512f"))) static inline __m512d
+load_pos_avx512(const double* p) {
+  return _mm512_loadu_pd(p);
+}
+
+__attribute__((target("avx512f"))) static inline __m512d
+load_pos_avx512(const float* p) {
+  return _mm512_cvtps_pd(_mm256_loadu_ps(p));
+}
+
+__attribute__((target("avx512f"))) static inline void
+store_pos_avx512(double* p, __mmask8 mask, __m512d v) {
+  _mm512_mask_storeu_pd(p, mask, v);
+}
+
+__attribute__((target("avx512f"))) static inline void
+store_pos_avx512(float* p, __mmask8 mask, __m512d v) {
+  _mm512_mask_storeu_ps(p, mask, _mm512_castps256_ps512(_mm512_cvtpd_ps(v)));
+}
+
+__attribute__((target("avx512f"))) static inline __m512d
+round_pos_avx512(const double*, __m512d v) {
+  return v;
+}
+
+__attribute__((target("avx512f"))) static inline __m512d
+round_pos_avx512(const float*, __m512d v) {
+  return _mm512_cvtps_pd(_mm512_cvtpd_ps(v));
+}
+
+// Flags are 16 bit in the compact particle format, and are widened to 32
+// bit lanes
+__attribute__((target("avx2,fma"))) static inline __m128i
+load_flag_avx2(const uint32_t* p) {
+  return _mm_loadu_si128((const __m128i*)p);
+}
+
+__attribute__((target("avx2,fma"))) static inline __m128i
+load_flag_avx2(const uint16_t* p) {
+  return _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)p));
+}
+
+__attribute__((target("avx512f"))) static inline __m256i
+load_flag_avx512(const uint32_t* p) {
+  return _mm256_loadu_si256((const __m256i*)p);
+}
+
+__attribute__((target("avx512f"))) static inline __m256i
+load_flag_avx512(const uint16_t* p) {
+  return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p));
+}
+
+__attribute__((target("avx2,fma"))) Index_t
+geodesic_push_avx2(particle_data& ptc, const geodesic_push_params& params,
+                   Index_t begin, Index_t end) {
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d two = _mm256_set1_pd(2.0);
+  const __m256d minus_one = _mm256_set1_pd(-1.0);
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d q_dt_over_m = _mm256_set1_pd(params.q_dt_over_m);
+  const __m256d dt = _mm256_set1_pd(params.dt);
+  const __m256d dt_over_delta = _mm256_set1_pd(params.dt_over_delta);
+  const __m128i empty_cell = _mm_set1_epi32((int)MAX_CELL);
+  const __m128i em_bit =
+      _mm_set1_epi32(1 << static_cast<int>(ParticleFlag::ignore_EM));
+  const __m128i int_one = _mm_set1_epi32(1);
+  const __m128i int_zero = _mm_setzero_si128();
+  const __m128i wrap_lower = _mm_set1_epi32(params.wrap_lower);
+  const __m128i wrap_upper = _mm_set1_epi32(params.wrap_upper - 1);
+  const __m128i wrap_shift = _mm_set1_epi32(params.wrap_shift);
+  const __m128i absorb_lower = _mm_set1_epi32(params.absorb_lower);
+  const __m128i absorb_upper = _mm_set1_epi32(params.absorb_upper - 1);
+
+  Index_t idx = begin;
+  for (; idx + 4 <= end; idx += 4) {
+    __m128i cell = _mm_loadu_si128((const __m128i*)(ptc.cell + idx));
+    __m128i empty = _mm_cmpeq_epi32(cell, empty_cell);
+    if (_mm_movemask_epi8(empty) == 0xFFFF) continue;
+    __m128i flag = load_flag_avx2(ptc.flag + idx);
+    __m128i em = _mm_cmpeq_epi32(_mm_and_si128(flag, em_bit), int_zero);
+    __m128i active32 = _mm_xor_si128(empty, _mm_cmpeq_epi32(cell, cell));
+    __m256i active = _mm256_cvtepi32_epi64(active32);
+    __m256d active_pd = _mm256_castsi256_pd(active);
+    __m256d push = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm_andnot_si128(empty, em)));
+
+    __m256d x1 = load_pos_avx2(ptc.x1 + idx);
+    __m256d p1 = _mm256_loadu_pd(ptc.p1 + idx);
+
+    // Background quantities at the particle, interpolated from the cell edges
+    __m128i cell_p = _mm_add_epi32(cell, int_one);
+    __m256d beta = interp_avx2(params.beta, cell, cell_p, x1, active_pd);
+    __m256d force = interp_avx2(params.force, cell, cell_p, x1, push);
+    __m256d s = _mm256_blendv_pd(one, minus_one, _mm256_cmp_pd(beta, zero, _CMP_LT_OQ));
+    __m256d b2 = _mm256_mul_pd(beta, beta);
+    __m256d b2p1 = _mm256_add_pd(one, b2);
+    // One Newton iteration on the tabulated 1/(1 + beta^2)
+    __m256d inv_b2p1 = interp_avx2(params.inv_b2p1, cell, cell_p, x1, active_pd);
+    inv_b2p1 = _mm256_mul_pd(inv_b2p1, _mm256_fnmadd_pd(inv_b2p1, b2p1, two));
+
+    // Geodesic force
+    __m256d g = _mm256_sqrt_pd(_mm256_fmadd_pd(p1, p1, b2p1));
+    __m256d f = _mm256_mul_pd(_mm256_fnmadd_pd(s, p1, g), inv_b2p1);
+    __m256d dp = _mm256_mul_pd(_mm256_mul_pd(force, _mm256_div_pd(_mm256_mul_pd(f, f), g)),
+                               dt);
+
+    // Electric force, linear interpolation from E[cell - 1] and E[cell]
+    __m256d E0 = _mm256_mask_i32gather_pd(zero, params.E, _mm_sub_epi32(cell, int_one),
+                                          push, 8);
+    __m256d E1 = _mm256_mask_i32gather_pd(zero, params.E, cell, push, 8);
+    __m256d vE = _mm256_fmadd_pd(E1, x1, _mm256_mul_pd(E0, _mm256_sub_pd(one, x1)));
+    p1 = _mm256_blendv_pd(p1, _mm256_add_pd(p1, _mm256_fmadd_pd(vE, q_dt_over_m, dp)),
+                          push);
+
+    // Move the particle
+    g = _mm256_sqrt_pd(_mm256_fmadd_pd(p1, p1, b2p1));
+    __m256d v = _mm256_mul_pd(
+        s, _mm256_mul_pd(_mm256_fmadd_pd(s, _mm256_div_pd(p1, g), b2), inv_b2p1));
+    __m256d dx1 = round_pos_avx2(params.dx1, _mm256_mul_pd(v, dt_over_delta));
+    x1 = round_pos_avx2(ptc.x1, _mm256_add_pd(x1, dx1));
+    __m256d delta_cell = _mm256_floor_pd(x1);
+    x1 = _mm256_sub_pd(x1, delta_cell);
+    cell = _mm_blendv_epi8(_mm_add_epi32(cell, _mm256_cvttpd_epi32(delta_cell)), cell,
+                           empty);
+
+    // Boundary condition
+    __m128i shift = _mm_sub_epi32(
+        _mm_and_si128(_mm_cmplt_epi32(cell, wrap_lower), wrap_shift),
+        _mm_and_si128(_mm_cmpgt_epi32(cell, wrap_upper), wrap_shift));
+    cell = _mm_add_epi32(cell, _mm_and_si128(shift, active32));
+    __m128i out = _mm_and_si128(
+        active32, _mm_or_si128(_mm_cmplt_epi32(cell, absorb_lower),
+                               _mm_cmpgt_epi32(cell, absorb_upper)));
+    int out_mask = _mm_movemask_ps(_mm_castsi128_ps(out));
+    if (out_mask != 0) record_lanes(params.absorbed, idx, out_mask);
+
+    _mm256_maskstore_pd(ptc.p1 + idx, active, p1);
+#ifndef APERTURE_COMPACT_PARTICLES
+    _mm256_maskstore_pd(ptc.gamma + idx, active, g);
+#endif
+    store_pos_avx2(params.dx1 + idx, active, active32, dx1);
+    store_pos_avx2(ptc.x1 + idx, active, active32, x1);
+    _mm_storeu_si128((__m128i*)(ptc.cell + idx), cell);
+  }
+  return idx;
+}
+
+__attribute__((target("avx512f"))) Index_t
+geodesic_push_avx512(particle_data& ptc, const geodesic_push_params& params,
+                     Index_t begin, Index_t end) {
+  const __m512d one = _mm512_set1_pd(1.0);
+  const __m512d two = _mm512_set1_pd(2.0);
+  const __m512d minus_one = _mm512_set1_pd(-1.0);
+  const __m512d zero = _mm512_setzero_pd();
+  const __m512d q_dt_over_m = _mm512_set1_pd(params.q_dt_over_m);
+  const __m512d dt = _mm512_set1_pd(params.dt);
+  const __m512d dt_over_delta = _mm512_set1_pd(params.dt_over_delta);
+  const __m512i empty_cell = _mm512_set1_epi32((int)MAX_CELL);
+  const __m512i em_bit =
+      _mm512_set1_epi32(1 << static_cast<int>(ParticleFlag::ignore_EM));
+  const __m256i int_one = _mm256_set1_epi32(1);
+  const __m512i wrap_lower = _mm512_set1_epi32(params.wrap_lower);
+  const __m512i wrap_upper = _mm512_set1_epi32(params.wrap_upper);
+  const __m512i wrap_shift = _mm512_set1_epi32(params.wrap_shift);
+  const __m512i absorb_lower = _mm512_set1_epi32(params.absorb_lower);
+  const __m512i absorb_upper = _mm512_set1_epi32(params.absorb_upper);
+  // The zero-masked sqrt, roundscale and cvtt start from a zeroed source
+  // rather than an undefined one, which GCC flags as maybe-uninitialized
+  const __mmask8 all = 0xFF;
+
+  Index_t idx = begin;
+  for (; idx + 8 <= end; idx += 8) {
+    // Cells and flags are 32 bit, so only the lower half of the 16 lanes
+    // are used in the integer masks
+    __m256i cell = _mm256_loadu_si256((const __m256i*)(ptc.cell + idx));
+    __mmask8 active = (__mmask8)_mm512_mask_cmpneq_epi32_mask(
+        0xFF, _mm512_castsi256_si512(cell), empty_cell);
+    if (active == 0) continue;
+    __m512i flag = _mm512_castsi256_si512(load_flag_avx512(ptc.flag + idx));
+    __mmask8 push = (__mmask8)_mm512_mask_testn_epi32_mask(active, flag, em_bit);
+
+    __m512d x1 = load_pos_avx512(ptc.x1 + idx);
+    __m512d p1 = _mm512_loadu_pd(ptc.p1 + idx);
+
+    // Background quantities at the particle, interpolated from the cell edges
+    __m256i cell_p = _mm256_add_epi32(cell, int_one);
+    __m512d beta = interp_avx512(params.beta, cell, cell_p, x1, active);
+    __m512d force = interp_avx512(params.force, cell, cell_p, x1, push);
+    __m512d s = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(beta, zero, _CMP_LT_OQ), one,
+                                     minus_one);
+    __m512d b2 = _mm512_mul_pd(beta, beta);
+    __m512d b2p1 = _mm512_add_pd(one, b2);
+    // One Newton iteration on the tabulated 1/(1 + beta^2)
+    __m512d inv_b2p1 = interp_avx512(params.inv_b2p1, cell, cell_p, x1, active);
+    inv_b2p1 = _mm512_mul_pd(inv_b2p1, _mm512_fnmadd_pd(inv_b2p1, b2p1, two));
+
+    // Geodesic force
+    __m512d g = _mm512_maskz_sqrt_pd(all, _mm512_fmadd_pd(p1, p1, b2p1));
+    __m512d f = _mm512_mul_pd(_mm512_fnmadd_pd(s, p1, g), inv_b2p1);
+    __m512d dp = _mm512_mul_pd(_mm512_mul_pd(force, _mm512_div_pd(_mm512_mul_pd(f, f), g)),
+                               dt);
+
+    // Electric force, linear interpolation from E[cell - 1] and E[cell]
+    __m512d E0 = _mm512_mask_i32gather_pd(zero, push, _mm256_sub_epi32(cell, int_one),
+                                          params.E, 8);
+    __m512d E1 = _mm512_mask_i32gather_pd(zero, push, cell, params.E, 8);
+    __m512d vE = _mm512_fmadd_pd(E1, x1, _mm512_mul_pd(E0, _mm512_sub_pd(one, x1)));
+    p1 = _mm512_mask_add_pd(p1, push, p1, _mm512_fmadd_pd(vE, q_dt_over_m, dp));
+
+    // Move the particle
+    g = _mm512_maskz_sqrt_pd(all, _mm512_fmadd_pd(p1, p1, b2p1));
+    __m512d v = _mm512_mul_pd(
+        s, _mm512_mul_pd(_mm512_fmadd_pd(s, _mm512_div_pd(p1, g), b2), inv_b2p1));
+    __m512d dx1 = round_pos_avx512(params.dx1, _mm512_mul_pd(v, dt_over_delta));
+    x1 = round_pos_avx512(ptc.x1, _mm512_add_pd(x1, dx1));
+    __m512d delta_cell =
+        _mm512_maskz_roundscale_pd(all, x1, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    x1 = _mm512_sub_pd(x1, delta_cell);
+    __m512i new_cell = _mm512_castsi256_si512(
+        _mm256_add_epi32(cell, _mm512_maskz_cvttpd_epi32(all, delta_cell)));
+
+    // Boundary condition
+    __mmask8 below = (__mmask8)_mm512_mask_cmplt_epi32_mask(active, new_cell, wrap_lower);
+    __mmask8 above = (__mmask8)_mm512_mask_cmpge_epi32_mask(active, new_cell, wrap_upper);
+    new_cell = _mm512_mask_add_epi32(new_cell, below, new_cell, wrap_shift);
+    new_cell = _mm512_mask_sub_epi32(new_cell, above, new_cell, wrap_shift);
+    __mmask8 out =
+        (__mmask8)(_mm512_mask_cmplt_epi32_mask(active, new_cell, absorb_lower) |
+                   _mm512_mask_cmpge_epi32_mask(active, new_cell, absorb_upper));
+    if (out != 0) record_lanes(params.absorbed, idx, out);
+
+    _mm512_mask_storeu_pd(ptc.p1 + idx, active, p1);
+#ifndef APERTURE_COMPACT_PARTICLES
+    _mm512_mask_storeu_pd(ptc.gamma + idx, active, g);
+#endif
+    store_pos_avx512(params.dx1 + idx, active, dx1);
+    store_pos_avx512(ptc.x1 + idx, active, x1);
+    _mm512_mask_storeu_epi32(ptc.cell + idx, active, new_cell);
+  }
+  return idx;
+}
+
+#else
+
+Index_t
+geodesic_push_avx2(particle_data& ptc, const geodesic_push_params& params,
+                   Index_t begin, Index_t end) {
+  return begin;
+}
+
+Index_t
+geodesic_push_avx512(particle_data& ptc, const geodesic_push_params& params,
+                     Index_t begin, Index_t end) {
+  return begin;
+}
+
+#endif  // APERTURE_X86_SIMD
+
+}
+
+}
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <cstdint>
 #include "commandline_args.h"
+#include "algorithm_registry.h"
 #include "utils/logger.h"
 #include "cxxopts.hpp"
 
@@ -12,6 +13,7 @@ CommandArgs::CommandArgs() {
   m_options = std::make_unique<cxxopts::Options>("aperture", "Aperture PIC code");
   m_options->add_options()
       ("h,help", "Prints this help message.")
+      ("list-algorithms", "Prints the algorithms that can be selected in the configuration file.")
       // ("verbose,v", po::value<int>(&verbosity)->default_value(0)->implicit_value(3),
       //  "Level of verbosity of program output.")
       // ("config,c", po::value<std::string>(&m_conf_filename)->default_value("sim.conf"),
@@ -22,6 +24,8 @@ CommandArgs::CommandArgs() {
        "Number of steps to run the simulation.", cxxopts::value<uint32_t>()->default_value("2000"))
       ("d,interval",
        "The interval to output data to the hard disk.", cxxopts::value<uint32_t>()->default_value("20"))
+      ("t,threads",
+       "The number of threads used by each process.", cxxopts::value<int>()->default_value("1"))
       // ("mode,m", po::value<std::string>(&mode)->default_value("cpu"),
       //  "Execution mode, can be either cpu or gpu.")
       ("x,dimx",
@@ -51,12 +55,17 @@ CommandArgs::read_args(int argc, char* argv[]) {
       // throw(exceptions::program_option_terminate());
       exit(0);
     }
+    if (result["list-algorithms"].as<bool>()) {
+      list_algorithms(std::cout);
+      exit(0);
+    }
     m_steps = result["steps"].as<uint32_t>();
     m_data_interval = result["interval"].as<uint32_t>();
     m_conf_filename = result["config"].as<std::string>();
     m_dimx = result["x"].as<int>();
     m_dimy = result["y"].as<int>();
     m_dimz = result["z"].as<int>();
+    m_threads = result["threads"].as<int>();
   } catch (std::exception& e) {
     Logger::err("Error");
     Logger::err(e.what());
@@ -102,6 +102,11 @@ ConfigFile::parse_file(const std::string& filename) {
         m_data.gravity = std::atof(input.c_str());
       } else if (word.compare("ion_mass") == 0) {
         m_data.ion_mass = std::atof(input.c_str());
+      } else if (word.compare("subcycle") == 0) {
+        std::istringstream is(input);
+        int n;
+        for (auto& s : m_data.subcycle)
+          if (is >> n) s = n;
       } else if (word.compare("max_part_num") == 0) {
         m_data.max_ptc_number = std::atol(input.c_str());
       } else if (word.compare("max_photon_num") == 0) {
@@ -114,6 +119,20 @@ ConfigFile::parse_file(const std::string& filename) {
         m_data.boundary_periodic[2] = to_bool(input);
       } else if (word.compare("interpolation_order") == 0) {
         m_data.interpolation_order = std::atoi(input.c_str());
+      } else if (word.compare("current_smoothing") == 0) {
+        m_data.current_smoothing = std::atoi(input.c_str());
+      } else if (word.compare("current_compensate") == 0) {
+        m_data.current_compensate = to_bool(input);
+      } else if (word.compare("deposit_chunks") == 0) {
+        m_data.deposit_chunks = std::atoi(input.c_str());
+      } else if (word.compare("sort_by_cell") == 0) {
+        m_data.sort_by_cell = to_bool(input);
+      } else if (word.compare("incremental_sort") == 0) {
+        m_data.incremental_sort = to_bool(input);
+      } else if (word.compare("diag_window") == 0) {
+        m_data.diag_window = std::atoi(input.c_str());
+      } else if (word.compare("diag_stride") == 0) {
+        m_data.diag_stride = std::atoi(input.c_str());
       } else if (word.compare("create_pairs") == 0) {
         m_data.create_pairs = to_bool(input);
       } else if (word.compare("trace_photons") == 0) {
@@ -138,8 +157,14 @@ ConfigFile::parse_file(const std::string& filename) {
         m_data.algorithm_ptc_push = input;
       } else if (word.compare("algorithm_field_update") == 0) {
         m_data.algorithm_field_update = input;
+      } else if (word.compare("implicit_theta") == 0) {
+        m_data.implicit_theta = std::atof(input.c_str());
       } else if (word.compare("algorithm_current_deposit") == 0) {
         m_data.algorithm_current_deposit = input;
+      } else if (word.compare("step_engine") == 0) {
+        m_data.step_engine = input;
+      } else if (word.compare("field_engine") == 0) {
+        m_data.field_engine = input;
       } else if (word.compare("spectral_alpha") == 0) {
         m_data.spectral_alpha = std::atof(input.c_str());
       } else if (word.compare("e_s") == 0) {
@@ -0,0 +1,115 @@
+#include "current_filter.h"
+#include <algorithm>
+
+namespace Aperture {
+
+CurrentFilter::CurrentFilter(int passes, bool compensate, bool periodic)
+    : m_passes(std::max(passes, 0)),
+      m_compensate(compensate && passes > 0),
+      m_periodic(periodic),
+      m_boundary{!periodic, !periodic} {}
+
+CurrentFilter::~CurrentFilter() {}
+
+void
+CurrentFilter::apply(VectorField<Scalar>& J) {
+  if (m_passes == 0) return;
+  auto& mesh = J.grid().mesh();
+  Scalar* j = J.ptr(0);
+  const int guard = mesh.guard[0];
+  Scalar alpha = (m_compensate ? 1.0 + 0.5 * m_passes : 0.0);
+  // The faces on a physical boundary stay where they are
+  const int begin = (m_boundary[0] ? guard - 1 : 0);
+  const int end = (m_boundary[1] ? mesh.dims[0] - guard : mesh.dims[0]);
+  if (m_boundary[0] && m_boundary[1]) {
+    // Everything fits in a single sweep
+    sweep(j, begin, end, m_passes, alpha, m_buffer);
+    return;
+  }
+
+  // Every pass spoils one more of the guard cells on the other ends, so
+  // they are filled again after guard - 1 passes
+  const int per_fill = std::max(guard - 1, 1);
+  int binomial = m_passes;
+  bool compensation = m_compensate;
+  while (binomial > 0 || compensation) {
+    fill_guard_cells(J);
+    int passes = std::min(binomial, per_fill);
+    binomial -= passes;
+    bool compensate_now = (compensation && binomial == 0 && passes < per_fill);
+    if (compensate_now) compensation = false;
+    sweep(j, begin, end, passes, (compensate_now ? alpha : 0.0), m_buffer);
+  }
+}
+
+void
+CurrentFilter::fill_guard_cells(VectorField<Scalar>& J) {
+  if (m_periodic) {
+    // Face i and face i + reduced_dim are the same face
+    auto& mesh = J.grid().mesh();
+    Scalar* j = J.ptr(0);
+    const int n = mesh.reduced_dim(0);
+    for (int i = 0; i < mesh.guard[0] - 1; i++) j[i] = j[i + n];
+    for (int i = mesh.dims[0] - mesh.guard[0]; i < mesh.dims[0]; i++)
+      j[i] = j[i - n];
+  }
+  if (m_comm_callback_vfield) m_comm_callback_vfield(J);
+}
+
+void
+CurrentFilter::filter(Scalar* data, int begin, int end, int passes,
+                      bool compensate, std::vector<Scalar>& buffer) {
+  passes = std::max(passes, 0);
+  Scalar alpha = (compensate && passes > 0 ? 1.0 + 0.5 * passes : 0.0);
+  sweep(data, begin, end, passes, alpha, buffer);
+}
+
+void
+CurrentFilter::sweep(Scalar* data, int begin, int end, int passes,
+                     Scalar alpha, std::vector<Scalar>& buffer) {
+  const int total = passes + (alpha != 0.0 ? 1 : 0);
+  if (total == 0 || end - begin < 3) return;
+  // A block is read with total extra points on either side, where the
+  // result is spoiled by the edge of the block. The result of a block is
+  // only written back once the next block is read, as that one still needs
+  // the old values at the end of this one
+  const int block = 2048;
+  const int span = block + 2 * total;
+  buffer.resize(2 * span + block);
+  Scalar* a = buffer.data();
+  Scalar* b = a + span;
+  Scalar* pending = b + span;
+  int pending_begin = 0, pending_end = 0;
+
+  for (int b0 = begin + 1; b0 < end - 1; b0 += block) {
+    const int b1 = std::min(end - 1, b0 + block);
+    const int l0 = std::max(begin, b0 - total);
+    const int l1 = std::min(end, b1 + total);
+    std::copy(data + l0, data + l1, a);
+    std::copy(data + l0, data + l1, b);
+    // The end points of the whole range never change
+    const int i0 = std::max(l0, begin + 1) - l0;
+    const int i1 = std::min(l1, end - 1) - l0;
+    for (int p = 0; p < total; p++) {
+      Scalar center = 0.5, side = 0.25;
+      if (p == passes) {
+        center = alpha;
+        side = 0.5 * (1.0 - alpha);
+      }
+#pragma omp simd
+      for (int i = i0; i < i1; i++)
+        b[i] = center * a[i] + side * (a[i - 1] + a[i + 1]);
+      std::swap(a, b);
+    }
+
+    std::copy(pending, pending + (pending_end - pending_begin),
+              data + pending_begin);
+    std::copy(a + (b0 - l0), a + (b1 - l0), pending);
+    pending_begin = b0;
+    pending_end = b1;
+  }
+  std::copy(pending, pending + (pending_end - pending_begin),
+            data + pending_begin);
+}
+
+}  // namespace Aperture
@@ -0,0 +1,34 @@
+#include "data/background_geometry.h"
+#include "algorithms/functions.h"
+
+namespace Aperture {
+
+BackgroundGeometry::BackgroundGeometry() {}
+
+BackgroundGeometry::BackgroundGeometry(const Grid& grid)
+    : BackgroundGeometry(grid, beta_phi) {}
+
+BackgroundGeometry::BackgroundGeometry(const Grid& grid,
+                                       const profile_t& beta) {
+  set_beta_profile(grid, beta);
+}
+
+BackgroundGeometry::~BackgroundGeometry() {}
+
+void
+BackgroundGeometry::set_beta_profile(const Grid& grid, const profile_t& beta) {
+  auto& mesh = grid.mesh();
+  // One more edge than there are cells
+  int num_edges = mesh.dims[0] + 1;
+  m_beta.resize(num_edges);
+  m_inv_b2p1.resize(num_edges);
+  m_force.resize(num_edges);
+  for (int i = 0; i < num_edges; i++) {
+    double b = beta(mesh.pos(0, i, 0.0) / mesh.sizes[0]);
+    m_beta[i] = b;
+    m_inv_b2p1[i] = 1.0 / (1.0 + b * b);
+    m_force[i] = b / (0.5 * mesh.sizes[0]);
+  }
+}
+
+}
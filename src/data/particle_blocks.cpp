@@ -0,0 +1,11 @@
+#include "data/particle_blocks.h"
+#include "data/detail/particle_blocks_impl.hpp"
+
+namespace Aperture {
+
+template class ParticleBlocks<single_particle_t, 8>;
+template class ParticleBlocks<single_particle_t, 16>;
+template class ParticleBlocks<single_photon_t, 8>;
+template class ParticleBlocks<single_photon_t, 16>;
+
+}
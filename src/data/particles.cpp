@@ -38,6 +38,7 @@ Particles::Particles(const Particles& other)
   m_type = other.m_type;
   m_charge = other.m_charge;
   m_mass = other.m_mass;
+  m_sort_by_cell = other.m_sort_by_cell;
 }
 
 Particles::Particles(Particles&& other)
@@ -45,14 +46,14 @@ Particles::Particles(Particles&& other)
   m_type = other.m_type;
   m_charge = other.m_charge;
   m_mass = other.m_mass;
+  m_sort_by_cell = other.m_sort_by_cell;
 }
 
 Particles::~Particles() {}
 
 void
 Particles::put(std::size_t pos, Pos_t x, Scalar p, int cell, int flag) {
-  if (pos >= m_numMax)
-    throw std::runtime_error("Trying to insert particle beyond the end of the array. Resize it first!");
+  if (pos >= m_capacity) reserve(pos + 1);
 
   m_data.x1[pos] = x;
   // m_data.x2[pos] = x[1];
@@ -61,7 +62,9 @@ Particles::put(std::size_t pos, Pos_t x, Scalar p, int cell, int flag) {
   m_data.p1[pos] = p;
   // m_data.p2[pos] = p[1];
   // m_data.p3[pos] = p[2];
+#ifndef APERTURE_COMPACT_PARTICLES
   m_data.gamma[pos] = sqrt(1.0 + p*p);
+#endif
   m_data.cell[pos] = cell;
   m_data.flag[pos] = flag;
   if (pos >= m_number) m_number = pos + 1;
@@ -75,7 +78,15 @@ Particles::append(Pos_t x, Scalar p, int cell, int flag) {
 void
 Particles::sort(const Grid& grid) {
   if (m_number > 0)
-    partition_and_sort(m_partition, grid, 8);
+    partition_and_sort(m_partition, grid, 8, m_sort_by_cell);
+}
+
+void
+Particles::sort_incremental(const Grid& grid) {
+  if (maintain_tiles(m_partition)) return;
+  sort(grid);
+  // The tiles may not fit the grid, and the holes still need closing
+  if (!tiled()) compact();
 }
 
 }
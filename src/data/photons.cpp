@@ -2,7 +2,6 @@
 #include "sim_environment.h"
 #include "utils/logger.h"
 #include "utils/util_functions.h"
-#include "algorithms/functions.h"
 
 namespace Aperture {
 
@@ -24,6 +23,7 @@ Photons::Photons(const Environment& env)
   p_ph = env.conf().delta_t / l_ph;
   p_ic = env.conf().delta_t / env.conf().ic_path;
   track_pct = env.conf().track_percent;
+  periodic = env.conf().boundary_periodic[0];
 
   alpha = env.conf().spectral_alpha;
   e_s = env.conf().e_s;
@@ -43,8 +43,7 @@ Photons::~Photons() {}
 
 void
 Photons::put(std::size_t pos, Pos_t x, Scalar p, Scalar path_left, int cell, int flag) {
-  if (pos >= m_numMax)
-    throw std::runtime_error("Trying to insert photon beyond the end of the array. Resize it first!");
+  if (pos >= m_capacity) reserve(pos + 1);
 
   m_data.x1[pos] = x;
   m_data.p1[pos] = p;
@@ -93,7 +92,28 @@ Photons::sort(const Grid& grid) {
 }
 
 void
-Photons::emit_photons(Particles &electrons, Particles &positrons, const Quadmesh& mesh) {
+Photons::sort_incremental(const Grid& grid) {
+  if (maintain_tiles(m_partition)) return;
+  sort(grid);
+  if (!tiled()) compact();
+}
+
+// Lorentz factor of particle n. The compact particle format does not store
+// it, so there it is computed from p1 and the background
+static double
+particle_gamma(const Particles& ptc, Index_t n, const BackgroundGeometry& geom) {
+#ifdef APERTURE_COMPACT_PARTICLES
+  double beta = geom.beta(ptc.data().cell[n], ptc.data().x1[n]);
+  double p = ptc.data().p1[n];
+  return std::sqrt(1.0 + p * p + beta * beta);
+#else
+  return ptc.data().gamma[n];
+#endif
+}
+
+void
+Photons::emit_photons(Particles &electrons, Particles &positrons,
+                      const Quadmesh& mesh, const BackgroundGeometry& geom) {
   if (!create_pairs)
     return;
   double E_ph;
@@ -101,17 +121,18 @@ Photons::emit_photons(Particles &electrons, Particles &positrons, const Quadmesh
   for (Index_t n = 0; n < electrons.number(); n++) {
     if (electrons.is_empty(n))
       continue;
-    float gamma_ratio = electrons.data().gamma[n] / gamma_thr;
+    double g = particle_gamma(electrons, n, geom);
+    float gamma_ratio = g / gamma_thr;
     if (gamma_ratio > 1.0) {
-      float prob = (electrons.data().gamma[n] * e_min < 0.1 ? p_ic : p_ic * 0.1 / (e_min * electrons.data().gamma[n]));
+      float prob = (g * e_min < 0.1 ? p_ic : p_ic * 0.1 / (e_min * g));
       if (m_dist(m_generator) > prob)
         continue;
-      double x = mesh.pos(0, electrons.data().cell[n], electrons.data().x1[n]) / mesh.sizes[0];
-      E_ph = draw_photon_energy(electrons.data().gamma[n], electrons.data().p1[n], x);
-      double gamma_f = electrons.data().gamma[n] - std::abs(E_ph);
+      double beta = geom.beta(electrons.data().cell[n], electrons.data().x1[n]);
+      E_ph = draw_photon_energy(g, electrons.data().p1[n], beta);
+      double gamma_f = g - std::abs(E_ph);
       if (gamma_f < 1.0)
-        Logger::print_err("Photon energy exceeds particle energy! gamma is {}, Eph is {}", electrons.data().gamma[n], E_ph);
-      if (gamma_f < 2.0) gamma_f = std::min(2.0, electrons.data().gamma[n]);
+        Logger::print_err("Photon energy exceeds particle energy! gamma is {}, Eph is {}", g, E_ph);
+      if (gamma_f < 2.0) gamma_f = std::min(2.0, g);
       double p_i = std::abs(electrons.data().p1[n]);
       electrons.data().p1[n] *= sqrt(gamma_f * gamma_f - 1.0) / p_i;
       double l_photon = draw_photon_freepath(std::abs(E_ph));
@@ -136,19 +157,20 @@ Photons::emit_photons(Particles &electrons, Particles &positrons, const Quadmesh
   for (Index_t n = 0; n < positrons.number(); n++) {
     if (positrons.is_empty(n))
       continue;
-    float gamma_ratio = positrons.data().gamma[n] / gamma_thr;
+    double g = particle_gamma(positrons, n, geom);
+    float gamma_ratio = g / gamma_thr;
     if (gamma_ratio > 1.0) {
-      float e_p = positrons.data().gamma[n] * e_min;
+      float e_p = g * e_min;
       float prob = (e_p < 0.1 ? p_ic : p_ic * 0.1 / e_p);
       if (m_dist(m_generator) > prob)
         continue;
       // Assuming in KN regime, the photon takes 9/10 of the original energy
-      double x = mesh.pos(0, positrons.data().cell[n], positrons.data().x1[n]) / mesh.sizes[0];
-      E_ph = draw_photon_energy(positrons.data().gamma[n], positrons.data().p1[n], x);
-      double gamma_f = positrons.data().gamma[n] - std::abs(E_ph);
+      double beta = geom.beta(positrons.data().cell[n], positrons.data().x1[n]);
+      E_ph = draw_photon_energy(g, positrons.data().p1[n], beta);
+      double gamma_f = g - std::abs(E_ph);
       if (gamma_f < 1.0)
-        Logger::print_err("Photon energy exceeds particle energy! gamma is {}, Eph is {}", positrons.data().gamma[n], E_ph);
-      if (gamma_f < 2.0) gamma_f = std::min(2.0, positrons.data().gamma[n]);
+        Logger::print_err("Photon energy exceeds particle energy! gamma is {}, Eph is {}", g, E_ph);
+      if (gamma_f < 2.0) gamma_f = std::min(2.0, g);
       double p_i = std::abs(positrons.data().p1[n]);
       positrons.data().p1[n] *= sqrt(gamma_f * gamma_f - 1.0) / p_i;
       double l_photon = draw_photon_freepath(std::abs(E_ph));
@@ -206,6 +228,15 @@ Photons::move(const Grid& grid, double dt) {
     cell += delta_cell;
     // Logger::print_info("After move, c is {}, x1 is {}", c, m_data.x1[idx]);
 
+    // Boundary condition. Photons are removed as soon as they leave the
+    // bulk, and erased together with the particles after pair conversion.
+    bool below = (cell < mesh.guard[0]);
+    bool above = (cell >= mesh.dims[0] - mesh.guard[0]);
+    if (periodic)
+      cell += mesh.reduced_dim(0) * (below - above);
+    else if (below || above)
+      mark_erase(idx);
+
     m_data.cell[idx] = cell;
     // std::cout << m_data.x1[idx] << ", " << m_data.cell[idx] << std::endl;
     m_data.x1[idx] -= (Pos_t)delta_cell;
@@ -338,12 +369,11 @@ Photons::draw_photon_u1p(double e1p, double gamma) {
 }
 
 double
-Photons::draw_photon_energy(double gamma, double p, double x) {
+Photons::draw_photon_energy(double gamma, double p, double beta) {
   double e1p = draw_photon_e1p(gamma);
   double u1p = draw_photon_u1p(e1p, gamma);
   // given e1p and u1p, compute the photon energy in the lab frame
   // Logger::print_info("e1p is {}, u1p is {}", e1p, u1p);
-  double beta = beta_phi(x);
   double v = ((beta < 0.0 ? -1.0 : 1.0) * p / gamma + beta * beta) / (1.0 + beta * beta);
   if (beta < 0.0) {
     v *= -1.0;
@@ -0,0 +1,94 @@
+#include "field_averager.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace Aperture {
+
+FieldAverager::FieldAverager(uint32_t interval)
+    : m_interval(std::max<uint32_t>(interval, 1)) {}
+
+FieldAverager::~FieldAverager() {}
+
+FieldAverager::array_type&
+FieldAverager::add(const std::string& name, const array_type& source,
+                   uint32_t window, uint32_t stride) {
+  if (!m_entries.empty() && source.size() != m_entries[0]->source->size())
+    throw std::invalid_argument("Averaged arrays must all have the same size!");
+  std::unique_ptr<Entry> entry(new Entry);
+  entry->name = name;
+  entry->source = &source;
+  entry->sum.resize(source.extent());
+  entry->sum.assign(0.0);
+  entry->average.resize(source.extent());
+  entry->average.assign(0.0);
+  entry->window = window;
+  entry->stride = std::max<uint32_t>(stride, 1);
+  m_entries.push_back(std::move(entry));
+  return m_entries.back()->average;
+}
+
+bool
+FieldAverager::in_window(uint32_t step, uint32_t interval, uint32_t window,
+                         uint32_t stride) {
+  interval = std::max<uint32_t>(interval, 1);
+  stride = std::max<uint32_t>(stride, 1);
+  if (window == 0 || window > interval) window = interval;
+  // Number of steps between this one and the last one before the next output
+  uint32_t before_output = interval - 1 - step % interval;
+  return (before_output < window && before_output % stride == 0);
+}
+
+void
+FieldAverager::accumulate(uint32_t step) {
+  m_active.clear();
+  for (auto& e : m_entries) {
+    if (e->claimed == step) continue;
+    if (in_window(step, m_interval, e->window, e->stride)) {
+      m_active.push_back(e.get());
+      e->count += 1;
+    }
+  }
+  if (m_active.empty()) return;
+
+  // Go over the grid once, in blocks small enough that the blocks of all the
+  // sums stay in cache
+  const int block = 512;
+  const int size = m_active[0]->sum.size();
+  for (int b0 = 0; b0 < size; b0 += block) {
+    int b1 = std::min(size, b0 + block);
+    for (auto e : m_active) {
+      Scalar* sum = e->sum.data();
+      const Scalar* src = e->source->data();
+#pragma omp simd
+      for (int i = b0; i < b1; i++) sum[i] += src[i];
+    }
+  }
+}
+
+Scalar*
+FieldAverager::claim(const array_type& source, uint32_t step) {
+  for (auto& e : m_entries) {
+    if (e->source != &source || e->claimed == step) continue;
+    if (!in_window(step, m_interval, e->window, e->stride)) continue;
+    e->claimed = step;
+    e->count += 1;
+    return e->sum.data();
+  }
+  return nullptr;
+}
+
+void
+FieldAverager::normalize() {
+  for (auto& e : m_entries) {
+    Scalar factor = (e->count > 0 ? 1.0 / e->count : 0.0);
+    Scalar* sum = e->sum.data();
+    Scalar* avg = e->average.data();
+    for (int i = 0; i < e->sum.size(); i++) {
+      avg[i] = sum[i] * factor;
+      sum[i] = 0.0;
+    }
+    e->count = 0;
+  }
+}
+
+}  // namespace Aperture
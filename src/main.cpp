@@ -1,9 +1,11 @@
+#include <algorithm>
 #include <iostream>
 #include <random>
 #include "utils/logger.h"
 #include "sim_environment.h"
 #include "sim_data.h"
 #include "pic_sim.h"
+#include "field_averager.h"
 #include "utils/util_functions.h"
 
 using namespace Aperture;
@@ -124,16 +126,28 @@ int main(int argc, char *argv[])
   //   data.E(0, i) = -jb * 1 * (19182.2 + 0.85 * x - 2600.0 * log(x + 1600.0));
   // }
 
+  // Time averaged output. E is averaged over every step, the moments of
+  // each species over the sampled steps
+  FieldAverager averager(env.args().data_interval());
+  uint32_t window = env.conf().diag_window;
+  uint32_t stride = std::max(env.conf().diag_stride, 1);
+  auto& E1_avg = averager.add("E1avg", data.E.data(0));
+  auto& Rho_e_avg = averager.add("Rho_e_avg", data.Rho[0].data(), window, stride);
+  auto& Rho_p_avg = averager.add("Rho_p_avg", data.Rho[1].data(), window, stride);
+  auto& J_e_avg = averager.add("J_e_avg", data.J_s[0].data(), window, stride);
+  auto& J_p_avg = averager.add("J_p_avg", data.J_s[1].data(), window, stride);
+  sim.set_averager(&averager);
+
   // Initialize data output
   env.exporter().AddArray("E1", data.E, 0);
-  env.exporter().AddArray("E1avg", data.B, 0);
+  env.exporter().AddArray("E1avg", E1_avg);
   env.exporter().AddArray("J1", data.J, 0);
   env.exporter().AddArray("Rho_e", data.Rho[0].data());
   env.exporter().AddArray("Rho_p", data.Rho[1].data());
-  env.exporter().AddArray("Rho_e_avg", data.Rho_avg[0].data());
-  env.exporter().AddArray("Rho_p_avg", data.Rho_avg[1].data());
-  env.exporter().AddArray("J_e_avg", data.J_avg[0].data());
-  env.exporter().AddArray("J_p_avg", data.J_avg[1].data());
+  env.exporter().AddArray("Rho_e_avg", Rho_e_avg);
+  env.exporter().AddArray("Rho_p_avg", Rho_p_avg);
+  env.exporter().AddArray("J_e_avg", J_e_avg);
+  env.exporter().AddArray("J_p_avg", J_p_avg);
   env.exporter().AddParticleArray("Electrons", data.particles[0]);
   env.exporter().AddParticleArray("Positrons", data.particles[1]);
   if (env.conf().trace_photons)
@@ -153,25 +167,12 @@ int main(int argc, char *argv[])
     double time = step * env.conf().delta_t;
 
     if (step % env.args().data_interval() == 0) {
-      double factor = 1.0 / env.args().data_interval();
-      data.B.multiplyBy(factor);
-      data.Rho_avg[0].multiplyBy(factor);
-      data.Rho_avg[1].multiplyBy(factor);
-      data.J_avg[0].multiplyBy(factor);
-      data.J_avg[1].multiplyBy(factor);
+      averager.normalize();
       env.exporter().WriteOutput(step, time);
-      data.B.initialize();
-      data.Rho_avg[0].initialize();
-      data.Rho_avg[1].initialize();
-      data.J_avg[0].initialize();
-      data.J_avg[1].initialize();
     }
 
     sim.step(data, step);
-    data.Rho_avg[0].addBy(data.Rho[0]);
-    data.Rho_avg[1].addBy(data.Rho[1]);
-    data.J_avg[0].addBy(data.J_s[0]);
-    data.J_avg[1].addBy(data.J_s[1]);
+    averager.accumulate(step);
   }
   return 0;
 }
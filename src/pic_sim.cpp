@@ -1,13 +1,35 @@
 #include "pic_sim.h"
-#include "algorithms/field_solver_integral.h"
-#include "algorithms/ptc_pusher_geodesic.h"
-#include "algorithms/current_deposit_Esirkepov.h"
+#include "algorithm_registry.h"
 #include "domain_communicator.h"
+#include "field_averager.h"
+#include <algorithm>
+#include <cmath>
 #include <functional>
+#include <limits>
 #include <memory>
 
 namespace Aperture {
 
+namespace {
+
+// Create the implementation of a module named in the config file, or the
+// default one if there is no such name
+template <typename T>
+std::unique_ptr<T>
+create_module(const std::string& name, const Environment& env) {
+  auto& registry = AlgorithmRegistry<T>::instance();
+  std::string selected = name;
+  if (!registry.has(name)) {
+    Logger::print_err("Unknown {} {}, using {}", registry.kind(), name,
+                      registry.default_name());
+    selected = registry.default_name();
+  }
+  Logger::print_info("Using {} {}", selected, registry.kind());
+  return registry.create(selected, env);
+}
+
+}  // namespace
+
 // PICSim::PICSim() :
 //     PICSim(Environment::get_instance()) {}
 
@@ -16,23 +38,55 @@ PICSim::PICSim(Environment& env) : m_env(env) {
   // Initialize modules
   m_comm = std::make_unique<DomainCommunicator>(env);
 
-  // TODO: select current deposition method according to config
-  m_depositer = std::make_unique<CurrentDepositer_Esirkepov>(m_env);
+  m_depositer = create_module<CurrentDepositer>(
+      env.conf().algorithm_current_deposit, m_env);
   m_depositer->set_periodic(env.conf().boundary_periodic[0]);
   m_depositer->set_interp_order(env.conf().interpolation_order);
+  m_depositer->set_deposit_chunks(env.conf().deposit_chunks);
 
-  // TODO: select field solver according to config
-  m_field_solver = std::make_unique<FieldSolver_Integral>(m_env.local_grid(),
-                                                          m_env.local_grid_dual());
+  m_field_solver =
+      create_module<FieldSolver>(env.conf().algorithm_field_update, m_env);
 
-  // TODO: select particle mover type according to config
   // int interp_order = m_env.conf().interpolation_order;
 
-  // Implement particle pusher
-  m_pusher = std::make_unique<ParticlePusher_Geodesic>();
+  m_pusher = create_module<ParticlePusher>(env.conf().algorithm_ptc_push, m_env);
   m_pusher->set_periodic(env.conf().boundary_periodic[0]);
   m_pusher->set_interp_order(env.conf().interpolation_order);
 
+  if (env.conf().step_engine == "fused") {
+    m_fused = true;
+  } else if (env.conf().step_engine != "staged") {
+    Logger::print_err("Unknown step engine {}, using staged",
+                      env.conf().step_engine);
+  }
+  Logger::print_info("Using {} step engine", m_fused ? "fused" : "staged");
+
+  if (env.conf().field_engine == "fused") {
+    m_fused_fields = true;
+  } else if (env.conf().field_engine != "staged") {
+    Logger::print_err("Unknown field engine {}, using staged",
+                      env.conf().field_engine);
+  }
+  if (env.conf().current_smoothing > 0) {
+    // Split along x, the guard cells come from the neighbours, and only the
+    // ends of the first and last domain are boundaries unless periodic
+    auto& cart = env.cartesian();
+    bool periodic = env.conf().boundary_periodic[0];
+    bool split = !cart.is_null() && cart.dim(0) > 1;
+    m_filter = std::make_unique<CurrentFilter>(env.conf().current_smoothing,
+                                               env.conf().current_compensate,
+                                               periodic && !split);
+    if (split)
+      m_filter->set_boundary(!periodic && cart.coord(0) == 0,
+                             !periodic && cart.coord(0) == cart.dim(0) - 1);
+    Logger::print_info("Smoothing the current with {} passes",
+                       m_filter->passes());
+  }
+  // The filter needs all of J, so the species are summed before it
+  m_depositer->set_edge_sum_only(m_fused_fields && m_filter == nullptr);
+  Logger::print_info("Using {} field engine",
+                     m_fused_fields ? "fused" : "staged");
+
   // TODO: figure out a way to set algorithm
   // if (m_env.conf().algorithm_ptc_push == "Vay")
   //   m_pusher -> set_algorithm(ForceAlgorithm::Vay);
@@ -54,6 +108,10 @@ PICSim::PICSim(Environment& env) : m_env(env) {
   m_field_solver->register_comm_callback(
       [this](ScalarField<Scalar>& f) -> void { m_comm->get_guard_cells(f); });
 
+  if (m_filter != nullptr)
+    m_filter->register_comm_callback(
+        [this](VectorField<Scalar>& j) -> void { m_comm->get_guard_cells(j); });
+
   // auto &comm = *m_comm;
   // std::function<void(VectorField<Scalar>&)> vcall = [&comm](VectorField<Scalar>& f) -> void { comm.get_guard_cells(f); };
   // m_field_solver->register_comm_callback(std::bind(
@@ -76,13 +134,45 @@ void PICSim::loop(Aperture::SimData& data, uint32_t steps, uint32_t data_freq) {
 void
 PICSim::step(Aperture::SimData &data, uint32_t step) {
   double dt = m_env.conf().delta_t;
+  update_subcycle(data, step, dt);
+  m_field_solver->predict_fields(data, *m_depositer, dt);
   // TODO: add particle logic
-  m_pusher->push(data, dt);
-  m_depositer->deposit(data, dt);
-  m_field_solver->update_fields(data, dt);
-  data.photons.emit_photons(data.particles[0], data.particles[1], data.E.grid().mesh());
+  if (m_fused) {
+    push_deposit_fused(data, dt);
+  } else {
+    m_pusher->push(data, dt);
+    m_depositer->deposit(data, dt);
+  }
+  if (m_filter != nullptr) m_filter->apply(data.J);
+  if (m_fused_fields) {
+    Scalar* E_sum = nullptr;
+    if (m_averager != nullptr)
+      E_sum = m_averager->claim(data.E.data(0), step);
+    m_field_solver->update_fields_fused(data, dt, E_sum, m_filter == nullptr);
+  } else {
+    m_field_solver->update_fields(data, dt);
+  }
+  data.photons.emit_photons(data.particles[0], data.particles[1],
+                            data.E.grid().mesh(), data.geometry);
   data.photons.move(data.E.grid(), dt);
+  // New pairs are appended to the particle arrays, and have not been through
+  // the boundary condition in the mover
+  std::vector<Index_t> first_new;
+  for (auto& part : data.particles) first_new.push_back(part.number());
   data.photons.convert_pairs(data.particles[0], data.particles[1]);
+  // Erase what left the box, and close the holes so that the next step
+  // only sees live particles
+  m_pusher->handle_boundary(data, first_new);
+  const bool incremental = m_env.conf().incremental_sort;
+  if (incremental) {
+    // The holes are kept as slack in the tiles, and closed when the
+    // overflow is merged
+    for (auto& part : data.particles) part.sort_incremental(data.E.grid());
+    data.photons.sort_incremental(data.E.grid());
+  } else {
+    for (auto& part : data.particles) part.compact();
+    data.photons.compact();
+  }
 
   // auto& mesh = data.E.grid().mesh();
   // Logger::print_info("J at boundary 1: {} | {} | {} | {}", data.J(0, 1),
@@ -90,27 +180,39 @@ PICSim::step(Aperture::SimData &data, uint32_t step) {
   // Logger::print_info("J at boundary 2: {} | {} | {} | {}", data.J(0, 0),
   //                    data.J(0, 1), data.J(0, 2), data.J(0, 3));
 
-  // Sort the particles every 20 timesteps to move empty slots to the back
-  if ((step % 100) == 0) {
+  // Sort the particles every 100 timesteps to keep the particles of a tile
+  // together
+  bool sorted = ((step % 100) == 0);
+  if (sorted && !incremental) {
     for (auto& part : data.particles) {
       part.sort(data.E.grid());
     }
   }
-  if ((step % 200) == 0) {
+  if ((step % 200) == 0 && !incremental) {
     data.photons.sort(data.E.grid());
   }
-  m_pusher->handle_boundary(data);
-  Logger::print_info("There are {} electrons in the pool", data.particles[0].number());
-  Logger::print_info("There are {} positrons in the pool", data.particles[1].number());
+  if (sorted) {
+    const double MB = 1024.0 * 1024.0;
+    for (Index_t sp = 0; sp < data.particles.size(); sp++) {
+      auto& part = data.particles[sp];
+      Logger::print_info("Species {} uses {:.1f} MB, at most {:.1f} MB so far",
+                         sp, part.memory() / MB, part.peak_memory() / MB);
+    }
+    Logger::print_info("Photons use {:.1f} MB, at most {:.1f} MB so far",
+                       data.photons.memory() / MB,
+                       data.photons.peak_memory() / MB);
+  }
+  Logger::print_info("There are {} electrons in the pool", data.particles[0].count_live());
+  Logger::print_info("There are {} positrons in the pool", data.particles[1].count_live());
 
   uint32_t total_tracked_e = 0;
   uint32_t total_tracked_ph = 0;
   for (Index_t idx = 0; idx < data.particles[0].number(); idx++) {
-    if (!data.particles[0].is_empty(idx) && data.particles[0].check_flag(idx, ParticleFlag::tracked))
+    if (data.particles[0].check_flag(idx, ParticleFlag::tracked))
       total_tracked_e += 1;
   }
   for (Index_t idx = 0; idx < data.photons.number(); idx++) {
-    if (!data.photons.is_empty(idx) && data.photons.check_flag(idx, PhotonFlag::tracked))
+    if (data.photons.check_flag(idx, PhotonFlag::tracked))
       total_tracked_ph += 1;
   }
   Logger::print_info("{} electrons are tracked", total_tracked_e);
@@ -119,4 +221,118 @@ PICSim::step(Aperture::SimData &data, uint32_t step) {
 }
 
 
+void
+PICSim::update_subcycle(SimData& data, uint32_t step, double dt) {
+  auto& conf = m_env.conf();
+  m_next_advance.resize(data.particles.size(), step);
+  for (Index_t sp = 0; sp < data.particles.size(); sp++) {
+    data.advance[sp] = (step >= m_next_advance[sp]);
+    if (!data.advance[sp]) continue;
+    int n = conf.subcycle[sp];
+    if (n <= 0) {
+      n = auto_subcycle(data, sp, dt);
+    } else if (n > 1) {
+      // A manual subcycle is kept within the same displacement limit
+      n = std::min(n, displacement_limit(data, sp, dt));
+      if (n < conf.subcycle[sp] && n != data.subcycle[sp])
+        Logger::print_err("Species {} moves too far in {} steps for the deposit",
+                          sp, conf.subcycle[sp]);
+    }
+    if (n != data.subcycle[sp])
+      Logger::print_info("Species {} is now advanced every {} steps", sp, n);
+    data.subcycle[sp] = n;
+    m_next_advance[sp] = step + data.subcycle[sp];
+    // The charge density of this advance is held until the next one, so it
+    // is needed if any step until then is sampled
+    data.deposit_rho[sp] = false;
+    for (uint32_t s = step; s < m_next_advance[sp]; s++) {
+      if (sample_step(s)) {
+        data.deposit_rho[sp] = true;
+        break;
+      }
+    }
+    data.keep_current[sp] = (data.subcycle[sp] > 1 || data.deposit_rho[sp]);
+  }
+}
+
+bool
+PICSim::sample_step(uint32_t step) const {
+  return FieldAverager::in_window(step, m_env.args().data_interval(),
+                                  m_env.conf().diag_window,
+                                  m_env.conf().diag_stride);
+}
+
+int
+PICSim::displacement_limit(const SimData& data, Index_t sp, double dt) const {
+  // A subcycled particle should still move less than half a cell, so that
+  // the deposit stencil holds
+  const double max_displacement = 0.5;
+
+  auto& part = data.particles[sp];
+  auto& ptc = part.data();
+  double max_v = 0.0;
+  for (Index_t n = 0; n < part.number(); n++) {
+    if (part.is_empty(n)) continue;
+    // Same velocity as in the geodesic pusher
+    double beta = data.geometry.beta(ptc.cell[n], ptc.x1[n]);
+    double p = ptc.p1[n];
+    double g = std::sqrt(1.0 + p * p + beta * beta);
+    double v = ((beta < 0.0 ? -1.0 : 1.0) * p / g + beta * beta) / (1.0 + beta * beta);
+    max_v = std::max(max_v, std::abs(v));
+  }
+  double max_dx = max_v * dt / data.E.grid().mesh().delta[0];
+  double n = std::numeric_limits<int>::max();
+  if (max_dx > 0.0) n = std::min(n, max_displacement / max_dx);
+  return std::max((int)n, 1);
+}
+
+int
+PICSim::auto_subcycle(const SimData& data, Index_t sp, double dt) const {
+  // Besides the displacement limit, a particle should get a momentum kick
+  // from E much smaller than m c over one advance
+  const int max_subcycle = 16;
+  const double max_kick = 0.1;
+
+  auto& part = data.particles[sp];
+  double max_E = 0.0;
+  for (int i = 0; i < data.E.grid().mesh().dims[0]; i++)
+    max_E = std::max(max_E, std::abs(data.E(0, i)));
+  double kick = std::abs(part.charge()) * max_E * dt / part.mass();
+
+  int n = std::min(max_subcycle, displacement_limit(data, sp, dt));
+  if (kick > 0.0) n = (int)std::min<double>(n, max_kick / kick);
+  return std::max(n, 1);
+}
+
+void
+PICSim::push_deposit_fused(SimData& data, double dt) {
+  Logger::print_info("In fused particle pass");
+  // Small enough for the particle data of a block to stay in L1 cache
+  const Index_t block_size = 512;
+  m_depositer->begin_deposit(data);
+  for (Index_t sp = 0; sp < data.particles.size(); sp++) {
+    auto& part = data.particles[sp];
+    if (!data.advance[sp] || part.number() == 0) continue;
+    double dt_sp = data.subcycle[sp] * dt;
+    // Each chunk of particles is pushed and deposited by one thread
+    const Index_t num = part.number();
+    const Index_t num_chunks = m_depositer->begin_chunks(data, sp);
+    const Index_t chunk_size = m_depositer->chunk_size();
+    part.reserve_displacement();
+#pragma omp parallel for schedule(dynamic)
+    for (Index_t k = 0; k < num_chunks; k++) {
+      DepositWindow window(m_depositer->chunk_J(k), m_depositer->chunk_Rho(k),
+                           m_depositer->chunk_dim());
+      Index_t chunk_end = std::min(num, (k + 1) * chunk_size);
+      for (Index_t begin = k * chunk_size; begin < chunk_end; begin += block_size) {
+        Index_t end = std::min(chunk_end, begin + block_size);
+        m_pusher->push_range(part, data.E, data.geometry, dt_sp, begin, end);
+        m_depositer->deposit_range(window, part, dt_sp, begin, end);
+      }
+    }
+    m_depositer->reduce_chunks();
+  }
+  m_depositer->finish_deposit(data);
+}
+
 }
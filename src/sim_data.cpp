@@ -1,4 +1,5 @@
 #include "sim_data.h"
+#include <algorithm>
 
 namespace Aperture {
 
@@ -12,18 +13,23 @@ SimData::SimData(const Environment& e) :
     env(e), E(env.local_grid()),
     B(env.local_grid()),
     J(env.local_grid()),
+    geometry(env.local_grid()),
     photons(env) {
   // initialize(env);
   num_species = 3;
   E.initialize();
+  B.set_field_type(FieldType::B);
   B.initialize();
   J.initialize();
   for (int i = 0; i < num_species; i++) {
     Rho.emplace_back(env.local_grid());
-    Rho_avg.emplace_back(env.local_grid());
     J_s.emplace_back(env.local_grid());
-    J_avg.emplace_back(env.local_grid());
     particles.emplace_back(env.conf().max_ptc_number);
+    particles.back().set_sort_by_cell(env.conf().sort_by_cell);
+    subcycle.push_back(std::max(env.conf().subcycle[i], 1));
+    advance.push_back(true);
+    deposit_rho.push_back(true);
+    keep_current.push_back(true);
 
     double q = env.conf().q_e;
     if (static_cast<ParticleType>(i) == ParticleType::electron) {
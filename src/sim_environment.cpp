@@ -4,6 +4,9 @@
 // #include "data/detail/grid_impl.hpp"
 #include "sim_data.h"
 #include "domain_communicator.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace Aperture {
 
@@ -33,6 +36,13 @@ Environment::Environment(int* argc, char*** argv)
   Logger::init(m_comm->world().rank(), m_conf_file.data().log_lvl, m_conf_file.data().log_file);
   Logger::print_debug("Current rank is {}", m_comm->world().rank());
 
+#ifdef _OPENMP
+  omp_set_num_threads(m_args.threads());
+  Logger::print_info("Using {} threads per rank", m_args.threads());
+#else
+  if (m_args.threads() > 1)
+    Logger::print_err("Built without OpenMP, ignoring --threads {}", m_args.threads());
+#endif
 
   // Obtain the metric type and setup the grid mesh
   // m_metric_type = parse_metric(m_conf_file.data().metric);
@@ -12,6 +12,7 @@ void Logger::init(int rank, LogLevel level, std::string log_file) {
   m_rank = rank;
   m_level = level;
   m_log_file = log_file;
+  if (m_file != nullptr) std::fclose(m_file);
   m_file = std::fopen(log_file.c_str(), "w");
   if (!m_file) {
     print_err("Can't open file!\n");
@@ -1,7 +1,11 @@
 #include "utils/memory.h"
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <new>
 #include <assert.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 // using namespace Aperture;
 namespace Aperture {
@@ -20,4 +24,56 @@ void aligned_free(void* p) {
   free((void*)((uintptr_t)p-((uint16_t*)p)[-1]));
 }
 
+namespace {
+
+std::size_t
+page_size() {
+  static std::size_t size = sysconf(_SC_PAGESIZE);
+  return size;
+}
+
+std::size_t
+round_to_pages(std::size_t size) {
+  return (size + page_size() - 1) / page_size() * page_size();
+}
+
+}
+
+void* reserve_pages(std::size_t size) {
+  if (size == 0) return nullptr;
+  void* p = mmap(nullptr, round_to_pages(size), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED) throw std::bad_alloc();
+  return p;
+}
+
+void* grow_pages(void* p, std::size_t old_size, std::size_t new_size) {
+  if (p == nullptr) return reserve_pages(new_size);
+  if (round_to_pages(new_size) <= round_to_pages(old_size)) return p;
+#ifdef __linux__
+  void* q = mremap(p, round_to_pages(old_size), round_to_pages(new_size),
+                   MREMAP_MAYMOVE);
+  if (q == MAP_FAILED) throw std::bad_alloc();
+  return q;
+#else
+  void* q = reserve_pages(new_size);
+  std::memcpy(q, p, old_size);
+  free_pages(p, old_size);
+  return q;
+#endif
+}
+
+void release_pages(void* p, std::size_t size) {
+  // Only the pages that lie entirely inside the range
+  uintptr_t begin = (uintptr_t)p;
+  uintptr_t end = begin + size;
+  begin = (begin + page_size() - 1) / page_size() * page_size();
+  end = end / page_size() * page_size();
+  if (end > begin) madvise((void*)begin, end - begin, MADV_DONTNEED);
+}
+
+void free_pages(void* p, std::size_t size) {
+  if (p != nullptr) munmap(p, round_to_pages(size));
+}
+
 }
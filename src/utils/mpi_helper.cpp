@@ -143,19 +143,23 @@ void register_particle_type(const ParticleType& p_def, MPI_Datatype* type) {
   MPI_Datatype types[n_entries];
   MPI_Aint offsets[n_entries];
 
+  // Take the offsets from the struct itself, since there is padding when
+  // Pos_t is smaller than Scalar
   int n = 0;
-  int offset = 0;
+  const char* base = reinterpret_cast<const char*>(&p_def);
   boost::fusion::for_each(
-      p_def, [&n, &offset, &blocklengths, &types, &offsets](auto& x) {
+      p_def, [&n, base, &blocklengths, &types, &offsets](auto& x) {
         blocklengths[n] = 1;
         types[n] = get_mpi_datatype(
             typename std::remove_reference<decltype(x)>::type());
-        offsets[n] = offset;
+        offsets[n] = reinterpret_cast<const char*>(&x) - base;
         n += 1;
-        offset += sizeof(typename std::remove_reference<decltype(x)>::type);
       });
 
-  MPI_Type_create_struct(n_entries, blocklengths, offsets, types, type);
+  MPI_Datatype tmp_type;
+  MPI_Type_create_struct(n_entries, blocklengths, offsets, types, &tmp_type);
+  MPI_Type_create_resized(tmp_type, 0, sizeof(ParticleType), type);
+  MPI_Type_free(&tmp_type);
   MPI_Type_commit(type);
 }
 
@@ -0,0 +1,41 @@
+#include "utils/simd.h"
+
+namespace Aperture {
+
+SimdLevel
+detect_simd_level() {
+#ifdef APERTURE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return SimdLevel::avx512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return SimdLevel::avx2;
+#endif
+  return SimdLevel::scalar;
+}
+
+int
+simd_width(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::avx512:
+      return 8;
+    case SimdLevel::avx2:
+      return 4;
+    default:
+      return 1;
+  }
+}
+
+const char*
+simd_level_name(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::avx512:
+      return "avx512";
+    case SimdLevel::avx2:
+      return "avx2";
+    default:
+      return "scalar";
+  }
+}
+
+}
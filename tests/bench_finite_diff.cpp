@@ -0,0 +1,50 @@
+#include "algorithms/finite_diff.h"
+#include "data/fields.h"
+#include "data/grid.h"
+#include "utils/timer.h"
+#include <iostream>
+#include <random>
+#include <string>
+
+using namespace Aperture;
+
+// Times the curl of a vector field on a 3D grid, with the tiled derivative
+// and with the reference one. Usage: bench_finite_diff [N] [order]
+int main(int argc, char *argv[]) {
+  int N = (argc > 1 ? std::stoi(argv[1]) : 128);
+  int order = (argc > 2 ? std::stoi(argv[2]) : 2);
+  const int repeat = 10;
+  std::string dim = " 0.0 1.0 2";
+  Grid grid(std::array<std::string, 3>{"DIM1 " + std::to_string(N) + dim,
+                                       "DIM2 " + std::to_string(N) + dim,
+                                       "DIM3 " + std::to_string(N) + dim});
+  VectorField<Scalar> A(grid), curl(grid), curl_ref(grid);
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+  for (int n = 0; n < VECTOR_DIM; n++)
+    for (int i = 0; i < grid.size(); i++) A.data(n)[i] = dist(gen);
+
+  timer::stamp("tiled");
+  for (int r = 0; r < repeat; r++) FiniteDiff::compute_curl(A, curl, order);
+  timer::show_duration_since_stamp("10 tiled curls", "ms", "tiled");
+
+  timer::stamp("reference");
+  for (int r = 0; r < repeat; r++) {
+    for (int i = 0; i < VECTOR_DIM; i++) {
+      curl_ref.data(i).assign(0.0);
+      int j = (i + 1) % VECTOR_DIM, k = (i + 2) % VECTOR_DIM;
+      FiniteDiff::derivative_reference(grid, A.data(k), curl_ref.data(i), j,
+                                       A.stagger(k), 1.0, order);
+      FiniteDiff::derivative_reference(grid, A.data(j), curl_ref.data(i), k,
+                                       A.stagger(j), -1.0, order);
+    }
+  }
+  timer::show_duration_since_stamp("10 reference curls", "ms", "reference");
+
+  double diff = 0.0;
+  for (int n = 0; n < VECTOR_DIM; n++)
+    for (int i = 0; i < grid.size(); i++)
+      diff = std::max(diff, std::abs(curl.data(n)[i] - curl_ref.data(n)[i]));
+  std::cout << "Largest difference is " << diff << std::endl;
+  return 0;
+}
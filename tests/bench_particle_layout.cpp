@@ -0,0 +1,160 @@
+#include "algorithms/current_deposit_kernels.h"
+#include "algorithms/ptc_pusher_geodesic_simd.h"
+#include "data/background_geometry.h"
+#include "data/fields.h"
+#include "data/grid.h"
+#include "data/particle_blocks.h"
+#include "data/particles.h"
+#include "utils/simd.h"
+#include "utils/timer.h"
+#include <iostream>
+#include <random>
+#include <string>
+
+using namespace Aperture;
+
+namespace {
+
+typedef ParticleBlocks<single_particle_t> Blocks;
+
+struct Setup {
+  Grid grid;
+  VectorField<Scalar> E;
+  BackgroundGeometry geom;
+  std::vector<Scalar> J;
+  SimdLevel level = detect_simd_level();
+  double dt = 0.1;
+
+  explicit Setup(int N)
+      : grid(std::array<std::string, 3>{
+            "DIM1 " + std::to_string(N) + " 0.0 " + std::to_string(N) + " 3",
+            "", ""}),
+        E(grid),
+        geom(grid, [](double x) { return 0.0; }),
+        J(grid.mesh().dims[0], 0.0) {
+    for (int i = 0; i < grid.mesh().dims[0]; i++)
+      E(0, i) = 0.01 * std::sin(0.01 * i);
+  }
+
+  detail::geodesic_push_params params(Pos_t* dx1,
+                                      std::vector<Index_t>* absorbed) const {
+    auto& mesh = grid.mesh();
+    detail::geodesic_push_params p;
+    p.E = E.data(0).data();
+    p.dx1 = dx1;
+    p.beta = geom.beta();
+    p.inv_b2p1 = geom.inv_b2p1();
+    p.force = geom.force();
+    p.q_dt_over_m = -dt;
+    p.dt = dt;
+    p.dt_over_delta = dt / mesh.delta[0];
+    // Periodic, so that nothing is absorbed
+    p.wrap_lower = mesh.guard[0];
+    p.wrap_upper = mesh.dims[0] - mesh.guard[0];
+    p.wrap_shift = mesh.reduced_dim(0);
+    p.absorb_lower = 0;
+    p.absorb_upper = mesh.dims[0];
+    p.absorbed = absorbed;
+    return p;
+  }
+
+  void push(particle_data& ptc, Pos_t* dx1, Index_t num) const {
+    std::vector<Index_t> absorbed;
+    auto p = params(dx1, &absorbed);
+    if (level == SimdLevel::avx512)
+      detail::geodesic_push_avx512(ptc, p, 0, num);
+    else
+      detail::geodesic_push_avx2(ptc, p, 0, num);
+  }
+
+  void deposit(const particle_data& ptc, const Pos_t* dx1, Index_t num) {
+    deposit_flux<1>(J.data(), nullptr, 0, ptc, dx1, 0, num, 1.0,
+                    grid.mesh().delta[0], dt);
+  }
+};
+
+// The displacement of the particles of a block. The compact format keeps
+// it outside of the particles, in an array of its own
+Pos_t*
+block_dx1(Blocks& blocks, std::vector<Pos_t>& dx1, Index_t b) {
+#ifdef APERTURE_COMPACT_PARTICLES
+  return dx1.data() + b * Blocks::lanes;
+#else
+  return blocks.block(b).dx1;
+#endif
+}
+
+void
+run_kernels(Setup& setup, Particles& ptc, Blocks& blocks,
+            std::vector<Pos_t>& dx1, int repeat, const std::string& when) {
+  const Index_t num = ptc.number();
+  timer::stamp("push");
+  for (int r = 0; r < repeat; r++) setup.push(ptc.data(), ptc.displacement(), num);
+  timer::show_duration_since_stamp("SoA push, " + when, "ms", "push");
+  timer::stamp("push");
+  for (int r = 0; r < repeat; r++) {
+    for (Index_t b = 0; b < blocks.num_blocks(); b++) {
+      auto view = blocks.block(b);
+      setup.push(view, block_dx1(blocks, dx1, b), Blocks::lanes);
+    }
+  }
+  timer::show_duration_since_stamp("AoSoA push, " + when, "ms", "push");
+
+  timer::stamp("deposit");
+  for (int r = 0; r < repeat; r++)
+    setup.deposit(ptc.data(), ptc.displacement(), num);
+  timer::show_duration_since_stamp("SoA deposit, " + when, "ms", "deposit");
+  timer::stamp("deposit");
+  for (int r = 0; r < repeat; r++) {
+    for (Index_t b = 0; b < blocks.num_blocks(); b++)
+      setup.deposit(blocks.block(b), block_dx1(blocks, dx1, b), Blocks::lanes);
+  }
+  timer::show_duration_since_stamp("AoSoA deposit, " + when, "ms", "deposit");
+}
+
+}  // namespace
+
+// Times the push, deposit and sort of the same particles stored as
+// structs of arrays (Particles) and in blocks (ParticleBlocks), before and
+// after sorting them into tiles. Usage: bench_particle_layout [particles]
+// [cells], with the particle number a multiple of the lanes
+int main(int argc, char *argv[]) {
+  Index_t num = (argc > 1 ? std::stoul(argv[1]) : (1 << 22));
+  int N = (argc > 2 ? std::stoi(argv[2]) : 1 << 16);
+  num = num / Blocks::lanes * Blocks::lanes;
+  const int repeat = 10;
+  Setup setup(N);
+  if (setup.level == SimdLevel::scalar) {
+    std::cout << "The vectorized push needs at least AVX2" << std::endl;
+    return 0;
+  }
+  std::cout << "Blocks of " << Blocks::lanes << " particles, "
+            << simd_level_name(setup.level) << " kernels" << std::endl;
+
+  auto& mesh = setup.grid.mesh();
+  std::mt19937 gen(1);
+  std::uniform_int_distribution<int> cell_dist(mesh.guard[0],
+                                               mesh.dims[0] - mesh.guard[0] - 1);
+  std::uniform_real_distribution<double> dist(0.0, 1.0);
+  Particles ptc(num);
+  for (Index_t i = 0; i < num; i++)
+    ptc.append(dist(gen), dist(gen) - 0.5, cell_dist(gen));
+  Blocks blocks(num);
+  blocks.copy_from(ptc);
+  // Some room for the last, partly filled block
+  std::vector<Pos_t> dx1(num + Blocks::lanes, 0.0);
+  ptc.displacement();
+
+  run_kernels(setup, ptc, blocks, dx1, repeat, "random order");
+
+  std::vector<Index_t> partitions;
+  timer::stamp("sort");
+  ptc.partition_and_sort(partitions, setup.grid, 8);
+  timer::show_duration_since_stamp("SoA sort", "ms", "sort");
+  timer::stamp("sort");
+  blocks.partition_and_sort(partitions, setup.grid, 8);
+  timer::show_duration_since_stamp("AoSoA sort", "ms", "sort");
+
+  run_kernels(setup, ptc, blocks, dx1, repeat, "sorted");
+  return 0;
+}
@@ -0,0 +1,65 @@
+#ifndef _SIM_TEST_ENV_H_
+#define _SIM_TEST_ENV_H_
+
+#include "sim_environment.h"
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace Aperture {
+
+/// An Environment for the tests that need SimData or PICSim, read from a
+/// small config file with the given lines added. Each one registers the MPI
+/// types, so only one can exist at a time
+class TestEnvironment {
+ public:
+  TestEnvironment(const std::string& conf, uint32_t data_interval = 20) {
+    namespace fs = boost::filesystem;
+    m_dir = fs::temp_directory_path() / fs::unique_path("aperture-test-%%%%-%%%%");
+    fs::create_directories(m_dir);
+    std::string filename = (m_dir / "test.conf").string();
+    std::ofstream file(filename);
+    file << "DELTA_T 0.1\n"
+         << "Q_E 1.0\n"
+         << "MAX_PART_NUM 100000\n"
+         << "MAX_PHOTON_NUM 100000\n"
+         << "DIM1 64 0.0 64.0 3\n"
+         << "DATADIR " << (m_dir / "Data").string() << "\n"
+         << conf << "\n";
+    file.close();
+
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    m_args = {"tests", "-c", filename, "-d", std::to_string(data_interval),
+              "-t", std::to_string(threads)};
+    for (auto& arg : m_args) m_argv.push_back(&arg[0]);
+    int argc = m_argv.size();
+    char** argv = m_argv.data();
+    m_env = std::make_unique<Environment>(&argc, &argv);
+  }
+  ~TestEnvironment() {
+    m_env.reset();
+    boost::system::error_code error;
+    boost::filesystem::remove_all(m_dir, error);
+  }
+
+  Environment& operator*() { return *m_env; }
+  Environment* operator->() { return m_env.get(); }
+
+ private:
+  boost::filesystem::path m_dir;
+  std::vector<std::string> m_args;
+  std::vector<char*> m_argv;
+  std::unique_ptr<Environment> m_env;
+};
+
+}
+
+#endif  // _SIM_TEST_ENV_H_
@@ -1,2 +1,12 @@
-#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_RUNNER
 #include "catch.hpp"
+#include <mpi.h>
+
+// MPI is set up here rather than by each Environment, so that the tests can
+// create and destroy environments one after the other
+int main(int argc, char* argv[]) {
+  MPI_Init(&argc, &argv);
+  int result = Catch::Session().run(argc, argv);
+  MPI_Finalize();
+  return result;
+}
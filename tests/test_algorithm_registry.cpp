@@ -0,0 +1,43 @@
+#include "algorithm_registry.h"
+#include "current_depositer.h"
+#include "field_solver.h"
+#include "particle_pusher.h"
+#include "catch.hpp"
+#include <sstream>
+
+using namespace Aperture;
+
+TEST_CASE("Built in algorithms are registered", "[registry]") {
+  auto& pushers = AlgorithmRegistry<ParticlePusher>::instance();
+  CHECK(pushers.default_name() == "geodesic");
+  CHECK(pushers.has("geodesic_scalar"));
+  CHECK(pushers.config_key() == "algorithm_ptc_push");
+
+  auto& depositers = AlgorithmRegistry<CurrentDepositer>::instance();
+  CHECK(depositers.default_name() == "Esirkepov");
+
+  auto& solvers = AlgorithmRegistry<FieldSolver>::instance();
+  CHECK(solvers.default_name() == "integral");
+  CHECK(solvers.has("implicit"));
+  CHECK(solvers.has("finite_diff"));
+  CHECK_FALSE(solvers.has("Integral"));
+
+  std::ostringstream os;
+  list_algorithms(os);
+  CHECK(os.str().find("finite_diff") != std::string::npos);
+  CHECK(os.str().find("algorithm_current_deposit") != std::string::npos);
+}
+
+TEST_CASE("Adding an algorithm under an existing name replaces it",
+          "[registry]") {
+  // A copy, so that the registry PICSim uses in other tests is untouched
+  auto solvers = AlgorithmRegistry<FieldSolver>::instance();
+  auto count = solvers.entries().size();
+  auto factory = solvers.entries().back().create;
+  solvers.add("test_solver", "first", factory);
+  solvers.add("test_solver", "second", factory);
+  CHECK(solvers.entries().size() == count + 1);
+  CHECK(solvers.entries().back().description == "second");
+  CHECK(solvers.default_name() == "integral");
+  CHECK_FALSE(AlgorithmRegistry<FieldSolver>::instance().has("test_solver"));
+}
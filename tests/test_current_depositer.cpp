@@ -0,0 +1,83 @@
+#include "algorithms/current_deposit_Esirkepov.h"
+#include "algorithms/current_deposit_kernels.h"
+#include "sim_data.h"
+#include "sim_test_env.h"
+#include "catch.hpp"
+#include <random>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace Aperture;
+
+namespace {
+
+// Electrons all over the grid, with a displacement from the last push of
+// up to a cell. Some slots are left empty
+void
+fill_moved(SimData& data, Index_t num) {
+  std::mt19937 gen(2468);
+  std::uniform_real_distribution<double> dist(0.0, 1.0);
+  auto& mesh = data.J.grid().mesh();
+  auto& part = data.particles[0];
+  for (Index_t i = 0; i < num; i++) {
+    int cell = mesh.guard[0] + 1 + (int)(dist(gen) * (mesh.reduced_dim(0) - 2));
+    part.append(dist(gen), 0.0, cell);
+  }
+  for (Index_t i = 7; i < num; i += 13) part.erase(i);
+  part.reserve_displacement();
+  for (Index_t i = 0; i < num; i++)
+    part.displacement()[i] = 0.9 * (2.0 * dist(gen) - 1.0);
+  // Only the electrons are deposited
+  for (Index_t sp = 0; sp < data.particles.size(); sp++) {
+    data.advance[sp] = (sp == 0);
+    data.deposit_rho[sp] = (sp == 0);
+  }
+}
+
+}
+
+TEST_CASE("Chunked deposit does not depend on the number of threads",
+          "[deposit]") {
+  TestEnvironment env("DIM1 256 0.0 256.0 3\n");
+  // Enough particles for 16 chunks of the smallest size
+  const Index_t num = 16 * 4096;
+  const double dt = 0.1;
+  SimData data(*env);
+  fill_moved(data, num);
+
+  CurrentDepositer_Esirkepov depositer(*env);
+  auto deposit = [&](int chunks, int threads) {
+    depositer.set_deposit_chunks(chunks);
+#ifdef _OPENMP
+    int num_threads = omp_get_max_threads();
+    omp_set_num_threads(threads);
+#endif
+    depositer.deposit(data, dt);
+#ifdef _OPENMP
+    omp_set_num_threads(num_threads);
+#endif
+    const int dim = data.J.grid().mesh().dims[0];
+    std::vector<Scalar> result(data.J_s[0].ptr(), data.J_s[0].ptr() + dim);
+    result.insert(result.end(), data.Rho[0].ptr(), data.Rho[0].ptr() + dim);
+    return result;
+  };
+
+  auto serial = deposit(16, 1);
+  auto threaded = deposit(16, 4);
+  CHECK(serial == threaded);
+
+  // A single chunk deposits straight into the arrays
+  auto single = deposit(1, 4);
+  auto& mesh = data.J.grid().mesh();
+  std::vector<Scalar> J(mesh.dims[0], 0.0), Rho(mesh.dims[0], 0.0);
+  auto& part = data.particles[0];
+  deposit_flux<1>(J.data(), Rho.data(), 0, part.data(), part.displacement(),
+                  0, part.number(), part.charge(), mesh.delta[0], dt);
+  J.insert(J.end(), Rho.begin(), Rho.end());
+  CHECK(single == J);
+  // The chunks only change the rounding
+  for (std::size_t i = 0; i < J.size(); i++)
+    CHECK(serial[i] == Approx(J[i]).margin(1.0e-10));
+}
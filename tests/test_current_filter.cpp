@@ -0,0 +1,231 @@
+#include "current_filter.h"
+#include "data/fields.h"
+#include "data/grid.h"
+#include "catch.hpp"
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace Aperture;
+
+namespace {
+
+// One pass at a time over the whole range, keeping the end points
+void
+filter_reference(std::vector<Scalar>& v, int begin, int end, int passes,
+                 bool compensate) {
+  int total = passes + (compensate ? 1 : 0);
+  for (int p = 0; p < total; p++) {
+    Scalar center = 0.5, side = 0.25;
+    if (p == passes) {
+      center = 1.0 + 0.5 * passes;
+      side = 0.5 * (1.0 - center);
+    }
+    std::vector<Scalar> old(v);
+    for (int i = begin + 1; i < end - 1; i++)
+      v[i] = center * old[i] + side * (old[i - 1] + old[i + 1]);
+  }
+}
+
+// Lets the two halves of a split domain wait for each other, the way the
+// ranks do in the guard cell exchange
+class Barrier {
+ public:
+  explicit Barrier(int count) : m_count(count) {}
+  void wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    int generation = m_generation;
+    if (++m_waiting == m_count) {
+      m_waiting = 0;
+      m_generation += 1;
+      m_cond.notify_all();
+    } else {
+      m_cond.wait(lock, [this, generation] { return generation != m_generation; });
+    }
+  }
+
+ private:
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  int m_count, m_waiting = 0, m_generation = 0;
+};
+
+// Filter J on a grid of 2n cells, and on the same grid split into two
+// halves of n cells that exchange their guard cells as
+// DomainCommunicator::get_guard_cells does, and check that both agree
+void
+check_split_filter(int passes, bool compensate, bool periodic) {
+  const int n = 32, g = 3;
+  Grid whole(std::array<std::string, 3>{"DIM1 64 0.0 10.0 3", "", ""});
+  std::vector<Grid> half{
+      Grid(std::array<std::string, 3>{"DIM1 32 0.0 5.0 3", "", ""}),
+      Grid(std::array<std::string, 3>{"DIM1 32 5.0 5.0 3", "", ""})};
+  const int dims = whole.mesh().dims[0];
+  std::mt19937 gen(passes);
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+
+  VectorField<Scalar> J(whole);
+  J.assign(0.0);
+  for (int i = 0; i < dims; i++) J(0, i) = dist(gen);
+  if (periodic) {
+    for (int i = 0; i < g - 1; i++) J(0, i) = 0.0;
+    J(0, g - 1) = J(0, g - 1 + 2 * n);
+  }
+  std::vector<VectorField<Scalar>> J_half;
+  for (int d = 0; d < 2; d++) {
+    J_half.emplace_back(half[d]);
+    J_half[d].assign(0.0);
+    for (int i = 0; i < n + 2 * g; i++) J_half[d](0, i) = J(0, i + d * n);
+  }
+
+  CurrentFilter filter(passes, compensate, periodic);
+  filter.apply(J);
+
+  Barrier barrier(2);
+  std::vector<int> exchanges(2, 0);
+  auto run = [&](int d) {
+    CurrentFilter f(passes, compensate, false);
+    f.set_boundary(!periodic && d == 0, !periodic && d == 1);
+    f.register_comm_callback([&, d](VectorField<Scalar>& j) {
+      barrier.wait();
+      // The lower guard cells come from the top of the bulk of the domain
+      // to the left, and the upper ones from the bottom of the one to the
+      // right
+      const auto& other = J_half[1 - d];
+      if (d == 1 || periodic)
+        for (int i = 0; i < g; i++) j(0, i) = other(0, n + i);
+      if (d == 0 || periodic)
+        for (int i = 0; i < g; i++) j(0, n + g + i) = other(0, g + i);
+      exchanges[d] += 1;
+      barrier.wait();
+    });
+    f.apply(J_half[d]);
+  };
+  std::thread lower(run, 0), upper(run, 1);
+  lower.join();
+  upper.join();
+
+  // One exchange for every guard - 1 passes
+  const int total = passes + (compensate ? 1 : 0);
+  CHECK(exchanges[0] == (total + g - 2) / (g - 1));
+  CHECK(exchanges[1] == exchanges[0]);
+  // Every face the halves own, including the one they share
+  for (int d = 0; d < 2; d++) {
+    for (int i = g - 1; i < n + g; i++)
+      CHECK(J_half[d](0, i) == Approx(J(0, i + d * n)).margin(1.0e-14));
+  }
+  if (!periodic) {
+    CHECK(J_half[0](0, 0) == J(0, 0));
+    CHECK(J_half[1](0, n + 2 * g - 1) == J(0, dims - 1));
+  }
+}
+
+}  // namespace
+
+TEST_CASE("Blocked filter agrees with one pass at a time", "[filter]") {
+  // Several blocks, and a last block that is not full
+  const int n = 5000;
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+  std::vector<Scalar> orig(n);
+  for (auto& x : orig) x = dist(gen);
+
+  std::vector<Scalar> buffer;
+  for (int passes = 1; passes <= 4; passes++) {
+    for (bool compensate : {false, true}) {
+      std::vector<Scalar> v(orig), ref(orig);
+      CurrentFilter::filter(v.data(), 3, n - 5, passes, compensate, buffer);
+      filter_reference(ref, 3, n - 5, passes, compensate);
+      for (int i = 0; i < n; i++) REQUIRE(v[i] == ref[i]);
+    }
+  }
+}
+
+TEST_CASE("Filter response to a single wave", "[filter]") {
+  const int n = 400;
+  std::vector<Scalar> buffer;
+  // The shortest wave is gone after one pass
+  std::vector<Scalar> v(n);
+  for (int i = 0; i < n; i++) v[i] = (i % 2 == 0 ? 1.0 : -1.0);
+  CurrentFilter::filter(v.data(), 0, n, 1, false, buffer);
+  for (int i = 1; i < n - 1; i++) CHECK(v[i] == Approx(0.0).margin(1.0e-15));
+
+  // A long wave is damped by cos(k/2)^2N, and much less with compensation
+  const double k = 0.2;
+  const int passes = 4;
+  double damping = std::pow(std::cos(0.5 * k), 2 * passes);
+  double compensation = 1.0 + 0.5 * passes * (1.0 - std::cos(k));
+  for (bool compensate : {false, true}) {
+    for (int i = 0; i < n; i++) v[i] = std::sin(k * i);
+    CurrentFilter::filter(v.data(), 0, n, passes, compensate, buffer);
+    double factor = damping * (compensate ? compensation : 1.0);
+    for (int i = 10; i < n - 10; i++)
+      CHECK(v[i] == Approx(factor * std::sin(k * i)).margin(1.0e-12));
+  }
+  CHECK(std::abs(damping * compensation - 1.0) < 0.1 * (1.0 - damping));
+}
+
+TEST_CASE("Periodic filter takes more passes than guard cells", "[filter]") {
+  Grid grid(std::array<std::string, 3>{"DIM1 64 0.0 10.0 3", "", ""});
+  auto& mesh = grid.mesh();
+  const int g = mesh.guard[0], n = mesh.reduced_dim(0);
+  VectorField<Scalar> J(grid);
+  std::mt19937 gen(11);
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+  // The n distinct faces, as the depositer leaves them
+  std::vector<Scalar> faces(n);
+  for (auto& x : faces) x = dist(gen);
+  J.assign(0.0);
+  for (int i = g; i < g + n; i++) J(0, i) = faces[i - g];
+  J(0, g - 1) = J(0, g - 1 + n);
+
+  const int passes = 7;
+  CurrentFilter filter(passes, true, true);
+  filter.apply(J);
+
+  // Filter a periodic copy long enough that its middle does not see the ends
+  std::vector<Scalar> ref(5 * n);
+  for (int i = 0; i < 5 * n; i++) ref[i] = faces[i % n];
+  filter_reference(ref, 0, 5 * n, passes, true);
+  double total = 0.0;
+  for (int i = g; i < g + n; i++) {
+    CHECK(J(0, i) == Approx(ref[2 * n + i - g]).margin(1.0e-14));
+    total += J(0, i) - faces[i - g];
+  }
+  CHECK(J(0, g - 1) == J(0, g - 1 + n));
+  // The filter conserves the total current
+  CHECK(total == Approx(0.0).margin(1.0e-12));
+}
+
+TEST_CASE("Non periodic filter keeps the boundary faces", "[filter]") {
+  Grid grid(std::array<std::string, 3>{"DIM1 64 0.0 10.0 3", "", ""});
+  auto& mesh = grid.mesh();
+  const int g = mesh.guard[0];
+  VectorField<Scalar> J(grid);
+  for (int i = 0; i < mesh.dims[0]; i++) J(0, i) = (i * i) % 7;
+  VectorField<Scalar> orig(J);
+
+  CurrentFilter filter(3);
+  filter.apply(J);
+  CHECK(J(0, g - 1) == orig(0, g - 1));
+  CHECK(J(0, mesh.dims[0] - g - 1) == orig(0, mesh.dims[0] - g - 1));
+  CHECK(J(0, g + 10) != orig(0, g + 10));
+  // Nothing outside the boundary faces changes
+  CHECK(J(0, 0) == orig(0, 0));
+  CHECK(J(0, mesh.dims[0] - 1) == orig(0, mesh.dims[0] - 1));
+}
+
+TEST_CASE("Filter on a split domain agrees with the whole domain", "[filter]") {
+  for (bool periodic : {false, true}) {
+    for (int passes : {1, 2, 5}) {
+      for (bool compensate : {false, true}) {
+        INFO("periodic " << periodic << ", passes " << passes
+                         << ", compensate " << compensate);
+        check_split_filter(passes, compensate, periodic);
+      }
+    }
+  }
+}
@@ -39,8 +39,8 @@ int main(int argc, char *argv[])
       // float e1p = 25.0*gamma*emin;
       float u1p = ph.draw_photon_u1p(e1p, gamma);
       // float ep = ph.draw_photon_ep(e1p, gamma);
-      float E_ph = ph.draw_photon_energy(gamma, p, x) / gamma;
-      // std::cout << ph.draw_photon_energy(gamma, p, x) << std::endl;
+      float E_ph = ph.draw_photon_energy(gamma, p, beta) / gamma;
+      // std::cout << ph.draw_photon_energy(gamma, p, beta) << std::endl;
 
       // float u = dist(g);
       // float E_target = emin * std::pow(1.0 - u, -1.0 / alpha);
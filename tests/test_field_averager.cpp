@@ -0,0 +1,77 @@
+#include "field_averager.h"
+#include "catch.hpp"
+
+using namespace Aperture;
+
+TEST_CASE("Sampling windows end right before the output", "[average]") {
+  // Whole interval
+  for (uint32_t s = 0; s < 30; s++) CHECK(FieldAverager::in_window(s, 10, 0, 1));
+  // The last 4 steps before every output at a multiple of 10
+  for (uint32_t s = 0; s < 30; s++)
+    CHECK(FieldAverager::in_window(s, 10, 4, 1) == (s % 10 >= 6));
+  // Every third step, counting back from the one before the output
+  for (uint32_t s = 0; s < 30; s++)
+    CHECK(FieldAverager::in_window(s, 10, 0, 3) == (s % 10 == 9 || s % 10 == 6 ||
+                                                    s % 10 == 3 || s % 10 == 0));
+  // A window longer than the interval is the whole interval
+  CHECK(FieldAverager::in_window(0, 10, 50, 1));
+}
+
+TEST_CASE("Averages are normalized by their own number of samples", "[average]") {
+  MultiArray<Scalar> a(16), b(16);
+  FieldAverager averager(10);
+  auto& a_avg = averager.add("a", a);
+  auto& b_avg = averager.add("b", b, 5, 2);
+  CHECK(averager.size() == 2);
+
+  for (uint32_t step = 0; step < 10; step++) {
+    for (int i = 0; i < 16; i++) {
+      a[i] = step + i;
+      b[i] = 2.0 * step;
+    }
+    averager.accumulate(step);
+  }
+  // b samples steps 5, 7 and 9
+  CHECK(averager.num_samples(0) == 10);
+  CHECK(averager.num_samples(1) == 3);
+  averager.normalize();
+  for (int i = 0; i < 16; i++) {
+    CHECK(a_avg[i] == Approx(4.5 + i));
+    CHECK(b_avg[i] == Approx(2.0 * 7.0));
+  }
+
+  // The sums start over after an output
+  CHECK(averager.num_samples(0) == 0);
+  a.assign(1.0);
+  averager.accumulate(10);
+  averager.normalize();
+  CHECK(a_avg[3] == Approx(1.0));
+  // Nothing was sampled for b
+  CHECK(b_avg[3] == 0.0);
+}
+
+TEST_CASE("A claimed sum is not accumulated again", "[average]") {
+  MultiArray<Scalar> a(8), b(8);
+  FieldAverager averager(4);
+  auto& a_avg = averager.add("a", a);
+  auto& b_avg = averager.add("b", b, 1);
+
+  for (uint32_t step = 0; step < 4; step++) {
+    a.assign(step);
+    b.assign(1.0);
+    // What a solver does while it updates a
+    Scalar* sum = averager.claim(a, step);
+    REQUIRE(sum != nullptr);
+    for (int i = 0; i < 8; i++) sum[i] += a[i];
+    CHECK(averager.claim(a, step) == nullptr);
+    // b is only sampled on the step before the output
+    CHECK((averager.claim(b, step) != nullptr) == (step == 3));
+    averager.accumulate(step);
+  }
+  CHECK(averager.num_samples(0) == 4);
+  CHECK(averager.num_samples(1) == 1);
+  averager.normalize();
+  CHECK(a_avg[5] == Approx(1.5));
+  // The claimed sample of b was never added
+  CHECK(b_avg[5] == 0.0);
+}
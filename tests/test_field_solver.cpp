@@ -0,0 +1,137 @@
+#include "algorithms/current_deposit_kernels.h"
+#include "algorithms/field_solver_implicit.h"
+#include "algorithms/ptc_pusher_geodesic.h"
+#include "data/background_geometry.h"
+#include "data/fields.h"
+#include "data/grid.h"
+#include "data/particles.h"
+#include "catch.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace Aperture;
+
+namespace {
+
+const std::array<std::string, 3> grid_conf = {"DIM1 64 0.0 64.0 3", "", ""};
+
+// Largest total energy of a cold plasma oscillation over the given number of
+// steps, relative to the initial one. Stops once it has grown a hundredfold
+double
+max_energy_ratio(double theta, double dt, int steps) {
+  Grid grid(grid_conf);
+  auto& mesh = grid.mesh();
+  const int g = mesh.guard[0];
+  VectorField<Scalar> E(grid), J(grid), J_old(grid), Jb(grid);
+  E.assign(0.0);
+  J_old.assign(0.0);
+  Jb.assign(0.0);
+  BackgroundGeometry geom(grid, [](double x) { return 0.0; });
+  ParticlePusher_Geodesic pusher;
+
+  // Cold electrons at rest away from the ends, in a small field. With unit
+  // charge and mass the plasma frequency is sqrt(ppc)
+  const int ppc = 16, lo = g + 8, hi = mesh.dims[0] - g - 8;
+  Particles ptc(ppc * (hi - lo), ParticleType::electron);
+  ptc.set_charge(-1.0);
+  ptc.set_mass(1.0);
+  for (int c = lo; c < hi; c++) {
+    for (int j = 0; j < ppc; j++) ptc.append((j + 0.5) / ppc, 0.0, c);
+  }
+  for (int i = lo; i < hi - 1; i++)
+    E(0, i) = 1.0e-4 * std::sin(2.0 * M_PI * (i + 1 - lo) / (hi - lo));
+
+  auto energy = [&]() {
+    double w = 0.0;
+    for (int i = 0; i < mesh.dims[0]; i++) w += 0.5 * E(0, i) * E(0, i);
+    for (Index_t n = 0; n < ptc.number(); n++)
+      w += 0.5 * ptc.data().p1[n] * ptc.data().p1[n];
+    return w;
+  };
+  const double w0 = energy();
+  double ratio = 1.0;
+  std::vector<Scalar> chi(mesh.dims[0]), E_old(mesh.dims[0]);
+  for (int step = 0; step < steps && ratio < 100.0; step++) {
+    // The same sequence as PICSim::step with FieldSolver_Implicit
+    std::fill(chi.begin(), chi.end(), 0.0);
+    FieldSolver_Implicit::add_susceptibility(ptc, geom, dt, dt, chi.data(), 0,
+                                             ptc.number());
+    std::copy(E.ptr(0), E.ptr(0) + mesh.dims[0], E_old.begin());
+    FieldSolver_Implicit::predict(E.ptr(0), J_old.ptr(0), Jb.ptr(0), chi.data(),
+                                  theta, dt, g - 1, mesh.dims[0] - g);
+    pusher.push(ptc, E, geom, dt);
+
+    J.assign(0.0);
+    deposit_flux<1>(J.ptr(0), nullptr, 0, ptc.data(), ptc.displacement(), 0,
+                    ptc.number(), ptc.charge(), mesh.delta[0], dt);
+    std::copy(E_old.begin(), E_old.end(), E.ptr(0));
+    for (int i = g - 1; i < mesh.dims[0] - g; i++) E(0, i) -= dt * J(0, i);
+    J_old = J;
+    ratio = std::max(ratio, energy() / w0);
+  }
+  return ratio;
+}
+
+}  // namespace
+
+TEST_CASE("Susceptibility uses the field interpolation weights", "[field]") {
+  Grid grid(grid_conf);
+  BackgroundGeometry geom(grid, [](double x) { return 0.0; });
+  Particles ptc(10, ParticleType::positron);
+  ptc.set_charge(2.0);
+  ptc.set_mass(4.0);
+  ptc.append(0.25, 0.0, 10);
+  // A relativistic particle barely responds, and one that ignores the field
+  // not at all
+  ptc.append(0.5, 100.0, 20);
+  ptc.append(0.5, 0.0, 30, bit_or(ParticleFlag::ignore_EM));
+
+  std::vector<Scalar> chi(grid.mesh().dims[0], 0.0);
+  FieldSolver_Implicit::add_susceptibility(ptc, geom, 0.5, 2.0, chi.data(), 0,
+                                           ptc.number());
+  // dt * dt_sp * q^2 / m at rest
+  CHECK(chi[9] == Approx(0.75));
+  CHECK(chi[10] == Approx(0.25));
+  CHECK(chi[20] == Approx(0.5 / std::pow(1.0 + 1.0e4, 1.5)));
+  CHECK(chi[29] == 0.0);
+  CHECK(chi[30] == 0.0);
+}
+
+TEST_CASE("Susceptibility is the response of the pusher velocity",
+          "[field]") {
+  Grid grid(grid_conf);
+  for (double b : {0.5, -0.5}) {
+    INFO("beta " << b);
+    BackgroundGeometry geom(grid, [b](double x) { return b; });
+    // The velocity of the pusher, which flips its sign for beta < 0
+    auto v = [b](double p) {
+      double g = std::sqrt(1.0 + p * p + b * b);
+      double s = (b < 0.0 ? -1.0 : 1.0);
+      return s * (s * p / g + b * b) / (1.0 + b * b);
+    };
+    Particles ptc(10, ParticleType::positron);
+    ptc.set_charge(1.0);
+    ptc.set_mass(1.0);
+    ptc.append(0.5, 0.3, 10);
+    ptc.append(0.5, -2.0, 20);
+
+    std::vector<Scalar> chi(grid.mesh().dims[0], 0.0);
+    FieldSolver_Implicit::add_susceptibility(ptc, geom, 1.0, 1.0, chi.data(),
+                                             0, ptc.number());
+    const double h = 1.0e-5;
+    CHECK(chi[10] == Approx(0.5 * (v(0.3 + h) - v(0.3 - h)) / (2.0 * h)));
+    CHECK(chi[20] == Approx(0.5 * (v(-2.0 + h) - v(-2.0 - h)) / (2.0 * h)));
+  }
+}
+
+TEST_CASE("Implicit update is stable beyond the plasma period", "[field]") {
+  // omega_p dt = 6, where the explicit scheme is far beyond its limit of 2
+  const double dt = 1.5;
+  CHECK(max_energy_ratio(0.0, dt, 200) > 100.0);
+  CHECK(max_energy_ratio(0.5, dt, 200) < 2.0);
+  CHECK(max_energy_ratio(1.0, dt, 200) < 2.0);
+  // Well within the explicit limit, both are stable. The energy is only
+  // roughly conserved, as E and p are not known at the same time
+  CHECK(max_energy_ratio(0.0, 0.1, 200) < 2.0);
+  CHECK(max_energy_ratio(0.5, 0.1, 200) < 2.0);
+}
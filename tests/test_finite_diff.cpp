@@ -0,0 +1,138 @@
+#include "algorithms/field_solver_finite_diff.h"
+#include "algorithms/field_solver_integral.h"
+#include "algorithms/finite_diff.h"
+#include "data/fields.h"
+#include "data/grid.h"
+#include "catch.hpp"
+#include <cmath>
+#include <random>
+
+using namespace Aperture;
+
+namespace {
+
+const std::array<std::string, 3> grid_conf = {
+    "DIM1 20 0.0 20.0 2", "DIM2 12 0.0 12.0 2", "DIM3 10 0.0 10.0 2"};
+
+}  // namespace
+
+TEST_CASE("Tiled derivative agrees with the reference", "[finite_diff]") {
+  Grid grid(grid_conf);
+  auto& mesh = grid.mesh();
+  std::mt19937 gen(3);
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+  MultiArray<Scalar> input(mesh.extent());
+  for (int i = 0; i < mesh.size(); i++) input[i] = dist(gen);
+
+  for (int order : {2, 4}) {
+    for (int dir = 0; dir < 3; dir++) {
+      for (unsigned long s = 0; s < 8; s++) {
+        Stagger_t stagger(s);
+        MultiArray<Scalar> out(mesh.extent()), ref(mesh.extent());
+        out.assign(1.0);
+        ref.assign(1.0);
+        FiniteDiff::derivative(grid, input, out, dir, stagger, 0.5, order);
+        FiniteDiff::derivative_reference(grid, input, ref, dir, stagger, 0.5,
+                                         order);
+        for (int i = 0; i < mesh.size(); i++) REQUIRE(out[i] == ref[i]);
+      }
+    }
+  }
+
+  MultiArray<Scalar> out(mesh.extent());
+  CHECK_THROWS_AS(FiniteDiff::derivative(grid, input, out, 3, Stagger_t(0)),
+                  std::invalid_argument);
+  CHECK_THROWS_AS(
+      FiniteDiff::derivative(grid, input, out, 0, Stagger_t(0), 1.0, 6),
+      std::invalid_argument);
+}
+
+TEST_CASE("Derivative of a linear function is exact", "[finite_diff]") {
+  Grid grid(grid_conf);
+  auto& mesh = grid.mesh();
+  for (int order : {2, 4}) {
+    for (int dir = 0; dir < 3; dir++) {
+      for (bool staggered : {false, true}) {
+        Stagger_t stagger;
+        stagger[dir] = staggered;
+        ScalarField<Scalar> f(grid, stagger), df(grid);
+        for (int i = 0; i < mesh.size(); i++)
+          f.data()[i] = 3.0 * mesh.pos_3d(i, stagger)[dir] + 1.0;
+        df.assign(0.0);
+        FiniteDiff::derivative(grid, f.data(), df.data(), dir, stagger, 1.0,
+                               order);
+        for (int k = mesh.guard[2]; k < mesh.dims[2] - mesh.guard[2]; k++) {
+          for (int j = mesh.guard[1]; j < mesh.dims[1] - mesh.guard[1]; j++) {
+            for (int i = mesh.guard[0]; i < mesh.dims[0] - mesh.guard[0]; i++)
+              CHECK(df(i, j, k) == Approx(3.0));
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("Vector identities hold on the staggered grid", "[finite_diff]") {
+  Grid grid(grid_conf);
+  auto& mesh = grid.mesh();
+  std::mt19937 gen(5);
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+
+  for (int order : {2, 4}) {
+    // curl grad f = 0
+    ScalarField<Scalar> f(grid);
+    for (int i = 0; i < mesh.size(); i++) f.data()[i] = dist(gen);
+    VectorField<Scalar> grad(grid), curl(grid);
+    FiniteDiff::compute_gradient(f, grad, order);
+    FiniteDiff::compute_curl(grad, curl, order);
+    // The first derivative is only right in the bulk, so the second one is
+    // only right further in
+    const int g = order + 1;
+    for (int n = 0; n < 3; n++) {
+      CHECK(grad.stagger(n) == Stagger_t(1ul << n));
+      for (int k = g; k < mesh.dims[2] - g; k++) {
+        for (int j = g; j < mesh.dims[1] - g; j++) {
+          for (int i = g; i < mesh.dims[0] - g; i++)
+            CHECK(curl(n, i, j, k) == Approx(0.0).margin(1.0e-13));
+        }
+      }
+    }
+
+    // div curl A = 0
+    VectorField<Scalar> A(grid);
+    for (int n = 0; n < 3; n++)
+      for (int i = 0; i < mesh.size(); i++) A.data(n)[i] = dist(gen);
+    ScalarField<Scalar> div(grid);
+    FiniteDiff::compute_curl(A, curl, order);
+    FiniteDiff::compute_divergence(curl, div, order);
+    CHECK(div.stagger() == Stagger_t("111"));
+    for (int k = g; k < mesh.dims[2] - g; k++) {
+      for (int j = g; j < mesh.dims[1] - g; j++) {
+        for (int i = g; i < mesh.dims[0] - g; i++)
+          CHECK(div(i, j, k) == Approx(0.0).margin(1.0e-13));
+      }
+    }
+  }
+}
+
+TEST_CASE("Finite difference solver in 1D matches the integral one",
+          "[finite_diff]") {
+  Grid grid(std::array<std::string, 3>{"DIM1 64 0.0 64.0 3", "", ""});
+  auto& mesh = grid.mesh();
+  VectorField<Scalar> E1(grid), E2(grid), B(grid), J(grid);
+  B.set_field_type(FieldType::B);
+  B.assign(0.0);
+  E1.assign(0.0);
+  J.assign(0.0);
+  for (int i = 0; i < mesh.dims[0]; i++) {
+    E1(0, i) = std::sin(0.1 * i);
+    J(0, i) = std::cos(0.3 * i);
+  }
+  E2 = E1;
+  FieldSolver_Integral integral(grid, grid);
+  FieldSolver_FiniteDiff finite_diff(grid, grid);
+  integral.update_fields(E1, B, J, 0.3);
+  finite_diff.update_fields(E2, B, J, 0.3);
+  for (int i = 0; i < mesh.dims[0]; i++) CHECK(E1(0, i) == E2(0, i));
+  for (int i = 0; i < mesh.dims[0]; i++) CHECK(B(2, i) == 0.0);
+}
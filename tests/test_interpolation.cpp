@@ -0,0 +1,136 @@
+#include "algorithms/current_deposit_kernels.h"
+#include "algorithms/interpolation.h"
+#include "data/particles.h"
+#include "catch.hpp"
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <vector>
+
+using namespace Aperture;
+
+namespace {
+
+template <int Order>
+void
+check_stencil() {
+  typedef shape_function<Order> shape;
+  Interpolator interp(Order);
+  REQUIRE((int)shape::radius == interp.radius());
+  REQUIRE((int)shape::support == interp.support());
+
+  int c = 20;
+  for (double x : {0.1, 0.25, 0.75, 0.999}) {
+    int first = c - shape::reach - 1;
+    double w[shape::width];
+    shape::stencil(x, c, first, w);
+    double sum = 0.0;
+    for (int k = 0; k < shape::width; k++) {
+      CHECK(w[k] == interp.interp_cell(x, c, first + k));
+      // The weight of a cell is the charge between its two faces
+      double upper = shape::cumulative((double)(first + k + 1 - c) - x);
+      double lower = shape::cumulative((double)(first + k - c) - x);
+      CHECK(upper - lower == Approx(w[k]).margin(1.0e-14));
+      sum += w[k];
+    }
+    CHECK(sum == Approx(1.0));
+  }
+}
+
+// Particles spread over the middle of a grid of dim cells, each with a
+// random displacement of less than a cell
+void
+fill_moving_particles(Particles& ptc, Index_t num, int dim, bool flagged) {
+  std::mt19937 gen(2718);
+  std::uniform_real_distribution<double> dist(0.0, 1.0);
+  for (Index_t i = 0; i < num; i++) {
+    uint32_t flag = 0;
+    if (flagged && i % 5 == 2) set_bit(flag, ParticleFlag::ignore_current);
+    ptc.append(dist(gen), 0.0, 10 + (int)(dist(gen) * (dim - 20)), flag);
+  }
+  auto dx1 = ptc.displacement();
+  for (Index_t i = 0; i < num; i++) dx1[i] = 1.8 * dist(gen) - 0.9;
+  if (flagged) {
+    for (Index_t i = 7; i < num; i += 13) ptc.erase(i);
+  }
+}
+
+template <int Order>
+void
+check_flux_deposit() {
+  const int dim = 100;
+  const Index_t num = 1001;
+  const double delta = 0.1, dt = 0.05;
+  // The sums are done in a different order, so they agree to rounding
+  const double eps = std::max(1.0e-10, 100.0 * std::numeric_limits<Scalar>::epsilon());
+  INFO("order " << Order);
+
+  {
+    // Agrees with the Esirkepov deposit followed by a scan
+    Particles ptc(num, ParticleType::electron);
+    ptc.set_charge(-1.0);
+    fill_moving_particles(ptc, num, dim, true);
+
+    std::vector<Scalar> J(dim, 0.0), Rho(dim, 0.0), J_ref(dim, 0.0),
+        Rho_ref(dim, 0.0);
+    deposit_flux<Order>(J.data(), Rho.data(), 0, ptc.data(),
+                        ptc.displacement(), 0, ptc.number(), ptc.charge(),
+                        delta, dt);
+    for (Index_t n = 0; n < ptc.number(); n++) {
+      if (ptc.is_empty(n)) continue;
+      deposit_delta_rho<Order>(J_ref.data(), Rho_ref.data(), 0, ptc.data(),
+                               ptc.displacement(), n, ptc.charge(), delta, dt);
+    }
+    for (int i = 1; i < dim; i++) J_ref[i] += J_ref[i - 1];
+    for (int i = 0; i < dim; i++) {
+      CHECK(J[i] == Approx(J_ref[i]).epsilon(eps).margin(10.0 * eps));
+      CHECK(Rho[i] == Approx(Rho_ref[i]).epsilon(eps).margin(eps));
+    }
+  }
+
+  {
+    // Satisfies the continuity equation
+    Particles ptc(num, ParticleType::electron);
+    fill_moving_particles(ptc, num, dim, false);
+    // The same particles at their old positions, not moving
+    Particles old(num, ParticleType::electron);
+    auto& d = ptc.data();
+    for (Index_t n = 0; n < num; n++) {
+      double x_p = d.x1[n] - ptc.displacement()[n];
+      int shift = (int)std::floor(x_p);
+      old.append(x_p - shift, 0.0, d.cell[n] + shift, 0);
+    }
+    auto dx0 = old.displacement();
+    for (Index_t n = 0; n < num; n++) dx0[n] = 0.0;
+
+    std::vector<Scalar> J(dim, 0.0), Rho(dim, 0.0), J_old(dim, 0.0),
+        Rho_old(dim, 0.0);
+    deposit_flux<Order>(J.data(), Rho.data(), 0, d, ptc.displacement(), 0,
+                        num, ptc.charge(), delta, dt);
+    deposit_flux<Order>(J_old.data(), Rho_old.data(), 0, old.data(),
+                        old.displacement(), 0, num, old.charge(), delta, dt);
+    for (int i = 0; i < dim; i++) REQUIRE(J_old[i] == 0.0);
+    // Gauss's law: the change of the charge in a cell is the net flux through
+    // its two faces
+    for (int i = 1; i < dim; i++) {
+      double div_J = (J[i] - J[i - 1]) * dt / delta;
+      CHECK(Rho[i] - Rho_old[i] == Approx(-div_J).margin(eps));
+    }
+  }
+}
+
+}
+
+TEST_CASE("Flux deposit conserves charge", "[interp]") {
+  check_flux_deposit<0>();
+  check_flux_deposit<1>();
+  check_flux_deposit<2>();
+  check_flux_deposit<3>();
+}
+
+TEST_CASE("Fixed order shape functions agree with the interpolator", "[interp]") {
+  check_stencil<0>();
+  check_stencil<1>();
+  check_stencil<2>();
+  check_stencil<3>();
+}
@@ -0,0 +1,442 @@
+#include "data/grid.h"
+#include "data/particle_blocks.h"
+#include "data/particles.h"
+#include "data/photons.h"
+#include "catch.hpp"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace Aperture;
+
+TEST_CASE("Compaction removes the holes and keeps the order", "[particles]") {
+  // More than a few chunks, so that the threaded part is exercised
+  const Index_t num = 20011;
+  Particles ptc(num, ParticleType::electron);
+  std::mt19937 gen(4321);
+  std::uniform_real_distribution<double> dist(0.0, 1.0);
+  for (Index_t i = 0; i < num; i++)
+    ptc.append(dist(gen), (double)i, 10 + i % 100, i % 3);
+
+  // Leave the first chunk intact, and punch holes of every size after it
+  std::vector<Index_t> live;
+  for (Index_t i = 0; i < num; i++) {
+    if (i >= 5000 && (dist(gen) < 0.3 || (i > 9000 && i < 13000)))
+      ptc.erase(i);
+    else if (i % 17 == 0)
+      ptc.mark_erase(i);
+    else
+      live.push_back(i);
+  }
+
+  ptc.compact();
+  REQUIRE(ptc.number() == live.size());
+  REQUIRE(ptc.marked().empty());
+  auto& d = ptc.data();
+  for (Index_t j = 0; j < live.size(); j++) {
+    Index_t i = live[j];
+    REQUIRE(!ptc.is_empty(j));
+    CHECK(d.p1[j] == (double)i);
+    CHECK(d.cell[j] == 10 + i % 100);
+    CHECK(d.flag[j] == i % 3);
+  }
+  for (Index_t j = live.size(); j < num; j++) REQUIRE(ptc.is_empty(j));
+
+  // Nothing changes for an array that is already dense
+  ptc.compact();
+  CHECK(ptc.number() == live.size());
+  CHECK(d.p1[live.size() - 1] == (double)live.back());
+}
+
+TEST_CASE("Compaction works on photons", "[particles]") {
+  Photons ph(100);
+  for (int i = 0; i < 50; i++) ph.append(0.5, (double)i, 1.0, 10 + i);
+  for (int i = 0; i < 50; i += 2) ph.erase(i);
+  ph.compact();
+  REQUIRE(ph.number() == 25);
+  for (int j = 0; j < 25; j++) {
+    CHECK(ph.data().p1[j] == (double)(2 * j + 1));
+    CHECK(ph.data().cell[j] == 11 + 2 * j);
+  }
+}
+
+TEST_CASE("Particle arrays grow in chunks and give them back", "[particles]") {
+  const Index_t chunk = Particles::chunk_size;
+  // The reservation is much smaller than what is put in
+  Particles ptc(1000, ParticleType::positron);
+  CHECK(ptc.capacity() == 0);
+  CHECK(ptc.memory() == 0);
+
+  const Index_t num = 3 * chunk + 5;
+  for (Index_t i = 0; i < num; i++) ptc.append(0.5, (double)i, i % 1000 + 3);
+  REQUIRE(ptc.number() == num);
+  CHECK(ptc.numMax() >= num);
+  CHECK(ptc.capacity() == 4 * chunk);
+  CHECK(ptc.peak_memory() == ptc.memory());
+  for (Index_t i = 0; i < num; i++) {
+    REQUIRE(ptc.data().p1[i] == (double)i);
+    REQUIRE(ptc.data().cell[i] == i % 1000 + 3);
+  }
+  // The new slots are empty
+  for (Index_t i = num; i < ptc.capacity(); i++) REQUIRE(ptc.is_empty(i));
+
+  // Once most of the particles are gone, the chunks above them are released
+  // and empty again when they are reused
+  auto peak = ptc.peak_memory();
+  ptc.erase(100, num - 100);
+  ptc.compact();
+  CHECK(ptc.number() == 100);
+  CHECK(ptc.capacity() == 2 * chunk);
+  CHECK(ptc.peak_memory() == peak);
+  for (Index_t i = 0; i < 100; i++) REQUIRE(ptc.data().p1[i] == (double)i);
+  ptc.put(3 * chunk, 0.5, 1.0, 5);
+  CHECK(ptc.capacity() == 4 * chunk);
+  for (Index_t i = 100; i < 3 * chunk; i++) REQUIRE(ptc.is_empty(i));
+
+  // A copy only holds what is in use
+  Particles copy(ptc);
+  CHECK(copy.number() == ptc.number());
+  CHECK(copy.capacity() == ptc.capacity());
+  CHECK(copy.data().p1[3 * chunk] == 1.0);
+}
+
+TEST_CASE("Sorting into tiles is stable", "[particles]") {
+  // 64 cells in the bulk, 8 tiles of 8 cells
+  Grid grid(std::array<std::string, 3>{"DIM1 64 0.0 64.0 2", "", ""});
+  auto& mesh = grid.mesh();
+  const Index_t num = 50000;
+  std::mt19937 gen(99);
+  std::uniform_int_distribution<int> cell_dist(0, mesh.dims[0] - 1);
+  std::uniform_real_distribution<double> dist(0.0, 1.0);
+
+  for (bool by_cell : {false, true}) {
+    Particles ptc(num);
+    for (Index_t i = 0; i < num; i++) {
+      ptc.append(dist(gen), (double)i, cell_dist(gen));
+      if (dist(gen) < 0.1) ptc.erase(i);
+    }
+    // What the sort should give: bulk particles by tile, or by cell, then
+    // the guard cells below and above, keeping the order within each
+    auto bin = [&](Index_t i) {
+      int c = ptc.data().cell[i];
+      if (ptc.is_empty(i)) return 1000;
+      if (c < mesh.guard[0]) return 200;
+      if (c >= mesh.dims[0] - mesh.guard[0]) return 300;
+      return (by_cell ? c : (c - mesh.guard[0]) / 8);
+    };
+    std::vector<Index_t> order(num);
+    for (Index_t i = 0; i < num; i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+                     [&](Index_t a, Index_t b) { return bin(a) < bin(b); });
+    Index_t live = 0;
+    for (Index_t i = 0; i < num; i++) live += !ptc.is_empty(i);
+    std::vector<double> expected;
+    for (Index_t j = 0; j < live; j++) expected.push_back(ptc.data().p1[order[j]]);
+
+    std::vector<Index_t> partitions;
+    ptc.partition_and_sort(partitions, grid, 8, by_cell);
+    REQUIRE(ptc.number() == live);
+    for (Index_t j = 0; j < live; j++) REQUIRE(ptc.data().p1[j] == expected[j]);
+    for (Index_t j = live; j < ptc.capacity(); j++) REQUIRE(ptc.is_empty(j));
+
+    // partitions holds where every tile starts
+    REQUIRE(partitions.size() == 8 + 29);
+    for (int t = 0; t < 8; t++) {
+      for (Index_t j = partitions[t]; j < partitions[t + 1]; j++)
+        REQUIRE((int)(ptc.data().cell[j] - mesh.guard[0]) / 8 == t);
+    }
+    CHECK(partitions[8 + 27] == live);
+  }
+}
+
+TEST_CASE("Rearranging the arrays applies a permutation", "[particles]") {
+  Particles ptc(100);
+  for (int i = 0; i < 10; i++) ptc.append(0.5, (double)i, 10 + i);
+  std::vector<Index_t> index = {3, 0, 1, 2};
+  ptc.rearrange_arrays(index, 4);
+  REQUIRE(ptc.number() == 10);
+  CHECK(ptc.data().p1[0] == 1.0);
+  CHECK(ptc.data().p1[3] == 0.0);
+  CHECK(ptc.data().cell[1] == 12);
+  for (int i = 4; i < 10; i++) CHECK(ptc.data().p1[i] == (double)i);
+}
+
+namespace {
+
+// Check that every particle is in the partition of its tile, or of its zone
+// outside of the bulk, or in the overflow, and that the particles are the
+// given ones
+void
+check_tiles(const Particles& ptc, const std::vector<Index_t>& partitions,
+            const Quadmesh& mesh, std::vector<double> ids) {
+  const int num_tiles = 8;
+  REQUIRE(partitions.size() == num_tiles + 29);
+  REQUIRE(partitions[num_tiles + 28] == ptc.number());
+  for (int p = 0; p < num_tiles + 27; p++) {
+    for (Index_t j = partitions[p]; j < partitions[p + 1]; j++) {
+      if (ptc.is_empty(j)) continue;
+      int c = ptc.data().cell[j];
+      int zone = mesh.find_zone(c);
+      if (p < num_tiles)
+        REQUIRE(((c - mesh.guard[0]) / 8 == p && zone == CENTER_ZONE));
+      else
+        REQUIRE(zone == p - num_tiles);
+    }
+  }
+  for (Index_t j = partitions[num_tiles + 27]; j < ptc.number(); j++)
+    REQUIRE_FALSE(ptc.is_empty(j));
+  for (Index_t j = ptc.number(); j < ptc.capacity(); j++)
+    REQUIRE(ptc.is_empty(j));
+  std::vector<double> result;
+  for (Index_t j = 0; j < ptc.number(); j++)
+    if (!ptc.is_empty(j)) result.push_back(ptc.data().p1[j]);
+  std::sort(result.begin(), result.end());
+  std::sort(ids.begin(), ids.end());
+  REQUIRE(result == ids);
+}
+
+}  // namespace
+
+TEST_CASE("Tiles are kept as particles move", "[particles]") {
+  Grid grid(std::array<std::string, 3>{"DIM1 64 0.0 64.0 2", "", ""});
+  auto& mesh = grid.mesh();
+  const int lo = mesh.guard[0], hi = mesh.dims[0] - mesh.guard[0];
+  const Index_t num = 20000;
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<int> cell_dist(lo, hi - 1);
+  std::uniform_int_distribution<int> step_dist(-1, 1);
+  std::uniform_real_distribution<double> dist(0.0, 1.0);
+
+  Particles ptc(num);
+  std::vector<double> ids;
+  for (Index_t i = 0; i < num; i++) {
+    ptc.append(dist(gen), (double)i, cell_dist(gen));
+    ids.push_back(i);
+  }
+  std::vector<Index_t> partitions;
+  REQUIRE_FALSE(ptc.maintain_tiles(partitions));
+  ptc.partition_and_sort(partitions, grid, 8);
+  REQUIRE(ptc.tiled());
+
+  // Moves to the next cell only swap particles across tile boundaries
+  for (int n = 0; n < 5; n++) {
+    for (Index_t i = 0; i < ptc.number(); i++) {
+      if (ptc.is_empty(i)) continue;
+      int c = ptc.data().cell[i] + step_dist(gen);
+      ptc.data().cell[i] = std::min(hi - 1, std::max(lo, c));
+    }
+    REQUIRE(ptc.maintain_tiles(partitions));
+    check_tiles(ptc, partitions, mesh, ids);
+  }
+
+  // Erasing, adding, and moving further fill the slack and the overflow,
+  // until they are merged
+  for (int n = 0; n < 5; n++) {
+    for (Index_t i = 0; i < ptc.number(); i++) {
+      if (ptc.is_empty(i)) continue;
+      double u = dist(gen);
+      if (u < 0.02) {
+        ids.erase(std::find(ids.begin(), ids.end(), ptc.data().p1[i]));
+        ptc.mark_erase(i);
+      } else if (u < 0.03) {
+        // Into the guard cells, or anywhere in the bulk
+        ptc.data().cell[i] = (u < 0.025 ? hi : cell_dist(gen));
+      } else {
+        int c = ptc.data().cell[i] + step_dist(gen);
+        if (mesh.is_in_bulk(ptc.data().cell[i]))
+          ptc.data().cell[i] = std::min(hi - 1, std::max(lo, c));
+      }
+    }
+    for (int i = 0; i < 100; i++) {
+      double id = num * (n + 1) + i;
+      ptc.append(0.5, id, cell_dist(gen));
+      ids.push_back(id);
+    }
+    REQUIRE(ptc.maintain_tiles(partitions));
+    check_tiles(ptc, partitions, mesh, ids);
+  }
+
+  // compact() keeps the tiles, which then stay as they are
+  for (Index_t i = 0; i < ptc.number(); i += 7) {
+    if (ptc.is_empty(i)) continue;
+    ids.erase(std::find(ids.begin(), ids.end(), ptc.data().p1[i]));
+    ptc.erase(i);
+  }
+  ptc.compact();
+  std::vector<double> before(ptc.data().p1, ptc.data().p1 + ptc.number());
+  REQUIRE(ptc.maintain_tiles(partitions));
+  check_tiles(ptc, partitions, mesh, ids);
+  CHECK(std::equal(before.begin(), before.end(), ptc.data().p1));
+}
+
+TEST_CASE("Keeping the tiles only moves the particles that left", "[particles]") {
+  Grid grid(std::array<std::string, 3>{"DIM1 64 0.0 64.0 2", "", ""});
+  auto& mesh = grid.mesh();
+  const int lo = mesh.guard[0], hi = mesh.dims[0] - mesh.guard[0];
+  const Index_t num = 20000;
+  std::mt19937 gen(11);
+  std::uniform_int_distribution<int> cell_dist(lo, hi - 1);
+  std::uniform_real_distribution<double> dist(0.0, 1.0);
+
+  Particles ptc(num);
+  std::vector<double> ids;
+  for (Index_t i = 0; i < num; i++) {
+    ptc.append(0.5, (double)i, cell_dist(gen));
+    ids.push_back(i);
+  }
+  std::vector<Index_t> partitions;
+  ptc.partition_and_sort(partitions, grid, 8);
+
+  int merged = 0;
+  for (int n = 0; n < 20; n++) {
+    // A few particles go to the next tile, fewer go further, some are
+    // erased and some are added
+    Index_t crossed = 0, far = 0, added = 0;
+    for (Index_t i = 0; i < ptc.number(); i++) {
+      if (ptc.is_empty(i)) continue;
+      int c = ptc.data().cell[i];
+      double u = dist(gen);
+      if (u < 0.01) {
+        ids.erase(std::find(ids.begin(), ids.end(), ptc.data().p1[i]));
+        ptc.mark_erase(i);
+      } else if (u < 0.012) {
+        int c_new = cell_dist(gen);
+        if ((c_new - lo) / 8 == (c - lo) / 8) continue;
+        ptc.data().cell[i] = c_new;
+        far += 1;
+      } else if (u < 0.05 && (c - lo) % 8 == 7 && c < hi - 1) {
+        ptc.data().cell[i] = c + 1;
+        crossed += 1;
+      }
+    }
+    for (int i = 0; i < 20; i++) {
+      double id = num * (n + 1) + i;
+      ptc.append(0.5, id, cell_dist(gen));
+      ids.push_back(id);
+      added += 1;
+    }
+    REQUIRE(ptc.maintain_tiles(partitions));
+    check_tiles(ptc, partitions, mesh, ids);
+    if (ptc.moved() == ptc.number()) {
+      merged += 1;
+    } else {
+      // A swap moves two particles, the rotation across the boundary one,
+      // and the overflow one for every particle it takes in and gives out
+      CHECK(ptc.moved() <= 3 * crossed + 2 * far + added);
+      CHECK(ptc.moved() < ptc.number() / 50);
+    }
+  }
+  // The slack and the overflow fill up, and are merged now and then
+  CHECK(merged > 0);
+  CHECK(merged < 10);
+}
+
+TEST_CASE("Particles can be visited by tile and by cell", "[particles]") {
+  Grid grid(std::array<std::string, 3>{"DIM1 64 0.0 64.0 2", "", ""});
+  auto& mesh = grid.mesh();
+  const Index_t num = 10000;
+  std::mt19937 gen(5);
+  std::uniform_int_distribution<int> cell_dist(0, mesh.dims[0] - 1);
+
+  for (bool by_cell : {false, true}) {
+    Particles ptc(num);
+    std::vector<int> count(mesh.dims[0], 0);
+    for (Index_t i = 0; i < num; i++) {
+      int c = cell_dist(gen);
+      ptc.append(0.5, (double)i, c);
+      count[c] += 1;
+    }
+    CHECK_THROWS_AS(ptc.num_tiles(), std::runtime_error);
+    std::vector<Index_t> partitions;
+    ptc.partition_and_sort(partitions, grid, 8, by_cell);
+    REQUIRE(ptc.num_tiles() == 8);
+
+    for (int c = 0; c < mesh.dims[0]; c++) {
+      int n = 0;
+      ptc.for_each_in_cell(c, [&](Index_t i) {
+        REQUIRE(ptc.data().cell[i] == c);
+        n += 1;
+      });
+      CHECK(n == count[c]);
+      if (by_cell && mesh.is_in_bulk(c))
+        CHECK(ptc.cell_range(c).size() == count[c]);
+    }
+    // The guard cells are in the zones below and above the bulk
+    CHECK(ptc.zone_range(12).size() == count[0] + count[1]);
+    CHECK(ptc.zone_range(14).size() ==
+          count[mesh.dims[0] - 1] + count[mesh.dims[0] - 2]);
+
+    // Every particle in the bulk is in exactly one tile. The visitor runs
+    // on the OpenMP threads, so only record what it sees and check after
+    std::vector<int> seen(ptc.number(), 0);
+    std::vector<int> tile(ptc.number(), -1);
+    ptc.parallel_for_each_tile([&](int t, ParticleRange range) {
+      for (Index_t i = range.begin; i < range.end; i++) {
+        tile[i] = t;
+        seen[i] += 1;
+      }
+    });
+    Index_t wrong_tile = 0;
+    for (Index_t i = 0; i < ptc.number(); i++) {
+      if (seen[i] > 0 &&
+          (int)(ptc.data().cell[i] - mesh.guard[0]) / 8 != tile[i])
+        wrong_tile += 1;
+    }
+    CHECK(wrong_tile == 0);
+    Index_t in_tiles = 0;
+    ptc.for_each_tile(
+        [&](int t, ParticleRange range) { in_tiles += range.size(); });
+    CHECK(in_tiles == ptc.number() - ptc.zone_range(12).size() -
+                          ptc.zone_range(14).size());
+    CHECK(std::count(seen.begin(), seen.end(), 1) == in_tiles);
+  }
+}
+
+TEST_CASE("Particle blocks hold the same particles", "[particles]") {
+  Grid grid(std::array<std::string, 3>{"DIM1 64 0.0 64.0 2", "", ""});
+  const Index_t num = 1003;
+  std::mt19937 gen(3);
+  std::uniform_int_distribution<int> cell_dist(0, grid.mesh().dims[0] - 1);
+  std::uniform_real_distribution<double> dist(0.0, 1.0);
+
+  Particles ptc(num);
+  for (Index_t i = 0; i < num; i++) {
+    ptc.append(dist(gen), (double)i, cell_dist(gen));
+    if (i % 10 == 0) ptc.erase(i);
+  }
+  // Starting small, so that the blocks have to grow
+  ParticleBlocks<single_particle_t, 16> blocks(20);
+  blocks.copy_from(ptc);
+  REQUIRE(blocks.number() == num);
+  REQUIRE(blocks.num_blocks() == (num + 15) / 16);
+  for (Index_t i = 0; i < num; i++) {
+    auto block = blocks.block(i / 16);
+    REQUIRE(block.p1[i % 16] == ptc.data().p1[i]);
+    REQUIRE(block.cell[i % 16] == ptc.data().cell[i]);
+    REQUIRE(blocks.is_empty(i) == ptc.is_empty(i));
+  }
+
+  // Sorting gives the same order either way
+  std::vector<Index_t> part_soa, part_blocks;
+  ptc.partition_and_sort(part_soa, grid, 8);
+  blocks.partition_and_sort(part_blocks, grid, 8);
+  REQUIRE(part_blocks == part_soa);
+  REQUIRE(blocks.number() == ptc.number());
+  for (Index_t i = 0; i < ptc.number(); i++)
+    REQUIRE(blocks[i].p1 == ptc.data().p1[i]);
+  // Kernels run over whole blocks, so every slot past the particles,
+  // including the rest of the last block, has to be empty
+  REQUIRE(blocks.numMax() > num);
+  Index_t dirty = 0;
+  for (Index_t i = ptc.number(); i < blocks.numMax(); i++) {
+    if (!blocks.is_empty(i) || blocks.block(i / 16).p1[i % 16] != 0.0)
+      dirty += 1;
+  }
+  CHECK(dirty == 0);
+
+  Particles back(10);
+  blocks.copy_to(back);
+  REQUIRE(back.number() == ptc.number());
+  for (Index_t i = 0; i < ptc.number(); i++)
+    REQUIRE(back.data().x1[i] == ptc.data().x1[i]);
+}
@@ -0,0 +1,299 @@
+#include "field_averager.h"
+#include "pic_sim.h"
+#include "sim_data.h"
+#include "sim_test_env.h"
+#include "catch.hpp"
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace Aperture;
+
+namespace {
+
+// Fill both species with the same particles, spread over the grid with
+// momenta up to p_max
+void
+fill_pairs(SimData& data, Index_t num, double p_max) {
+  std::mt19937 gen(4321);
+  std::uniform_real_distribution<double> dist(0.0, 1.0);
+  auto& mesh = data.E.grid().mesh();
+  for (Index_t i = 0; i < num; i++) {
+    int cell = mesh.guard[0] + (int)(dist(gen) * mesh.reduced_dim(0));
+    double x = dist(gen), p = p_max * (2.0 * dist(gen) - 1.0);
+    data.particles[0].append(x, p, cell);
+    data.particles[1].append(x, -p, cell);
+  }
+}
+
+template <typename T>
+std::vector<double>
+copy_array(const T* a, Index_t n) {
+  return std::vector<double>(a, a + n);
+}
+
+// What a run leaves behind. Every value fits in a double exactly, so two
+// runs can be compared bitwise
+struct SimState {
+  std::vector<double> E, E_avg, J;
+  std::vector<std::vector<double>> J_s, Rho, particles;
+
+  template <typename P>
+  void add_particles(const P& part) {
+    auto& d = part.data();
+    Index_t n = part.number();
+    particles.push_back(copy_array(d.x1, n));
+    particles.push_back(copy_array(d.p1, n));
+    particles.push_back(copy_array(d.cell, n));
+    particles.push_back(copy_array(d.flag, n));
+  }
+};
+
+// Run the given number of steps from the particles of fill_pairs, the way
+// main does
+SimState
+run_steps(const std::string& conf, uint32_t steps, double p_max = 1000.0,
+          uint32_t interval = 20) {
+  TestEnvironment env(conf, interval);
+  SimData data(*env);
+  fill_pairs(data, 2000, p_max);
+  PICSim sim(*env);
+  FieldAverager averager(interval);
+  auto& E_avg = averager.add("E1avg", data.E.data(0));
+  sim.set_averager(&averager);
+  for (uint32_t step = 0; step < steps; step++) {
+    sim.step(data, step);
+    averager.accumulate(step);
+  }
+  averager.normalize();
+
+  SimState state;
+  const Index_t dim = data.E.grid().mesh().dims[0];
+  state.E = copy_array(data.E.ptr(0), dim);
+  state.E_avg = copy_array(E_avg.data(), dim);
+  state.J = copy_array(data.J.ptr(0), dim);
+  for (Index_t sp = 0; sp < data.particles.size(); sp++) {
+    state.J_s.push_back(copy_array(data.J_s[sp].ptr(), dim));
+    state.Rho.push_back(copy_array(data.Rho[sp].ptr(), dim));
+    state.add_particles(data.particles[sp]);
+  }
+  state.add_particles(data.photons);
+  state.particles.push_back(
+      copy_array(data.photons.data().path_left, data.photons.number()));
+  return state;
+}
+
+// Run the given steps and check the subcycling of the electrons: J_s and
+// Rho are held between advances, the charge moved by an advance matches its
+// current, and no particle moves by more than half a cell in one advance.
+// Returns the subcycle of every advance
+std::vector<int>
+check_subcycling(const std::string& conf, uint32_t steps, double p_max) {
+  TestEnvironment env(conf);
+  SimData data(*env);
+  fill_pairs(data, 2000, p_max);
+  PICSim sim(*env);
+  auto& mesh = data.E.grid().mesh();
+  const int dim = mesh.dims[0];
+  const double dt = env->conf().delta_t;
+  auto& J_s = data.J_s[0];
+  auto& Rho = data.Rho[0];
+  std::vector<int> subcycles;
+  std::vector<double> J_held, Rho_held;
+  for (uint32_t step = 0; step < steps; step++) {
+    sim.step(data, step);
+    auto J_now = copy_array(J_s.ptr(), dim);
+    auto Rho_now = copy_array(Rho.ptr(), dim);
+    if (!data.advance[0]) {
+      CHECK(J_now == J_held);
+      CHECK(Rho_now == Rho_held);
+      continue;
+    }
+    subcycles.push_back(data.subcycle[0]);
+    auto& part = data.particles[0];
+    double max_dx = 0.0;
+    for (Index_t n = 0; n < part.number(); n++)
+      if (!part.is_empty(n))
+        max_dx = std::max(max_dx, std::abs((double)part.displacement()[n]));
+    CHECK(max_dx <= 0.5);
+    if (step > 0) {
+      // Away from the ends, where particles leave the grid
+      double dt_sp = data.subcycle[0] * dt;
+      for (int i = mesh.guard[0] + 2; i < dim - mesh.guard[0] - 2; i++) {
+        double div_J = (J_now[i] - J_now[i - 1]) * dt_sp / mesh.delta[0];
+        CHECK(Rho_now[i] - Rho_held[i] == Approx(-div_J).margin(1.0e-10));
+      }
+    }
+    J_held = J_now;
+    Rho_held = Rho_now;
+  }
+  return subcycles;
+}
+
+void
+check_same(const SimState& a, const SimState& b) {
+  CHECK(a.E == b.E);
+  CHECK(a.E_avg == b.E_avg);
+  CHECK(a.J == b.J);
+  CHECK(a.J_s == b.J_s);
+  CHECK(a.Rho == b.Rho);
+  REQUIRE(a.particles.size() == b.particles.size());
+  for (std::size_t i = 0; i < a.particles.size(); i++) {
+    INFO("particle array " << i);
+    CHECK(a.particles[i] == b.particles[i]);
+  }
+}
+
+}
+
+TEST_CASE("Empty slots kept in the tiles are skipped", "[pic]") {
+  TestEnvironment env("SUBCYCLE 0 0 0\n"
+                      "INCREMENTAL_SORT true\n"
+                      "CREATE_PAIRS true\n"
+                      "TRACE_PHOTONS true\n"
+                      "GAMMA_THR 5.0\n");
+  // The same particles, once with holes left by maintain_tiles and once
+  // without. Too few holes to trigger a merge
+  SimData holes(*env), packed(*env);
+  fill_pairs(holes, 4000, 1000.0);
+  fill_pairs(packed, 4000, 1000.0);
+  auto& grid = holes.E.grid();
+  for (Index_t sp = 0; sp < 2; sp++) {
+    auto& part = holes.particles[sp];
+    part.sort(grid);
+    for (Index_t i = 3; i < part.number(); i += 20) part.erase(i);
+    part.sort_incremental(grid);
+    REQUIRE(part.count_live() < part.number());
+    packed.particles[sp].sort(grid);
+    for (Index_t i = 3; i < packed.particles[sp].number(); i += 20)
+      packed.particles[sp].erase(i);
+    packed.particles[sp].compact();
+    REQUIRE(part.count_live() == packed.particles[sp].number());
+  }
+
+  // The photon emission and the automatic subcycle only see the live
+  // particles, so they come out the same for both
+  auto& mesh = grid.mesh();
+  holes.photons.emit_photons(holes.particles[0], holes.particles[1], mesh,
+                             holes.geometry);
+  packed.photons.emit_photons(packed.particles[0], packed.particles[1], mesh,
+                              packed.geometry);
+  REQUIRE(packed.photons.number() > 0);
+  REQUIRE(holes.photons.number() == packed.photons.number());
+  auto& ph_h = holes.photons.data();
+  auto& ph_p = packed.photons.data();
+  for (Index_t i = 0; i < packed.photons.number(); i++) {
+    CHECK(ph_h.cell[i] == ph_p.cell[i]);
+    CHECK(ph_h.x1[i] == ph_p.x1[i]);
+    CHECK(ph_h.p1[i] == ph_p.p1[i]);
+  }
+  for (Index_t sp = 0; sp < 2; sp++) {
+    auto& part = holes.particles[sp];
+    for (Index_t i = 0; i < part.number(); i++)
+      if (part.is_empty(i)) CHECK(part.data().p1[i] == 0.0);
+  }
+
+  PICSim sim_holes(*env), sim_packed(*env);
+  sim_holes.step(holes, 0);
+  sim_packed.step(packed, 0);
+  for (Index_t sp = 0; sp < 2; sp++) {
+    CHECK(holes.subcycle[sp] == packed.subcycle[sp]);
+    CHECK(holes.particles[sp].count_live() ==
+          packed.particles[sp].count_live());
+  }
+}
+
+TEST_CASE("Fused and staged step engines agree exactly", "[pic]") {
+  for (bool pairs : {false, true}) {
+    for (bool periodic : {false, true}) {
+      INFO("pairs " << pairs << ", periodic " << periodic);
+      std::string conf = std::string("CREATE_PAIRS ") +
+                         (pairs ? "true" : "false") +
+                         "\nTRACE_PHOTONS true\nGAMMA_THR 5.0\n" +
+                         "PERIODIC_BOUNDARY_1 " + (periodic ? "true" : "false") +
+                         "\n";
+      auto staged = run_steps(conf + "STEP_ENGINE staged\n", 12);
+      auto fused = run_steps(conf + "STEP_ENGINE fused\n", 12);
+      if (pairs) CHECK(staged.particles.back().size() > 0);
+      check_same(staged, fused);
+    }
+  }
+}
+
+TEST_CASE("Fused and staged field engines agree exactly", "[pic]") {
+  // The last grids are smaller than the two guard widths at either end that
+  // the fused update treats apart
+  for (std::string grid : {"DIM1 64 0.0 64.0 3", "DIM1 5 0.0 5.0 3",
+                           "DIM1 2 0.0 2.0 3"}) {
+    for (bool periodic : {false, true}) {
+      INFO(grid << ", periodic " << periodic);
+      std::string conf = grid + "\nPERIODIC_BOUNDARY_1 " +
+                         (periodic ? "true" : "false") + "\n";
+      auto staged = run_steps(conf + "FIELD_ENGINE staged\n", 12, 5.0, 5);
+      auto fused = run_steps(conf + "FIELD_ENGINE fused\n", 12, 5.0, 5);
+      check_same(staged, fused);
+    }
+  }
+}
+
+TEST_CASE("Subcycled species hold their current and conserve charge", "[pic]") {
+  SECTION("Manual subcycle") {
+    auto n = check_subcycling("SUBCYCLE 4 1 1\n", 13, 0.5);
+    CHECK(n == std::vector<int>({4, 4, 4, 4}));
+  }
+  SECTION("Manual subcycle that moves the particles too far") {
+    // Close to the speed of light the particles cross a cell in 10 steps
+    auto n = check_subcycling("SUBCYCLE 16 1 1\n", 13, 100.0);
+    REQUIRE(n.size() > 1);
+    for (int s : n) CHECK((s >= 1 && s <= 5));
+  }
+  SECTION("Automatic subcycle") {
+    auto n = check_subcycling("SUBCYCLE 0 1 1\n", 40, 0.2);
+    REQUIRE(n.size() > 1);
+    CHECK(n[0] > 1);
+    for (int s : n) CHECK((s >= 1 && s <= 16));
+  }
+}
+
+TEST_CASE("Only held and sampled currents are kept apart", "[pic]") {
+  // Output every 10 steps, averaged over the last 3
+  const std::string conf = "SUBCYCLE 1 2 1\n";
+  {
+    TestEnvironment env(conf + "DIAG_WINDOW 3\n", 10);
+    SimData data(*env);
+    fill_pairs(data, 2000, 5.0);
+    PICSim sim(*env);
+    const int dim = data.E.grid().mesh().dims[0];
+    std::vector<double> Rho_held;
+    for (uint32_t step = 0; step < 20; step++) {
+      INFO("step " << step);
+      sim.step(data, step);
+      CHECK(sim.sample_step(step) == (step % 10 >= 7));
+      // The electrons are advanced every step, and only deposit into J_s and
+      // Rho when the step is sampled
+      CHECK(data.deposit_rho[0] == sim.sample_step(step));
+      CHECK(data.keep_current[0] == sim.sample_step(step));
+      auto Rho_now = copy_array(data.Rho[0].ptr(), dim);
+      if (data.deposit_rho[0])
+        Rho_held = Rho_now;
+      else if (!Rho_held.empty())
+        CHECK(Rho_now == Rho_held);
+      // The positrons hold their current over two steps, and deposit Rho if
+      // either of them is sampled
+      CHECK(data.keep_current[1]);
+      if (data.advance[1])
+        CHECK(data.deposit_rho[1] ==
+              (sim.sample_step(step) || sim.sample_step(step + 1)));
+    }
+  }
+
+  // Depositing straight into J only changes the rounding. DIAG_WINDOW 0
+  // samples every step
+  auto direct = run_steps(conf + "DIAG_WINDOW 3\n", 20, 5.0, 10);
+  auto kept = run_steps(conf + "DIAG_WINDOW 0\n", 20, 5.0, 10);
+  REQUIRE(direct.J.size() == kept.J.size());
+  for (std::size_t i = 0; i < kept.J.size(); i++) {
+    CHECK(direct.J[i] == Approx(kept.J[i]).margin(1.0e-10));
+    CHECK(direct.E[i] == Approx(kept.E[i]).margin(1.0e-10));
+  }
+}
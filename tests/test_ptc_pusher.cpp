@@ -0,0 +1,210 @@
+#include "algorithms/functions.h"
+#include "algorithms/ptc_pusher_geodesic.h"
+#include "data/background_geometry.h"
+#include "data/fields.h"
+#include "data/grid.h"
+#include "data/particles.h"
+#include "utils/util_functions.h"
+#include "catch.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace Aperture;
+
+namespace {
+
+const std::array<std::string, 3> grid_conf = {"DIM1 256 0.0 100.0 3", "", ""};
+
+void
+fill_particles(Particles& ptc, const Grid& grid, Index_t num) {
+  std::mt19937 gen(1234);
+  std::uniform_real_distribution<double> dist(0.0, 1.0);
+  auto& mesh = grid.mesh();
+  // Keep the particles far enough from the boundaries that they do not
+  // leave the grid during the test
+  for (Index_t i = 0; i < num; i++) {
+    int cell = mesh.guard[0] + 10 + (int)(dist(gen) * (mesh.reduced_dim(0) - 20));
+    uint32_t flag = 0;
+    if (i % 7 == 3) set_bit(flag, ParticleFlag::ignore_EM);
+    ptc.append(dist(gen), 20.0 * dist(gen) - 10.0, cell, flag);
+  }
+  // Leave some holes in the array
+  for (Index_t i = 5; i < num; i += 11) ptc.erase(i);
+}
+
+}
+
+TEST_CASE("Background geometry interpolates the beta profile", "[pusher]") {
+  Grid grid(grid_conf);
+  auto& mesh = grid.mesh();
+  BackgroundGeometry geom(grid);
+  for (int c = mesh.guard[0]; c < mesh.dims[0] - mesh.guard[0]; c += 7) {
+    for (double x : {0.0, 0.25, 0.5, 0.9}) {
+      Pos_t x1 = x;
+      double b = beta_phi(mesh.pos(0, c, x1) / mesh.sizes[0]);
+      // beta_phi is linear, so the table reproduces it exactly
+      CHECK(geom.beta(c, x1) == Approx(b).epsilon(1.0e-12).margin(1.0e-14));
+      CHECK(geom.force(c, x1) ==
+            Approx(b / (0.5 * mesh.sizes[0])).epsilon(1.0e-12).margin(1.0e-14));
+      CHECK(geom.inv_b2p1(c, x1, b) == Approx(1.0 / (1.0 + b * b)).epsilon(1.0e-8));
+    }
+  }
+
+  // A user supplied profile
+  geom.set_beta_profile(grid, [](double x) { return 0.5; });
+  CHECK(geom.beta(10, 0.3) == Approx(0.5));
+  CHECK(geom.inv_b2p1(10, 0.3, 0.5) == Approx(0.8));
+}
+
+TEST_CASE("Vectorized geodesic push agrees with the scalar one", "[pusher]") {
+  Grid grid(grid_conf);
+  VectorField<Scalar> E(grid);
+  BackgroundGeometry geom(grid);
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+  for (int i = 0; i < grid.mesh().dims[0]; i++) E.data(0)[i] = dist(gen);
+
+  // An odd number so that the scalar remainder is exercised too
+  const Index_t num = 1003;
+  Particles ref(num + 16, ParticleType::electron);
+  ref.set_charge(-1.0);
+  fill_particles(ref, grid, num);
+
+  ParticlePusher_Geodesic pusher;
+  pusher.set_simd_level(SimdLevel::scalar);
+  for (int n = 0; n < 10; n++) pusher.push(ref, E, geom, 0.3);
+
+  for (auto level : {SimdLevel::avx2, SimdLevel::avx512}) {
+    pusher.set_simd_level(level);
+    if (pusher.simd_level() != level) continue;
+    INFO("simd level " << simd_level_name(level));
+
+    Particles ptc(num + 16, ParticleType::electron);
+    ptc.set_charge(-1.0);
+    fill_particles(ptc, grid, num);
+    for (int n = 0; n < 10; n++) pusher.push(ptc, E, geom, 0.3);
+
+    // A single rounding of the positions may differ when they are stored in
+    // single precision
+    const double eps = std::max(1.0e-10, 100.0 * std::numeric_limits<Pos_t>::epsilon());
+    REQUIRE(ptc.number() == ref.number());
+    for (Index_t i = 0; i < ptc.number(); i++) {
+      REQUIRE(ptc.is_empty(i) == ref.is_empty(i));
+      if (ref.is_empty(i)) continue;
+      auto& d = ptc.data();
+      auto& r = ref.data();
+      CHECK((double)d.cell[i] + d.x1[i] ==
+            Approx((double)r.cell[i] + r.x1[i]).epsilon(eps));
+      CHECK(d.p1[i] == Approx(r.p1[i]).epsilon(eps));
+#ifndef APERTURE_COMPACT_PARTICLES
+      CHECK(d.gamma[i] == Approx(r.gamma[i]).epsilon(eps));
+#endif
+      CHECK(ptc.displacement()[i] ==
+            Approx(ref.displacement()[i]).epsilon(100.0 * eps).margin(1.0e-12));
+      CHECK(d.flag[i] == r.flag[i]);
+    }
+  }
+}
+
+TEST_CASE("Boundary condition is applied in the mover", "[pusher]") {
+  Grid grid(grid_conf);
+  auto& mesh = grid.mesh();
+  VectorField<Scalar> E(grid);
+  BackgroundGeometry geom(grid);
+  geom.set_beta_profile(grid, [](double x) { return 0.0; });
+  int lower = mesh.guard[0];
+  int upper = mesh.dims[0] - mesh.guard[0];
+
+  for (auto level : {SimdLevel::scalar, SimdLevel::avx2, SimdLevel::avx512}) {
+    ParticlePusher_Geodesic pusher;
+    pusher.set_simd_level(level);
+    if (pusher.simd_level() != level) continue;
+    INFO("simd level " << simd_level_name(level));
+
+    // Fast particles right at both ends of the bulk, moving out, and a few
+    // that stay inside
+    const Index_t num = 40;
+    Particles ptc(num, ParticleType::electron);
+    for (Index_t i = 0; i < num; i++) {
+      if (i % 4 == 0)
+        ptc.append(0.01, -100.0, lower, 0);
+      else if (i % 4 == 1)
+        ptc.append(0.99, 100.0, upper - 1, 0);
+      else
+        ptc.append(0.5, 0.0, lower + 20, 0);
+    }
+    ptc.erase(10);
+
+    SECTION("periodic") {
+      pusher.set_periodic(true);
+      pusher.push(ptc, E, geom, 0.1);
+      CHECK(ptc.marked().empty());
+      for (Index_t i = 0; i < num; i++) {
+        if (i == 10) {
+          CHECK(ptc.is_empty(i));
+          continue;
+        }
+        int c = ptc.data().cell[i];
+        CHECK(c >= lower);
+        CHECK(c < upper);
+        if (i % 4 == 0) CHECK(c == upper - 1);
+        if (i % 4 == 1) CHECK(c == lower);
+      }
+    }
+
+    SECTION("absorbing") {
+      pusher.set_periodic(false);
+      pusher.push(ptc, E, geom, 0.1);
+      // Marked particles are still in place for the deposit
+      CHECK(ptc.marked().size() == num / 2);
+      for (auto n : ptc.marked()) CHECK(!ptc.is_empty(n));
+      ptc.erase_marked();
+      CHECK(ptc.marked().empty());
+      for (Index_t i = 0; i < num; i++)
+        CHECK(ptc.is_empty(i) == (i % 4 < 2 || i == 10));
+    }
+  }
+}
+
+#ifdef _OPENMP
+TEST_CASE("Threaded push is identical to the serial one", "[pusher]") {
+  Grid grid(grid_conf);
+  VectorField<Scalar> E(grid);
+  BackgroundGeometry geom(grid);
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+  for (int i = 0; i < grid.mesh().dims[0]; i++) E.data(0)[i] = dist(gen);
+
+  // Several chunks plus a remainder
+  const Index_t num = 20011;
+  Particles serial(num, ParticleType::electron);
+  Particles threaded(num, ParticleType::electron);
+  fill_particles(serial, grid, num);
+  fill_particles(threaded, grid, num);
+
+  ParticlePusher_Geodesic pusher;
+  int num_threads = omp_get_max_threads();
+  omp_set_num_threads(1);
+  for (int n = 0; n < 10; n++) pusher.push(serial, E, geom, 0.3);
+  omp_set_num_threads(4);
+  for (int n = 0; n < 10; n++) pusher.push(threaded, E, geom, 0.3);
+  omp_set_num_threads(num_threads);
+
+  auto& s = serial.data();
+  auto& t = threaded.data();
+  for (Index_t i = 0; i < num; i++) {
+    REQUIRE(s.cell[i] == t.cell[i]);
+    REQUIRE(s.x1[i] == t.x1[i]);
+    REQUIRE(serial.displacement()[i] == threaded.displacement()[i]);
+    REQUIRE(s.p1[i] == t.p1[i]);
+#ifndef APERTURE_COMPACT_PARTICLES
+    REQUIRE(s.gamma[i] == t.gamma[i]);
+#endif
+  }
+}
+#endif